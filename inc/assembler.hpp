@@ -0,0 +1,95 @@
+#ifndef __ASSEMBLER_HPP__
+#define __ASSEMBLER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vm
+{
+
+	namespace x64
+	{
+
+		enum Register
+		{
+			rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+			r8, r9, r10, r11, r12, r13, r14, r15
+		};
+
+		enum XmmRegister
+		{
+			xmm0, xmm1, xmm2, xmm3, xmm4, xmm5, xmm6, xmm7,
+			xmm8, xmm9, xmm10, xmm11, xmm12, xmm13, xmm14, xmm15
+		};
+
+	}
+
+	class Assembler
+	{
+	public:
+		Assembler();
+
+		Assembler(Assembler const &) = delete;
+		Assembler & operator=(Assembler const &) = delete;
+
+		Assembler(Assembler &&) = default;
+		Assembler & operator=(Assembler &&) = default;
+
+		std::vector<std::uint8_t> const & code() const noexcept;
+		std::size_t size() const noexcept;
+
+		void push(x64::Register reg);
+		void push(x64::Register base, std::int32_t disp);
+		void pop(x64::Register reg);
+
+		void mov(x64::Register dst, x64::Register src);
+		void mov(x64::Register dst, x64::Register base, std::int32_t disp);
+		void mov(x64::Register dst, std::uint32_t imm);
+		void movsd(x64::XmmRegister dst, x64::Register base, std::int32_t disp);
+		void movq(x64::Register dst, x64::XmmRegister src);
+
+		void sub(x64::Register dst, std::int32_t imm);
+		void add(x64::Register dst, std::int32_t imm);
+
+		void call(x64::Register target);
+		void leave();
+		void ret();
+
+	private:
+		std::vector<std::uint8_t> code_;
+
+		void emit(std::uint8_t byte);
+		void emit32(std::uint32_t value);
+		void rex(bool wide, unsigned reg, unsigned base);
+		void modrm(unsigned mod, unsigned reg, unsigned rm);
+		void memory(unsigned reg, x64::Register base, std::int32_t disp);
+	};
+
+	class ExecutableMemory
+	{
+	public:
+		ExecutableMemory() noexcept;
+		~ExecutableMemory();
+
+		ExecutableMemory(ExecutableMemory const &) = delete;
+		ExecutableMemory & operator=(ExecutableMemory const &) = delete;
+
+		ExecutableMemory(ExecutableMemory && other) noexcept;
+		ExecutableMemory & operator=(ExecutableMemory && other) noexcept;
+
+		ExecutableMemory & swap(ExecutableMemory & other) noexcept;
+
+		bool install(Assembler const & code);
+
+		void const * address() const noexcept;
+		std::size_t size() const noexcept;
+
+	private:
+		void *memory_;
+		std::size_t size_;
+	};
+
+}
+
+#endif /*__ASSEMBLER_HPP__*/
@@ -11,6 +11,7 @@
 #include <string>
 #include <map>
 #include <memory>
+#include <unordered_set>
 
 #include <common.hpp>
 #include <token.hpp>
@@ -30,6 +31,7 @@ namespace vm
 	class Scope;
 	class Block;
 	class Visitor;
+	class Transformer;
 
 	class ASTNode;
 
@@ -40,6 +42,7 @@ namespace vm
 	class DoubleLitNode;
 	class LoadNode;
 	class StoreNode;
+	class LetNode;
 	class ForNode;
 	class WhileNode;
 	class NativeCallNode;
@@ -50,6 +53,7 @@ namespace vm
 
 	class Function;
 	class Variable;
+	class Reduction;
 
 
 	class Signature
@@ -112,6 +116,8 @@ namespace vm
 		typedef Variables::const_iterator const_variable_iterator;
 		typedef Functions::const_iterator const_function_iterator;
 
+		typedef std::vector<Scope *>::const_iterator child_iterator;
+
 		Scope(Scope *owner = nullptr);
 		virtual ~Scope();
 
@@ -124,9 +130,15 @@ namespace vm
 		void define_variable(std::unique_ptr<Variable> var);
 		void define_function(std::unique_ptr<Function> fun);
 
+		/* takes fun, defined right in this scope, back from it */
+		std::unique_ptr<Function> release_function(Function * fun);
+
 		Scope * owner() noexcept;
 		Scope const * owner() const noexcept;
 
+		/* moves the scope with everything in it under another owner */
+		void set_owner(Scope * owner);
+
 		variable_iterator const variables_begin() noexcept;
 		variable_iterator const variables_end() noexcept;
 
@@ -139,13 +151,17 @@ namespace vm
 		const_function_iterator const functions_begin() const noexcept;
 		const_function_iterator const functions_end() const noexcept;
 
+		child_iterator const children_begin() const noexcept;
+		child_iterator const children_end() const noexcept;
+
 	private:
 		Variables variables_;
 		Functions functions_;
 		Scope *owner_;
-		std::vector<Scope const *> children_;
+		std::vector<Scope *> children_;
 
-		void register_child(Scope const * child);
+		void register_child(Scope * child);
+		void unregister_child(Scope * child) noexcept;
 	};
 
 	class ASTNode : public LocatedInFile
@@ -163,15 +179,7 @@ namespace vm
 
 		virtual void visit(Visitor &) { }
 		virtual void visit_children(Visitor &) { }
-
-		virtual void visit(Visitor const &) { }
-		virtual void visit_children(Visitor const &) { }
-
-		virtual void visit(Visitor &) const { }
-		virtual void visit_children(Visitor &) const { }
-
-		virtual void visit(Visitor const &) const { }
-		virtual void visit_children(Visitor const &) const { }
+		virtual void transform_children(Transformer &) { }
 	};
 
 	class Block : public ASTNode
@@ -209,6 +217,11 @@ namespace vm
 		ASTNode const * operator[](std::size_t index) const noexcept;
 
 		void push_back(std::unique_ptr<ASTNode> node);
+		void erase(iterator first, iterator last);
+
+		virtual void visit(Visitor & visitor);
+		virtual void visit_children(Visitor & visitor);
+		virtual void transform_children(Transformer & transformer);
 
 	private:
 		std::vector<ASTNode *> instructions_;
@@ -234,6 +247,10 @@ namespace vm
 		ASTNode * left() noexcept;
 		ASTNode * right() noexcept;
 
+		virtual void visit(Visitor & visitor);
+		virtual void visit_children(Visitor & visitor);
+		virtual void transform_children(Transformer & transformer);
+
 	private:
 		Token::Kind kind_;
 		ASTNode *left_;
@@ -253,22 +270,42 @@ namespace vm
 		ASTNode *operand() noexcept;
 		ASTNode const * operand() const noexcept;
 
+		virtual void visit(Visitor & visitor);
+		virtual void visit_children(Visitor & visitor);
+		virtual void transform_children(Transformer & transformer);
+
 	private:
 		Token::Kind kind_;
 		ASTNode *operand_;
 	};
 
+	/*
+	 * distinct string literals of a program, every literal node points
+	 * into it instead of holding a copy; interned strings never move
+	 */
+	class StringPool
+	{
+	public:
+		std::string const * intern(std::string const & value);
+		std::size_t size() const noexcept;
+
+	private:
+		std::unordered_set<std::string> strings_;
+	};
+
 	class StringLitNode : public ASTNode
 	{
 	public:
-		StringLitNode(std::string value,
+		StringLitNode(std::string const * value,
 						Location start = Location(),
-						Location finish = Location());
+						Location finish = Location()) noexcept;
 
 		std::string const & value() const noexcept;
 
+		virtual void visit(Visitor & visitor);
+
 	private:
-		std::string value_;
+		std::string const * value_;
 	};
 
 	class IntLitNode : public ASTNode
@@ -280,6 +317,8 @@ namespace vm
 
 		std::int64_t value() const noexcept;
 
+		virtual void visit(Visitor & visitor);
+
 	private:
 		std::int64_t value_;
 	};
@@ -293,6 +332,8 @@ namespace vm
 
 		double value() const noexcept;
 
+		virtual void visit(Visitor & visitor);
+
 	private:
 		double value_;
 	};
@@ -307,6 +348,8 @@ namespace vm
 		Variable * variable() noexcept;
 		Variable const * variable() const noexcept;
 
+		virtual void visit(Visitor & visitor);
+
 	private:
 		Variable * variable_;
 	};
@@ -330,29 +373,84 @@ namespace vm
 
 		Token::Kind kind() const noexcept;
 
+		virtual void visit(Visitor & visitor);
+		virtual void visit_children(Visitor & visitor);
+		virtual void transform_children(Transformer & transformer);
+
 	private:
 		Variable * variable_;
 		Token::Kind kind_;
 		ASTNode *expression_;
 	};
 
+	/*
+	 * stores the value of init to a variable and then has the value of
+	 * value; the inliner binds arguments to temporaries with it
+	 */
+	class LetNode : public ASTNode
+	{
+	public:
+		LetNode(Variable * var,
+					std::unique_ptr<ASTNode> init,
+					std::unique_ptr<ASTNode> value,
+					Location start = Location(),
+					Location finish = Location()) noexcept;
+
+		virtual ~LetNode();
+
+		Variable * variable() noexcept;
+		Variable const * variable() const noexcept;
+
+		ASTNode * init() noexcept;
+		ASTNode const * init() const noexcept;
+
+		ASTNode * value() noexcept;
+		ASTNode const * value() const noexcept;
+
+		virtual void visit(Visitor & visitor);
+		virtual void visit_children(Visitor & visitor);
+		virtual void transform_children(Transformer & transformer);
+
+	private:
+		Variable * variable_;
+		ASTNode * init_;
+		ASTNode * value_;
+	};
+
 	class NativeCallNode : public ASTNode
 	{
 	public:
-		NativeCallNode(std::unique_ptr<Signature> signature,
+		NativeCallNode(std::string native_name,
+						std::unique_ptr<Signature> signature,
 						Location start = Location(),
 						Location finish = Location()) noexcept;
 		virtual ~NativeCallNode();
 
 		std::string const & name() const noexcept;
+		std::string const & native_name() const noexcept;
+		Signature const & signature() const noexcept;
 		Type return_type() const noexcept;
 
 		std::size_t parameters_number() const noexcept;
 		Type at(std::size_t index) const noexcept;
 		Type operator[](std::size_t index) const noexcept;
 
+		bool is_bound() const noexcept;
+		void bind(NativeAddress address, NativeTrampoline trampoline) noexcept;
+
+		NativeAddress address() const noexcept;
+		NativeTrampoline trampoline() const noexcept;
+
+		/* args holds one slot per parameter in declaration order */
+		Value invoke(Value const * args) const noexcept;
+
+		virtual void visit(Visitor & visitor);
+
 	private:
+		std::string native_name_;
 		Signature *signature_;
+		NativeAddress address_;
+		NativeTrampoline trampoline_;
 	};
 
 	class ForNode : public ASTNode
@@ -375,10 +473,36 @@ namespace vm
 		Block * body() noexcept;
 		Block const * body() const noexcept;
 
+		/* bounds of a .. range expression, nullptr for other expressions */
+		ASTNode * from() noexcept;
+		ASTNode const * from() const noexcept;
+		ASTNode * to() noexcept;
+		ASTNode const * to() const noexcept;
+
+		/*
+		 * set by loop lowering: a counted loop iterates an int variable
+		 * over int bounds with a RangeCounter; if the body never writes
+		 * the variable it may live in a register for the whole loop
+		 */
+		bool is_counted() const noexcept;
+		bool writes_variable() const noexcept;
+		void set_counted(bool counted, bool writes_variable) noexcept;
+
+		/* vector form of the loop found by the vectorizer, if any */
+		Reduction const * reduction() const noexcept;
+		void set_reduction(std::unique_ptr<Reduction> reduction) noexcept;
+
+		virtual void visit(Visitor & visitor);
+		virtual void visit_children(Visitor & visitor);
+		virtual void transform_children(Transformer & transformer);
+
 	private:
 		Variable *variable_;
 		ASTNode * expr_;
 		Block *body_;
+		bool counted_;
+		bool writes_variable_;
+		Reduction *reduction_;
 	};
 
 	class WhileNode : public ASTNode
@@ -397,9 +521,20 @@ namespace vm
 		Block * body() noexcept;
 		Block const * body() const noexcept;
 
+		/* how often the condition held and failed in a profiled run */
+		std::uint64_t held() const noexcept;
+		std::uint64_t failed() const noexcept;
+		void count_branches(std::uint64_t held, std::uint64_t failed) noexcept;
+
+		virtual void visit(Visitor & visitor);
+		virtual void visit_children(Visitor & visitor);
+		virtual void transform_children(Transformer & transformer);
+
 	private:
 		ASTNode * expr_;
 		Block * body_;
+		std::uint64_t held_;
+		std::uint64_t failed_;
 	};
 
 	class ReturnNode : public ASTNode
@@ -414,6 +549,10 @@ namespace vm
 		ASTNode * expression() noexcept;
 		ASTNode const * expression() const noexcept;
 
+		virtual void visit(Visitor & visitor);
+		virtual void visit_children(Visitor & visitor);
+		virtual void transform_children(Transformer & transformer);
+
 	private:
 		ASTNode *expr_;
 	};
@@ -438,10 +577,27 @@ namespace vm
 		Block * else_block() noexcept;
 		Block const * else_block() const noexcept;
 
+		std::unique_ptr<Block> release_then_block() noexcept;
+		std::unique_ptr<Block> release_else_block() noexcept;
+
+		/* how often the condition held and failed in a profiled run */
+		std::uint64_t held() const noexcept;
+		std::uint64_t failed() const noexcept;
+		void count_branches(std::uint64_t held, std::uint64_t failed) noexcept;
+
+		/* an else block that ran more often than the then block is laid out first */
+		bool else_first() const noexcept;
+
+		virtual void visit(Visitor & visitor);
+		virtual void visit_children(Visitor & visitor);
+		virtual void transform_children(Transformer & transformer);
+
 	private:
 		ASTNode *expr_;
 		Block *thn_;
 		Block *els_;
+		std::uint64_t held_;
+		std::uint64_t failed_;
 	};
 
 	class CallNode : public ASTNode
@@ -464,9 +620,24 @@ namespace vm
 
 		void push_back(std::unique_ptr<ASTNode> arg);
 
+		/* callee bound once by the parser, never looked up by name again */
+		Function * function() noexcept;
+		Function const * function() const noexcept;
+		void set_function(Function * fun) noexcept;
+
+		/* number of calls made here in a profiled run */
+		std::uint64_t calls() const noexcept;
+		void count_call(std::uint64_t calls = 1) noexcept;
+
+		virtual void visit(Visitor & visitor);
+		virtual void visit_children(Visitor & visitor);
+		virtual void transform_children(Transformer & transformer);
+
 	private:
 		std::string name_;
 		std::vector<ASTNode *> params_;
+		Function * function_;
+		std::uint64_t calls_;
 	};
 
 	class PrintNode : public ASTNode
@@ -487,10 +658,56 @@ namespace vm
 
 		void push_back(std::unique_ptr<ASTNode> expr);
 
+		virtual void visit(Visitor & visitor);
+		virtual void visit_children(Visitor & visitor);
+		virtual void transform_children(Transformer & transformer);
+
 	private:
 		std::vector<ASTNode *> params_;
 	};
 
+#define FOR_NODES(NODE)		\
+		NODE(Block)				\
+		NODE(BinaryExprNode)	\
+		NODE(UnaryExprNode)		\
+		NODE(StringLitNode)		\
+		NODE(IntLitNode)		\
+		NODE(DoubleLitNode)		\
+		NODE(LoadNode)			\
+		NODE(StoreNode)			\
+		NODE(LetNode)			\
+		NODE(ForNode)			\
+		NODE(WhileNode)			\
+		NODE(NativeCallNode)	\
+		NODE(ReturnNode)		\
+		NODE(IfNode)			\
+		NODE(CallNode)			\
+		NODE(PrintNode)
+
+	/* every visit defaults to visiting the children of the node */
+	class Visitor
+	{
+	public:
+		virtual ~Visitor() { }
+
+		#define VISIT(n) virtual void visit(n & node);
+		FOR_NODES(VISIT)
+		#undef VISIT
+	};
+
+	class Transformer
+	{
+	public:
+		virtual ~Transformer() { }
+
+		/*
+		 * takes ownership of a child node and returns what should take its
+		 * place: the node itself, a new node or, for a statement, nullptr
+		 * to drop it from the enclosing block
+		 */
+		virtual std::unique_ptr<ASTNode> transform(std::unique_ptr<ASTNode> node) = 0;
+	};
+
 	class Function : public LocatedInFile
 	{
 	public:
@@ -511,9 +728,17 @@ namespace vm
 		Block * body() noexcept;
 		Block const * body() const noexcept;
 
+		NativeCallNode * native() noexcept;
+		NativeCallNode const * native() const noexcept;
+
+		/* number of calls observed by an executor, used to detect hot code */
+		std::uint64_t calls() const noexcept;
+		void count_call(std::uint64_t calls = 1) noexcept;
+
 	private:
 		Signature * signature_;
 		Block * body_;
+		std::uint64_t calls_;
 	};
 
 	class Variable : public LocatedInFile
@@ -0,0 +1,404 @@
+#ifndef __BYTECODE_HPP__
+#define __BYTECODE_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <ast.hpp>
+
+namespace vm
+{
+
+/*
+ * name, whether the argument is used and the stack effect; call, native
+ * and reduce pop a number of values that depends on their argument; ref
+ * pushes the address of a local, rload and rstore go through the address
+ * a local holds, which is how a nested function reaches the variables it
+ * captured. The opcodes after sprint are superinstructions only the
+ * peephole pass emits: load2 and loadi keep two operands in the halves of
+ * their argument, iaddi adds its argument, the int jumps compare the
+ * two ints on top and branch on the result and the di ops take a double
+ * and an int above it, converted as i2d would. deopt only appears in
+ * speculative code, see Speculator.
+ */
+#define FOR_OPCODES(OPCODE)	\
+		OPCODE(nop, 0, 0)			\
+		OPCODE(ipush, 1, 1)			\
+		OPCODE(iconst, 1, 1)		\
+		OPCODE(dconst, 1, 1)		\
+		OPCODE(sconst, 1, 1)		\
+		OPCODE(load, 1, 1)			\
+		OPCODE(store, 1, -1)		\
+		OPCODE(gload, 1, 1)			\
+		OPCODE(gstore, 1, -1)		\
+		OPCODE(iinc, 1, 0)			\
+		OPCODE(ref, 1, 1)			\
+		OPCODE(rload, 1, 1)			\
+		OPCODE(rstore, 1, -1)		\
+		OPCODE(pop, 0, -1)			\
+		OPCODE(i2d, 0, 0)			\
+		OPCODE(d2i, 0, 0)			\
+		OPCODE(iadd, 0, -1)			\
+		OPCODE(isub, 0, -1)			\
+		OPCODE(imul, 0, -1)			\
+		OPCODE(idiv, 0, -1)			\
+		OPCODE(imod, 0, -1)			\
+		OPCODE(ineg, 0, 0)			\
+		OPCODE(iand, 0, -1)			\
+		OPCODE(ior, 0, -1)			\
+		OPCODE(ixor, 0, -1)			\
+		OPCODE(inot, 0, 0)			\
+		OPCODE(lnot, 0, 0)			\
+		OPCODE(dadd, 0, -1)			\
+		OPCODE(dsub, 0, -1)			\
+		OPCODE(dmul, 0, -1)			\
+		OPCODE(ddiv, 0, -1)			\
+		OPCODE(dneg, 0, 0)			\
+		OPCODE(ieq, 0, -1)			\
+		OPCODE(ine, 0, -1)			\
+		OPCODE(ilt, 0, -1)			\
+		OPCODE(ile, 0, -1)			\
+		OPCODE(igt, 0, -1)			\
+		OPCODE(ige, 0, -1)			\
+		OPCODE(deq, 0, -1)			\
+		OPCODE(dne, 0, -1)			\
+		OPCODE(dlt, 0, -1)			\
+		OPCODE(dle, 0, -1)			\
+		OPCODE(dgt, 0, -1)			\
+		OPCODE(dge, 0, -1)			\
+		OPCODE(sadd, 0, -1)			\
+		OPCODE(seq, 0, -1)			\
+		OPCODE(sne, 0, -1)			\
+		OPCODE(jmp, 1, 0)			\
+		OPCODE(jz, 1, -1)			\
+		OPCODE(jnz, 1, -1)			\
+		OPCODE(call, 1, 0)			\
+		OPCODE(native, 1, 0)		\
+		OPCODE(reduce, 1, 0)		\
+		OPCODE(ret, 0, -1)			\
+		OPCODE(retv, 0, 0)			\
+		OPCODE(iprint, 0, -1)		\
+		OPCODE(dprint, 0, -1)		\
+		OPCODE(sprint, 0, -1)		\
+		OPCODE(load2, 1, 2)			\
+		OPCODE(loadi, 1, 2)			\
+		OPCODE(iaddi, 1, 0)			\
+		OPCODE(jieq, 1, -2)			\
+		OPCODE(jine, 1, -2)			\
+		OPCODE(jilt, 1, -2)			\
+		OPCODE(jile, 1, -2)			\
+		OPCODE(jigt, 1, -2)			\
+		OPCODE(jige, 1, -2)			\
+		OPCODE(diadd, 0, -1)		\
+		OPCODE(disub, 0, -1)		\
+		OPCODE(dimul, 0, -1)		\
+		OPCODE(didiv, 0, -1)		\
+		OPCODE(deopt, 1, 0)
+
+	class Opcode
+	{
+	public:
+		enum Kind
+		{
+
+			#define KIND(o, a, e) o,
+			FOR_OPCODES(KIND)
+			#undef KIND
+
+			opcode_count
+		};
+
+		static char const * name(Kind kind) noexcept;
+		static bool has_argument(Kind kind) noexcept;
+		static int stack_effect(Kind kind) noexcept;
+
+		/* the argument is an instruction index */
+		static bool is_jump(Kind kind) noexcept;
+
+		/* a jump that may fall through, and the one that goes the other way */
+		static bool is_conditional(Kind kind) noexcept;
+		static Kind inverse(Kind kind) noexcept;
+
+		/* the argument holds two operands, see Instruction::pack */
+		static bool has_operands(Kind kind) noexcept;
+	};
+
+	struct Instruction
+	{
+		Opcode::Kind opcode;
+		std::int32_t arg;
+
+		/* the low operand is a slot, the high one a signed 16 bit number */
+		static bool fits(std::int64_t low, std::int64_t high) noexcept
+		{ return low >= 0 && low <= 0xffff && high >= -0x8000 && high <= 0x7fff; }
+
+		static std::int32_t pack(std::int32_t low, std::int32_t high) noexcept
+		{ return static_cast<std::int32_t>((static_cast<std::uint32_t>(high) << 16) | static_cast<std::uint32_t>(low)); }
+
+		std::int32_t low() const noexcept
+		{ return static_cast<std::int32_t>(static_cast<std::uint32_t>(arg) & 0xffff); }
+
+		std::int32_t high() const noexcept
+		{ return static_cast<std::int16_t>(static_cast<std::uint32_t>(arg) >> 16); }
+	};
+
+	/*
+	 * a counter concurrent runs of a module add to without synchronizing,
+	 * every Interpreter in batches of its own counts; an addition may get
+	 * lost to another thread, a value never tears; add also seeds it with
+	 * the counts of an earlier run, see Feedback
+	 */
+	class Counter
+	{
+	public:
+		Counter() noexcept
+			: value_(0)
+		{ }
+
+		void increment() const noexcept
+		{ add(1); }
+
+		void add(std::uint64_t count) const noexcept
+		{ value_.store(value_.load(std::memory_order_relaxed) + count, std::memory_order_relaxed); }
+
+		std::uint64_t value() const noexcept
+		{ return value_.load(std::memory_order_relaxed); }
+
+	private:
+		mutable std::atomic<std::uint64_t> value_;
+	};
+
+	/* bytecode of a single function */
+	class Code
+	{
+	public:
+		typedef std::vector<Instruction> InstructionsType;
+
+		Code(std::string name, Type return_type, std::size_t parameters, std::size_t captures = 0);
+		~Code();
+
+		Code(Code const &) = delete;
+		Code & operator=(Code const &) = delete;
+
+		std::string const & name() const noexcept;
+		Type return_type() const noexcept;
+		std::size_t parameters_number() const noexcept;
+
+		/*
+		 * addresses of the captured variables a caller passes after the
+		 * arguments, zero for a function that captures nothing
+		 */
+		std::size_t captures_number() const noexcept;
+
+		/* parameters and then captures occupy the first slots of the locals */
+		std::size_t locals_number() const noexcept;
+		std::size_t allocate_local() noexcept;
+
+		/*
+		 * operand stack depth while emitting and the deepest it gets, for
+		 * the overflow check on call; code following an unconditional jump
+		 * resets the depth with set_stack
+		 */
+		std::size_t stack() const noexcept;
+		std::size_t max_stack() const noexcept;
+		void set_stack(std::size_t depth) noexcept;
+		void adjust_stack(int effect) noexcept;
+
+		std::size_t size() const noexcept;
+		Instruction const * instructions() const noexcept;
+		Instruction const & at(std::size_t index) const noexcept;
+		Location const & location_at(std::size_t index) const noexcept;
+
+		/* 0 based source line of an instruction, see Module::lines */
+		std::size_t line_at(std::size_t index) const noexcept;
+		void set_lines(LineTable const * lines) noexcept;
+
+		/* moves the known locations by the same distance, for code kept by a reload */
+		void relocate(std::ptrdiff_t delta) noexcept;
+
+		std::size_t emit(Opcode::Kind opcode, std::int32_t arg, Location const & location);
+		void patch(std::size_t index, std::int32_t arg) noexcept;
+
+		/* puts rewritten code in place of the emitted one, see peephole */
+		void rewrite(InstructionsType code, std::vector<Location> locations) noexcept;
+
+		/* equal constants, bit for bit, share one index */
+		std::size_t add_constant(Value value);
+		Value const & constant(std::size_t index) const noexcept;
+
+		/*
+		 * feedback of the runs, see Speculator: calls and the way each
+		 * conditional jump went, a call instruction is taken every time
+		 * it runs; seal sizes the branch counters once the instructions
+		 * are final
+		 */
+		void seal();
+		Counter const & calls() const noexcept;
+		Counter const & taken(std::size_t index) const noexcept;
+		Counter const & fallen(std::size_t index) const noexcept;
+
+		/*
+		 * a speculative copy of this code: the same frame layout and
+		 * constants, code instead of the instructions and deopt k resuming
+		 * this code at targets[k]
+		 */
+		std::unique_ptr<Code> derive(InstructionsType code, std::vector<Location> locations,
+					std::vector<std::size_t> targets) const;
+
+		/* the code a speculative one was derived from, nullptr for any other */
+		Code const * baseline() const noexcept;
+		std::size_t deopt_target(std::size_t index) const noexcept;
+		Counter const & deopts() const noexcept;
+
+		/*
+		 * the speculative version calls run instead of this code; the first
+		 * one installed stays and is owned by this code, install gives up
+		 * ownership even if it loses
+		 */
+		Code const * speculative() const noexcept;
+		bool install(std::unique_ptr<Code> speculative) const noexcept;
+
+		/* no speculative version runs or is derived from now on */
+		bool settled() const noexcept;
+		void settle() const noexcept;
+
+		/*
+		 * index of the function in its module, the module sets it and
+		 * speculative code has the one of its baseline; an interpreter
+		 * finds what it keeps for a function by it
+		 */
+		std::size_t slot() const noexcept;
+		void set_slot(std::size_t slot) noexcept;
+
+	private:
+		std::string name_;
+		Type return_type_;
+		std::size_t parameters_;
+		std::size_t captures_;
+		std::size_t locals_;
+		std::size_t stack_;
+		std::size_t max_stack_;
+		InstructionsType code_;
+		std::vector<Location> locations_;
+		std::vector<Value> constants_;
+		std::unordered_map<std::uint64_t, std::size_t> constant_indices_;
+		LineTable const * lines_;
+
+		std::unique_ptr<Counter[]> branches_;
+		Counter calls_;
+		Code const * baseline_;
+		std::vector<std::size_t> deopt_targets_;
+		Counter deopts_;
+		mutable std::atomic<Code *> speculative_;
+		mutable std::atomic<bool> settled_;
+		std::size_t slot_;
+	};
+
+	/*
+	 * compiled program: functions, globals and bindings of natives and
+	 * vectorized loops; reductions point into the AST, so the program must
+	 * outlive the module; once compiled only replace_function changes it,
+	 * any number of threads may run a module nothing replaces at once
+	 */
+	class Module
+	{
+	public:
+		struct Native
+		{
+			NativeAddress address;
+			NativeTrampoline trampoline;
+			std::size_t parameters;
+			Type return_type;
+		};
+
+		static std::size_t const npos = static_cast<std::size_t>(-1);
+
+		Module();
+		~Module();
+
+		Module(Module const &) = delete;
+		Module & operator=(Module const &) = delete;
+
+		std::size_t functions_number() const noexcept;
+		Code const & function(std::size_t index) const noexcept;
+		Code & function(std::size_t index) noexcept;
+		std::size_t add_function(std::unique_ptr<Code> code);
+
+		/* index of the first function of the name, npos if there is none */
+		std::size_t find_function(std::string const & name) const noexcept;
+
+		/*
+		 * the interpreter looks a callee up on every call, so the next
+		 * call of the slot runs the new code; the old code is kept until
+		 * the module is destroyed, frames that run it finish on it
+		 */
+		void replace_function(std::size_t index, std::unique_ptr<Code> code);
+
+		std::size_t entry() const noexcept;
+		void set_entry(std::size_t index) noexcept;
+
+		std::size_t globals_number() const noexcept;
+		std::size_t allocate_global() noexcept;
+
+		std::size_t natives_number() const noexcept;
+		Native const & native(std::size_t index) const noexcept;
+		std::size_t add_native(Native native);
+
+		std::size_t reductions_number() const noexcept;
+		Reduction const & reduction(std::size_t index) const noexcept;
+		std::size_t add_reduction(Reduction const * reduction);
+
+		/* string literals live as long as the module, each distinct one once */
+		char const * intern(std::string const & value);
+
+		/* line table of the source, shared by all functions of the module */
+		LineTable const & lines() const noexcept;
+		void set_lines(LineTable lines);
+
+		template <typename Stream>
+		Stream & dump(Stream & out) const
+		{
+			for (std::size_t index = 0; index != functions_.size(); ++index)
+			{
+				Code const & code = *functions_[index];
+				out << "function " << index << " " << code.name()
+					<< " (params " << code.parameters_number();
+				if (code.captures_number())
+					out << ", captures " << code.captures_number();
+				out << ", locals " << code.locals_number()
+					<< ", stack " << code.max_stack() << ")\n";
+
+				for (std::size_t pc = 0; pc != code.size(); ++pc)
+				{
+					Instruction const & insn = code.at(pc);
+					out << "\t" << pc << "\t" << Opcode::name(insn.opcode);
+					if (Opcode::has_operands(insn.opcode))
+						out << " " << insn.low() << " " << insn.high();
+					else if (Opcode::has_argument(insn.opcode))
+						out << " " << insn.arg;
+					out << "\n";
+				}
+			}
+			return out;
+		}
+
+	private:
+		std::vector<Code *> functions_;
+		std::vector<Code *> retired_;
+		std::size_t entry_;
+		std::size_t globals_;
+		std::vector<Native> natives_;
+		std::vector<Reduction const *> reductions_;
+		std::unordered_set<std::string> strings_;
+		LineTable lines_;
+	};
+
+}
+
+#endif /*__BYTECODE_HPP__*/
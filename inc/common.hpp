@@ -1,19 +1,78 @@
 #ifndef __COMMON_HPP__
 #define __COMMON_HPP__
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
 
 namespace vm
 {
 
+	union Value
+	{
+		std::int64_t as_int;
+		double as_double;
+		char const * as_string;
+
+		/* a slot of a captured variable, see Opcode::ref */
+		Value * as_ref;
+	};
+
+	typedef void (*NativeAddress)();
+	typedef Value (*NativeTrampoline)(NativeAddress target, Value const * args);
+
+	/*
+	 * iteration state of a counted loop over an inclusive int range: the
+	 * bounds are read once and the counter keeps the number of iterations
+	 * left, so a range ending at INT64_MAX never computes to + 1
+	 */
+	class RangeCounter
+	{
+	public:
+		RangeCounter(std::int64_t from, std::int64_t to) noexcept
+			: value_(from)
+			, left_(static_cast<std::uint64_t>(to) - static_cast<std::uint64_t>(from))
+			, done_(from > to)
+		{ }
+
+		bool done() const noexcept { return done_; }
+		std::int64_t value() const noexcept { return value_; }
+
+		/* trip count minus one: the full int64 range does not fit otherwise */
+		std::uint64_t last_index() const noexcept { return left_; }
+
+		void next() noexcept
+		{
+			if (!left_)
+			{
+				done_ = true;
+				return;
+			}
+
+			--left_;
+			value_ = static_cast<std::int64_t>(static_cast<std::uint64_t>(value_) + 1);
+		}
+
+	private:
+		std::int64_t value_;
+		std::uint64_t left_;
+		bool done_;
+	};
+
+	/*
+	 * byte offset into the source; line and column are only computed by
+	 * the LineTable of that source when a diagnostic needs them
+	 */
 	class Location
 	{
 	public:
-		static size_t const unreachable = static_cast<size_t>(-1);
+		static std::uint32_t const unreachable = static_cast<std::uint32_t>(-1);
 
-		Location(size_t line = unreachable,
-					size_t offset = unreachable) noexcept
-			: line_(line), offset_(offset)
+		explicit Location(std::uint32_t position = unreachable) noexcept
+			: position_(position)
 		{ }
 
 		Location(Location const &) noexcept = default;
@@ -23,20 +82,63 @@ namespace vm
 
 		Location & swap(Location & loc) noexcept
 		{
-			using std::swap;
+			std::swap(position_, loc.position_);
+			return *this;
+		}
 
-			std::swap(line_, loc.line_);
-			std::swap(offset_, loc.offset_);
+		std::uint32_t position() const noexcept { return position_; }
+		bool is_reachable() const noexcept { return position_ != unreachable; }
 
-			return *this;
+	private:
+		std::uint32_t position_;
+	};
+
+	/* starts of the lines of a source, built once by the scanner */
+	class LineTable
+	{
+	public:
+		static std::size_t const npos = static_cast<std::size_t>(-1);
+
+		LineTable() noexcept
+		{ }
+
+		explicit LineTable(std::string const & code)
+		{ assign(code); }
+
+		void assign(std::string const & code)
+		{
+			starts_.assign(1, 0);
+			char const * const begin = code.data();
+			char const * const end = begin + code.size();
+			char const * it = begin;
+			while ((it = static_cast<char const *>(std::memchr(it, '\n', end - it))) != nullptr)
+				starts_.push_back(static_cast<std::uint32_t>(++it - begin));
 		}
 
-		size_t line() const noexcept { return line_; }
-		size_t offset() const noexcept { return offset_; }
+		void clear() noexcept
+		{ starts_.clear(); }
+
+		std::size_t lines_number() const noexcept
+		{ return starts_.size(); }
+
+		/* 0 based line, or npos for an unreachable location */
+		std::size_t line(Location const & loc) const noexcept
+		{
+			if (!loc.is_reachable() || starts_.empty())
+				return npos;
+
+			return std::upper_bound(starts_.begin(), starts_.end(), loc.position()) - starts_.begin() - 1;
+		}
+
+		/* 0 based column in bytes, or npos */
+		std::size_t offset(Location const & loc) const noexcept
+		{
+			std::size_t const index = line(loc);
+			return index == npos ? npos : loc.position() - starts_[index];
+		}
 
 	private:
-		size_t line_;
-		size_t offset_;
+		std::vector<std::uint32_t> starts_;
 	};
 
 	class Status
@@ -0,0 +1,82 @@
+#ifndef __COMPILER_HPP__
+#define __COMPILER_HPP__
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ast.hpp>
+#include <bytecode.hpp>
+#include <parser.hpp>
+
+namespace vm
+{
+
+	/*
+	 * translates a parsed (and possibly optimized) program to stack
+	 * bytecode; variables of the top level scope become globals, every
+	 * other variable is a slot of the function that declares it. A slot
+	 * of a variable no nested function captures is reused by the scopes
+	 * that follow its own, so frames are only as large as the deepest
+	 * nesting of live variables. A nested function that uses variables of
+	 * enclosing ones gets their addresses from its caller after the
+	 * arguments, a flat environment; one that uses none is called with
+	 * the arguments alone. Natives must be linked before compilation.
+	 */
+	class Compiler
+	{
+	public:
+		typedef std::map<Variable const *, std::size_t> SlotsType;
+		typedef std::map<Function const *, std::size_t> FunctionsType;
+		typedef std::map<NativeCallNode const *, std::size_t> NativesType;
+		typedef std::vector<std::size_t> ReloadedType;
+
+		Compiler();
+
+		Compiler(Compiler const &) = delete;
+		Compiler & operator=(Compiler const &) = delete;
+
+		/* runs the peephole pass over every compiled function, on by default */
+		bool peephole() const noexcept;
+		void set_peephole(bool enable) noexcept;
+
+		std::unique_ptr<Module> compile(Program & program, Status & status);
+
+		/*
+		 * hot reload: brings the module this compiler compiled last up to
+		 * program, a new version of its source prepared the same way;
+		 * functions keep their slots by name, only the ones whose code
+		 * would differ are compiled again, the callers an optimizer
+		 * inlined them into included, and all of them replace their
+		 * slots together after every one compiled, or none does. Kept
+		 * code still points into the programs it was compiled from, they
+		 * must live as long as the module.
+		 */
+		Status::Code reload(Module & module, Program & program, ReloadedType & reloaded, Status & status);
+
+	private:
+		/* a function of the module by its name, see reload */
+		struct Compiled
+		{
+			std::size_t index;
+			Location start;
+			std::string shape;
+		};
+
+		typedef std::map<std::string, Compiled> CompiledType;
+		typedef std::map<std::string, std::size_t> NamesType;
+
+		SlotsType globals_;
+		FunctionsType functions_;
+		NativesType natives_;
+		NamesType names_;
+		CompiledType compiled_;
+		bool peephole_;
+
+		void allocate_globals(Module & module, Program & program);
+	};
+
+}
+
+#endif /*__COMPILER_HPP__*/
@@ -0,0 +1,90 @@
+#ifndef __ENGINE_HPP__
+#define __ENGINE_HPP__
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <bytecode.hpp>
+#include <interpreter.hpp>
+#include <optimizer.hpp>
+
+namespace vm
+{
+
+	class NativeLinker;
+
+	/*
+	 * the library entry point: parses, links, optionally optimizes and
+	 * compiles a source once; the module it returns is immutable and
+	 * keeps alive everything its code points to (the program and the
+	 * native trampolines), so it may outlive the engine
+	 */
+	class Engine
+	{
+	public:
+		Engine();
+		~Engine();
+
+		Engine(Engine const &) = delete;
+		Engine & operator=(Engine const &) = delete;
+
+		/* natives of later compiled sources are looked up in it too */
+		Status::Code load_library(std::string const & path, Status & status);
+
+		bool optimize() const noexcept;
+		void set_optimize(bool enable) noexcept;
+
+		Optimizer & optimizer() noexcept;
+
+		std::shared_ptr<Module const> compile(std::string const & code, Status & status);
+
+	private:
+		std::shared_ptr<NativeLinker> linker_;
+		Optimizer optimizer_;
+		bool optimize_;
+	};
+
+	/*
+	 * execution state of one request: the value stack, frames, globals
+	 * and strings built at run time, allocated once and reused by every
+	 * run and call; any number of contexts share one module, a context
+	 * is used by one thread at a time, so threads with a context each
+	 * run the same module concurrently without locks
+	 */
+	class Context
+	{
+	public:
+		static std::size_t const default_stack_size = 1 << 16;
+
+		Context(std::shared_ptr<Module const> module, std::ostream & out,
+					std::size_t stack_size = default_stack_size,
+					std::size_t max_frames = Interpreter::default_max_frames);
+
+		Context(Context const &) = delete;
+		Context & operator=(Context const &) = delete;
+
+		Module const & module() const noexcept;
+
+		/* the top level code, usually run once to set the globals up */
+		Status::Code run(Status & status);
+
+		/* see Interpreter::call, function is an index from Module::find_function */
+		Status::Code call(std::size_t function, std::vector<Value> const & args,
+					Value & result, Status & status);
+
+		void set_output(std::ostream & out) noexcept;
+
+		/* see Interpreter::set_speculator, contexts on several threads may share one */
+		void set_speculator(Speculator * speculator) noexcept;
+
+	private:
+		std::shared_ptr<Module const> module_;
+		Interpreter interpreter_;
+	};
+
+}
+
+#endif /*__ENGINE_HPP__*/
@@ -0,0 +1,86 @@
+#ifndef __FEEDBACK_HPP__
+#define __FEEDBACK_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+
+#include <ast.hpp>
+#include <bytecode.hpp>
+#include <parser.hpp>
+
+namespace vm
+{
+
+	/*
+	 * calls and branches a run recorded, kept across runs in a profile
+	 * file: how often every function was called, how often the condition
+	 * of every IfNode and WhileNode held and failed and how many calls
+	 * every CallNode made. A function is keyed by its name and the hash
+	 * of its source, nodes by their offset from the start of the
+	 * function, so a function that changed finds nothing and starts
+	 * over, while the others keep their counts. The top level code
+	 * hashes the whole source.
+	 *
+	 * A later run applies them to its program before it is optimized,
+	 * so hot calls are inlined and hot else blocks laid out first from
+	 * the start, and seeds the counters of its module with them, so the
+	 * Speculator takes a hot function at its first call; a run that
+	 * seeds its module and records it adds its counts to the seeds.
+	 */
+	class Feedback
+	{
+	public:
+		struct Branch
+		{
+			std::uint64_t held;
+			std::uint64_t failed;
+		};
+
+		struct Entry
+		{
+			std::uint64_t calls;
+			std::map<std::uint32_t, Branch> branches;
+			std::map<std::uint32_t, std::uint64_t> sites;
+		};
+
+		typedef std::pair<std::string, std::uint64_t> KeyType;
+		typedef std::map<KeyType, Entry> EntriesType;
+
+		Feedback() = default;
+
+		Feedback(Feedback const &) = delete;
+		Feedback & operator=(Feedback const &) = delete;
+
+		static std::uint64_t hash(std::string const & source, Function const & function) noexcept;
+
+		/*
+		 * adds what the code of module recorded while it ran, see
+		 * Interpreter::set_feedback; module was compiled from program,
+		 * which was parsed from source
+		 */
+		void record(Program & program, std::string const & source, Module const & module);
+
+		/* hands the counts to the functions and nodes of program, returns the functions found */
+		std::size_t apply(Program & program, std::string const & source) const;
+
+		/* adds the counts to the counters of the code module was compiled to */
+		void seed(Program & program, std::string const & source, Module const & module) const;
+
+		/* a malformed profile is not read at all */
+		bool read(std::istream & in);
+		void write(std::ostream & out) const;
+
+		EntriesType const & entries() const noexcept;
+
+	private:
+		EntriesType entries_;
+	};
+
+}
+
+#endif /*__FEEDBACK_HPP__*/
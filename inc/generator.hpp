@@ -0,0 +1,88 @@
+#ifndef __GENERATOR_HPP__
+#define __GENERATOR_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+namespace vm
+{
+
+	/*
+	 * Generates syntactically valid programs of configurable size and
+	 * shape for the scanner and parser benchmarks. The same seed always
+	 * gives the same program, so results of different commits can be
+	 * compared.
+	 */
+	class ProgramGenerator
+	{
+	public:
+		ProgramGenerator() noexcept;
+
+		ProgramGenerator(ProgramGenerator const &) = delete;
+		ProgramGenerator & operator=(ProgramGenerator const &) = delete;
+
+		std::uint32_t seed() const noexcept;
+		void set_seed(std::uint32_t seed) noexcept;
+
+		/* number of top level functions, each may call the previous ones */
+		std::size_t functions() const noexcept;
+		void set_functions(std::size_t count) noexcept;
+
+		/* statements in every function body, loops and ifs included */
+		std::size_t statements() const noexcept;
+		void set_statements(std::size_t count) noexcept;
+
+		/* maximum nesting of parenthesized subexpressions */
+		std::size_t expression_depth() const noexcept;
+		void set_expression_depth(std::size_t depth) noexcept;
+
+		/* operands of a single binary operator chain */
+		std::size_t expression_width() const noexcept;
+		void set_expression_width(std::size_t width) noexcept;
+
+		/* length of every string literal, zero disables strings */
+		std::size_t string_length() const noexcept;
+		void set_string_length(std::size_t length) noexcept;
+
+		/* comment lines emitted before every statement */
+		std::size_t comment_lines() const noexcept;
+		void set_comment_lines(std::size_t lines) noexcept;
+
+		std::string generate();
+
+	private:
+		std::uint32_t seed_;
+		std::size_t functions_;
+		std::size_t statements_;
+		std::size_t expression_depth_;
+		std::size_t expression_width_;
+		std::size_t string_length_;
+		std::size_t comment_lines_;
+
+		std::mt19937 random_;
+		std::string out_;
+		std::size_t function_;
+		std::size_t locals_;
+		std::size_t strings_;
+		std::size_t indent_;
+		std::size_t loops_;
+
+		std::size_t pick(std::size_t bound) noexcept;
+
+		void indent();
+		void line(std::string const & text);
+		void comments();
+
+		void generate_function(std::size_t index);
+		void generate_block(std::size_t level);
+		void generate_statement(std::size_t level);
+		void generate_expression(std::size_t depth, bool calls = true);
+		void generate_operand(bool calls);
+		void generate_string();
+	};
+
+}
+
+#endif /*__GENERATOR_HPP__*/
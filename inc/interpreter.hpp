@@ -0,0 +1,172 @@
+#ifndef __INTERPRETER_HPP__
+#define __INTERPRETER_HPP__
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <bytecode.hpp>
+#include <stack.hpp>
+
+namespace vm
+{
+
+	class PairCounter;
+	class Profiler;
+	class Speculator;
+
+	/*
+	 * executes a module from its entry function; locals and operands of
+	 * every frame share one value stack, print writes to the given stream;
+	 * a frame takes the locals_number + max_stack slots its Code computed
+	 * at compile time, so a call or a return only moves two pointers;
+	 * locals are not cleared, the compiler stores to every one of them
+	 * before it loads it
+	 */
+	class Interpreter
+	{
+	public:
+		static std::size_t const default_stack_size = 1 << 20;
+		static std::size_t const default_max_frames = 1 << 16;
+
+		/*
+		 * calls and branches are counted by every interpreter on its own;
+		 * the counts of a function go to its Code, which all interpreters
+		 * running the module share, every flush_calls calls of it and
+		 * when a run ends
+		 */
+		static std::uint64_t const flush_calls = 64;
+
+		/*
+		 * strings built at run time are collected once they take this
+		 * many bytes, or twice what the last collection kept
+		 */
+		static std::size_t const min_collect_bytes = 1 << 20;
+
+		explicit Interpreter(std::ostream & out,
+					std::size_t stack_size = default_stack_size,
+					std::size_t max_frames = default_max_frames);
+
+		Interpreter(Interpreter const &) = delete;
+		Interpreter & operator=(Interpreter const &) = delete;
+
+		/* runs the top level code, every global starts out zero */
+		Status::Code run(Module const & module, Status & status);
+
+		/*
+		 * runs one function of the module with args, one per parameter
+		 * of the right type, and stores what it returns in result; the
+		 * globals are the ones the last run left; strings a call builds,
+		 * result included, live until the next call or run unless a
+		 * global still points to them, so pass a string result back in
+		 * args or copy it out before calling again
+		 */
+		Status::Code call(Module const & module, std::size_t function,
+					Value const * args, Value & result, Status & status);
+
+		void set_output(std::ostream & out) noexcept;
+
+		/* samples are taken only while a profiler is set, and started */
+		void set_profiler(Profiler * profiler) noexcept;
+
+		/* counts every pair of instructions that run one after the other */
+		void set_pair_counter(PairCounter * pairs) noexcept;
+
+		/*
+		 * records calls and branches, see flush_calls, and runs the
+		 * speculative code of hot functions; the module must have been
+		 * compiled by a Compiler, which sizes the branch counters
+		 */
+		void set_speculator(Speculator * speculator) noexcept;
+
+		/* records calls and branches as above, without speculating */
+		void set_feedback(bool record) noexcept;
+
+	private:
+		struct Frame
+		{
+			Code const * code;
+			Instruction const * pc;
+			Value * locals;
+		};
+
+		/* runs function in the instantiation of execute the settings need */
+		Status::Code start(Module const & module, std::size_t function,
+					Value const * args, Value * result, Status & status);
+
+		template <bool Profiling, bool Recording>
+		Status::Code execute(Module const & module, std::size_t function,
+					Value const * args, Value * result, Status & status);
+
+		/*
+		 * what code has not been told yet, branches as Code::taken and
+		 * fallen; code is nullptr until the slot counts something. For a
+		 * baseline, runs is the code its calls run and runs_counts the
+		 * counts of that, nullptr until refresh asks the speculator
+		 */
+		struct Counts
+		{
+			Code const * code;
+			std::uint64_t calls;
+			std::vector<std::uint64_t> branches;
+			Code const * runs;
+			Counts * runs_counts;
+		};
+
+		/* two per function by Code::slot, for the baseline and the speculative code */
+		typedef std::vector<Counts> CountsType;
+
+		/* by the address of their characters, which a Value points to */
+		typedef std::unordered_map<char const *, std::unique_ptr<std::string> > StringsType;
+
+		void sample(Frame const * top, Code const * code, Instruction const * pc);
+
+		/* counts a call of baseline, returns the code it runs and sets counts to those of that */
+		Code const * enter(Code const & baseline, Counts * & counts);
+
+		/*
+		 * flushes the counts of a baseline that reached flush_calls and
+		 * sets what its calls run; a call only gets here then and after a
+		 * deopt, so what another interpreter installs or settles is seen
+		 * up to flush_calls calls late
+		 */
+		void refresh(Code const & baseline, Counts & called);
+		Counts & count(Code const & code);
+		void flush(Code const & code, Counts & counts) noexcept;
+		void flush() noexcept;
+
+		/* a string built at run time, a collection may run first */
+		char const * make_string(std::string value, Value const * top);
+
+		/*
+		 * frees the strings built at run time that no global and no
+		 * value in [stack begin, top) or in [begin, end) points to;
+		 * slots are not typed, so an int or a double that happens to hold
+		 * the address of one keeps it as well
+		 */
+		void collect(Value const * top, Value const * begin = nullptr, Value const * end = nullptr);
+
+		std::ostream * out_;
+		Profiler * profiler_;
+		PairCounter * pairs_;
+		Speculator * speculator_;
+		bool feedback_;
+		CountsType counts_;
+		/* the counts of the code of every frame, while recording */
+		std::vector<Counts *> frame_counts_;
+		StackMemory stack_;
+		StackMemory frames_;
+		std::vector<Value> globals_;
+
+		/* strings built at run time, all released when the next run starts */
+		StringsType strings_;
+		std::size_t string_bytes_;
+		std::size_t collect_bytes_;
+	};
+
+}
+
+#endif /*__INTERPRETER_HPP__*/
@@ -0,0 +1,57 @@
+#ifndef __NATIVE_HPP__
+#define __NATIVE_HPP__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <assembler.hpp>
+#include <common.hpp>
+#include <parser.hpp>
+#include <perf.hpp>
+
+namespace vm
+{
+
+	/*
+	 * Binds native function declarations to C symbols. Every bound
+	 * NativeCallNode gets the symbol address and a trampoline shared by
+	 * all natives of the same shape: the trampoline takes the target and
+	 * one Value slot per parameter and loads them straight into the System V
+	 * argument registers (or the stack when registers run out), so calling
+	 * a native costs a register shuffle and a direct call.
+	 */
+	class NativeLinker
+	{
+	public:
+		NativeLinker();
+		~NativeLinker();
+
+		NativeLinker(NativeLinker const &) = delete;
+		NativeLinker & operator=(NativeLinker const &) = delete;
+
+		NativeLinker(NativeLinker &&) = delete;
+		NativeLinker & operator=(NativeLinker &&) = delete;
+
+		Status::Code load_library(std::string const & path, Status & status);
+		Status::Code link(Program & program, Status & status);
+
+		NativeTrampoline trampoline(Signature const & signature);
+
+		/* new trampolines are reported to perf when set */
+		void set_perf(PerfWriter * perf) noexcept;
+
+	private:
+		typedef std::map<std::string, ExecutableMemory> TrampolinesType;
+
+		std::vector<void *> libraries_;
+		TrampolinesType trampolines_;
+		PerfWriter * perf_;
+
+		NativeAddress resolve(std::string const & symbol) const noexcept;
+		Status::Code link(Scope & scope, Status & status);
+	};
+
+}
+
+#endif /*__NATIVE_HPP__*/
@@ -0,0 +1,70 @@
+#ifndef __OPTIMIZER_HPP__
+#define __OPTIMIZER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <ast.hpp>
+#include <parser.hpp>
+
+namespace vm
+{
+
+	/* best effort static type of an expression, Type::Invalid if unknown */
+	Type expression_type(ASTNode * node) noexcept;
+
+	/*
+	 * the literal an operator applied to literals folds to, node itself
+	 * when its operands aren't literals or the result is left to run time
+	 */
+	std::unique_ptr<ASTNode> fold_literals(std::unique_ptr<ASTNode> node);
+
+	/* number of nodes in a subtree, statements and expressions alike */
+	std::size_t count_nodes(ASTNode & node);
+
+	class Optimizer
+	{
+	public:
+		static std::size_t const default_inline_budget = 16;
+		static std::size_t const default_hot_inline_budget = 64;
+		static std::uint64_t const default_hot_calls = 1000;
+
+		Optimizer() noexcept;
+
+		std::size_t inline_budget() const noexcept;
+		void set_inline_budget(std::size_t nodes) noexcept;
+
+		std::size_t hot_inline_budget() const noexcept;
+		void set_hot_inline_budget(std::size_t nodes) noexcept;
+
+		std::uint64_t hot_calls() const noexcept;
+		void set_hot_calls(std::uint64_t calls) noexcept;
+
+		/* lets vectorized double reductions reassociate additions */
+		bool fast_math() const noexcept;
+		void set_fast_math(bool enable) noexcept;
+
+		/*
+		 * folds and prunes every function, inlines small callees, folds
+		 * and prunes the merged bodies again and finally lowers and
+		 * vectorizes loops
+		 */
+		void optimize(Program & program);
+
+		bool fold_constants(Function & function);
+		bool eliminate_dead_code(Function & function);
+		bool inline_calls(Function & function, Scope const * globals);
+		void lower_loops(Function & function);
+		void vectorize_loops(Function & function);
+
+	private:
+		std::size_t inline_budget_;
+		std::size_t hot_inline_budget_;
+		std::uint64_t hot_calls_;
+		bool fast_math_;
+	};
+
+}
+
+#endif /*__OPTIMIZER_HPP__*/
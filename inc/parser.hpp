@@ -10,7 +10,8 @@ namespace vm
 	class Program
 	{
 	public:
-		Program(std::unique_ptr<Function> fun, std::unique_ptr<Scope> scope) noexcept;
+		Program(std::unique_ptr<Function> fun, std::unique_ptr<Scope> scope, LineTable lines = LineTable(),
+				std::shared_ptr<StringPool> strings = std::make_shared<StringPool>()) noexcept;
 		~Program();
 
 		Program(Program const &) = delete;
@@ -22,14 +23,43 @@ namespace vm
 		Function const * top_level() const noexcept;
 		Function * top_level() noexcept;
 
+		Scope const * scope() const noexcept;
+		Scope * scope() noexcept;
+
+		/* the top level function followed by every declared function */
+		std::vector<Function *> functions();
+
+		/* resolves the locations of the program's nodes to lines */
+		LineTable const & lines() const noexcept;
+
+		/* string literals of the program, shared with the programs reparsed from it */
+		std::shared_ptr<StringPool> const & strings() const noexcept;
+
 	private:
 		Function * top_;
 		Scope * scope_;
+		LineTable lines_;
+		std::shared_ptr<StringPool> strings_;
 	};
 
 	class Parser
 	{
 	public:
+		/* parenthesized expressions and call arguments nested deeper are rejected */
+		static std::size_t const max_expression_depth = 512;
+
+		/* every error of a recovering parse, in source order */
+		typedef std::vector<Status> DiagnosticsType;
+
+		/* what a reparse did to the functions of the previous program */
+		struct Changes
+		{
+			/* functions of the new program that were parsed anew */
+			std::vector<Function *> parsed;
+			/* functions of the previous program that are gone, only to compare against */
+			std::vector<Function const *> dropped;
+		};
+
 		Parser();
 		~Parser();
 
@@ -42,17 +72,95 @@ namespace vm
 		std::unique_ptr<Program> parse(std::string const & code);
 		std::unique_ptr<Program> parse(std::string const & code, Status & status);
 
+		/*
+		 * doesn't stop at the first error: skips to the next ; or } or
+		 * statement keyword and goes on; the program holds every statement
+		 * that parsed, status gets the first diagnostic
+		 */
+		std::unique_ptr<Program> parse(std::string const & code, Status & status, DiagnosticsType & diagnostics);
+
+		/*
+		 * parses the last parsed source with edit applied; previous must be
+		 * the program this parser returned last, not optimized since, its
+		 * top level functions the edit doesn't touch are moved to the new
+		 * program as they are instead of being parsed again
+		 */
+		std::unique_ptr<Program> reparse(std::unique_ptr<Program> previous, Edit const & edit,
+					Status & status, Changes & changes);
+
+		/* line table of the last parsed source, also for its errors */
+		LineTable const & lines() const noexcept;
+
 	private:
+		typedef std::vector<std::pair<CallNode *, Scope *> > CallSitesType;
+
+		/*
+		 * tokens [first, end) of a top level function and its calls; closed
+		 * tells if it uses no variables from outside, found out when it is
+		 * first reused
+		 */
+		struct Span
+		{
+			enum Closed
+			{
+				unknown,
+				closed,
+				open
+			};
+
+			Function * function;
+			std::size_t first;
+			std::size_t end;
+			CallSitesType calls;
+			Closed state;
+		};
+
+		typedef std::vector<Span> SpansType;
+
+		/* the program a reparse takes functions from and how its tokens moved */
+		struct Reuse
+		{
+			Program * previous;
+			Splice splice;
+			std::ptrdiff_t delta;
+			SpansType spans;
+			std::size_t next;
+			std::vector<Function *> reused;
+		};
+
+		/* parser state at the start of a statement to recover to */
+		struct Checkpoint
+		{
+			std::size_t pos;
+			std::size_t calls;
+			Scope * scope;
+		};
+
 		Scope *scope_;
 		Status *status_;
+		DiagnosticsType *diagnostics_;
 		TokenList tokens_;
 		std::size_t pos_;
+		Location end_;
+		CallSitesType calls_;
+		std::size_t depth_;
+		std::string code_;
+		Program const * program_;
+		SpansType spans_;
+		Reuse * reuse_;
+		std::shared_ptr<StringPool> strings_;
 
 		void error(std::string message, Location loc = Location());
 		bool is_ok() const noexcept;
 
+		Checkpoint checkpoint() const noexcept;
+		bool collect();
+		bool recover(Checkpoint const & from);
+		void synchronize() noexcept;
+
 		Token::Kind peek_token(std::size_t offset = 0) const noexcept;
 		Location location() const noexcept;
+		Location location(Token const & tok) const noexcept;
 		Token extract_token();
 		void consume_token(std::size_t count = 1) noexcept;
 		bool ensure_token(Token::Kind kind);
@@ -62,10 +170,15 @@ namespace vm
 		Scope * scope() noexcept;
 
 		void clear() noexcept;
+		std::unique_ptr<Program> parse_program(std::string const & code, Status & status, DiagnosticsType * diagnostics);
+		std::unique_ptr<Program> parse_tokens(Status & status, DiagnosticsType * diagnostics);
+		bool reuse_function();
+		void resolve_calls();
 		std::unique_ptr<Function> parse_toplevel();
 
-		std::unique_ptr<ASTNode> parse_binary(int precedence = 1);
+		std::unique_ptr<ASTNode> parse_binary(int power = 1);
 		std::unique_ptr<ASTNode> parse_unary();
+		std::unique_ptr<ASTNode> parse_primary();
 		std::unique_ptr<ASTNode> parse_int();
 		std::unique_ptr<ASTNode> parse_double();
 
@@ -81,6 +194,7 @@ namespace vm
 		std::unique_ptr<ASTNode> parse_declaration();
 		std::unique_ptr<ASTNode> parse_expression();
 		std::unique_ptr<Function> parse_function();
+		std::unique_ptr<Block> parse_native(Signature const & sign);
 	};
 
 }
@@ -0,0 +1,29 @@
+#ifndef __PEEPHOLE_HPP__
+#define __PEEPHOLE_HPP__
+
+#include <bytecode.hpp>
+
+namespace vm
+{
+
+	/*
+	 * rewrites the bytecode of a compiled function: jumps to jumps go
+	 * straight to the final target, jumps to the next instruction are
+	 * dropped and the hottest pairs the PairCounter found in the benchmark
+	 * programs are fused into superinstructions
+	 *
+	 *   load a, load b      -> load2 a b
+	 *   load a, ipush k     -> loadi a k
+	 *   ipush k, iadd/isub  -> iaddi (-)k
+	 *   icmp, jz/jnz        -> ji(!)cmp
+	 *   i2d, dop            -> diop
+	 *
+	 * nothing is fused across a jump target, so every jump still lands on
+	 * the first half of a pair; operands that do not fit the halves of an
+	 * argument leave the pair as it was
+	 */
+	void peephole(Code & code);
+
+}
+
+#endif /*__PEEPHOLE_HPP__*/
@@ -0,0 +1,60 @@
+#ifndef __PERF_HPP__
+#define __PERF_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace vm
+{
+
+	/*
+	 * tells linux perf about generated machine code: /tmp/perf-<pid>.map
+	 * names the code for perf report, /tmp/jit-<pid>.dump also carries the
+	 * code bytes and line tables for perf annotate (perf record -k mono,
+	 * then perf inject --jit); both may be open at the same time
+	 */
+	class PerfWriter
+	{
+	public:
+		/* code offset to 0 based source line */
+		struct Line
+		{
+			std::size_t offset;
+			std::size_t line;
+		};
+
+		typedef std::vector<Line> LinesType;
+
+		PerfWriter() noexcept;
+		~PerfWriter();
+
+		PerfWriter(PerfWriter const &) = delete;
+		PerfWriter & operator=(PerfWriter const &) = delete;
+
+		bool open_map(std::string const & directory = "/tmp");
+		bool open_jitdump(std::string const & directory = "/tmp");
+		void close();
+
+		bool is_open() const noexcept;
+
+		void load(std::string const & name, void const * address, std::size_t size,
+					std::string const & file = std::string(),
+					LinesType const & lines = LinesType());
+
+	private:
+		std::FILE * map_;
+		std::FILE * dump_;
+		void * marker_;
+		std::size_t marker_size_;
+		std::uint64_t index_;
+
+		void write_debug_info(void const * address, std::string const & file, LinesType const & lines);
+		void write_code_load(std::string const & name, void const * address, std::size_t size);
+	};
+
+}
+
+#endif /*__PERF_HPP__*/
@@ -0,0 +1,110 @@
+#ifndef __PROFILER_HPP__
+#define __PROFILER_HPP__
+
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <vector>
+
+#include <bytecode.hpp>
+
+namespace vm
+{
+
+	/*
+	 * SIGPROF based sampling profiler; the signal handler only counts
+	 * ticks, the interpreter polls them between instructions and records
+	 * the bytecode stack it is at, so nothing unsafe runs in the handler.
+	 * Samples keep pointers to Code, the modules must outlive reporting.
+	 */
+	class Profiler
+	{
+	public:
+		struct Site
+		{
+			Code const * code;
+			std::size_t offset;
+
+			bool operator<(Site const & other) const noexcept
+			{
+				return code < other.code
+					|| (code == other.code && offset < other.offset);
+			}
+		};
+
+		/* root (entry function) first, the sampled instruction last */
+		typedef std::vector<Site> StackType;
+		typedef std::map<StackType, std::size_t> StacksType;
+
+		explicit Profiler(unsigned frequency = 1000);
+		~Profiler();
+
+		Profiler(Profiler const &) = delete;
+		Profiler & operator=(Profiler const &) = delete;
+
+		/* only one profiler may be started at a time */
+		bool start();
+		void stop();
+
+		bool pending() const noexcept
+		{ return ticks_ != 0; }
+
+		/* attributes all ticks since the last sample to the stack */
+		void sample(StackType const & stack);
+
+		std::size_t samples() const noexcept;
+		StacksType const & stacks() const noexcept;
+
+		/* functions by self time, then the hottest source lines */
+		void report_flat(std::ostream & out) const;
+
+		/* one "caller;callee count" line per stack, for flamegraph.pl */
+		void report_folded(std::ostream & out) const;
+
+	private:
+		static void handler(int);
+
+		static volatile std::sig_atomic_t ticks_;
+
+		unsigned frequency_;
+		bool running_;
+		std::size_t samples_;
+		StacksType stacks_;
+		struct sigaction previous_;
+	};
+
+	/*
+	 * how often each opcode ran right after another one, calls and returns
+	 * included; the superinstructions of the peephole pass are picked from
+	 * the hottest pairs of the benchmark programs
+	 */
+	class PairCounter
+	{
+	public:
+		PairCounter() noexcept;
+
+		PairCounter(PairCounter const &) = delete;
+		PairCounter & operator=(PairCounter const &) = delete;
+
+		void count(Opcode::Kind first, Opcode::Kind second) noexcept
+		{
+			++counts_[first][second];
+			++total_;
+		}
+
+		std::uint64_t count_of(Opcode::Kind first, Opcode::Kind second) const noexcept;
+		std::uint64_t total() const noexcept;
+
+		/* the limit most frequent pairs with their share of all pairs */
+		void report(std::ostream & out, std::size_t limit = 20) const;
+
+	private:
+		std::uint64_t counts_[Opcode::opcode_count][Opcode::opcode_count];
+		std::uint64_t total_;
+	};
+
+}
+
+#endif /*__PROFILER_HPP__*/
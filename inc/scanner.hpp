@@ -1,4 +1,6 @@
 #include <cassert>
+#include <cstddef>
+#include <string>
 #include <vector>
 
 #include <token.hpp>
@@ -6,6 +8,28 @@
 namespace vm
 {
 
+	/* replaces length bytes of a source at offset with text */
+	struct Edit
+	{
+		std::size_t offset;
+		std::size_t length;
+		std::string text;
+
+		std::string apply(std::string const & code) const;
+	};
+
+	/*
+	 * tokens [0, first) of a rescan are the old ones, old tokens
+	 * [first, old_end) became new [first, new_end) and the rest are
+	 * the old ones moved by the size change of the edit
+	 */
+	struct Splice
+	{
+		std::size_t first;
+		std::size_t old_end;
+		std::size_t new_end;
+	};
+
 	class TokenList
 	{
 	public:
@@ -18,13 +42,21 @@ namespace vm
 
 		void push_back(Token token);
 		void emplace_back(Token::Kind kind, std::string value, Location loc);
+		void emplace_back(Token::Kind kind, Value literal, Location loc);
+
+		/* puts tokens in place of [first, last) and moves the ones after by delta */
+		void replace(size_t first, size_t last, TokenList & tokens, std::ptrdiff_t delta);
 
+		size_t size() const noexcept;
 		Token const & at(size_t index) const noexcept;
 		Token::Kind kind_at(size_t index) const noexcept;
 
 		Location const & location_at(size_t index) const noexcept;
 		std::string const & value_at(size_t index) const noexcept;
 
+		LineTable & lines() noexcept;
+		LineTable const & lines() const noexcept;
+
 		void clear() noexcept;
 
 		template <typename Stream>
@@ -46,6 +78,7 @@ namespace vm
 
 	private:
 		std::vector<Token> tokens_;
+		LineTable lines_;
 	};
 
 	class Scanner
@@ -61,6 +94,14 @@ namespace vm
 
 		Status::Code scan(std::string const & code, TokenList & tokens, Status & status);
 
+		/*
+		 * code is edit applied to the source of tokens, which are updated
+		 * in place; scanning starts a couple of tokens before the edit and
+		 * stops at the first token past it that starts where an old one did
+		 */
+		Status::Code rescan(std::string const & code, Edit const & edit, TokenList & tokens,
+					Splice & splice, Status & status);
+
 	private:
 		char peek_char(size_t off = 0) const noexcept;
 		char get_char() noexcept;
@@ -77,13 +118,17 @@ namespace vm
 		void skip_comment();
 		void skip_whitespaces();
 		void scan_impl();
+		bool resync();
 
-		size_t line_;
-		size_t offset_;
 		size_t pos_;
 		TokenList * tokens_;
 		Status * status_;
 		std::string const * code_;
+
+		TokenList const * previous_;
+		size_t resync_pos_;
+		size_t old_pos_;
+		std::ptrdiff_t delta_;
 	};
 
 }
@@ -0,0 +1,83 @@
+#ifndef __SPECULATOR_HPP__
+#define __SPECULATOR_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+#include <bytecode.hpp>
+
+namespace vm
+{
+
+	/*
+	 * speculates on the branches of hot functions; once a function was
+	 * called hot_calls times, every conditional jump that went the same
+	 * way in at least min_samples runs becomes a guard: the jump still
+	 * tests its condition, but the way it never went leads to a deopt
+	 * stub, the code only that way reached is dropped and the peephole
+	 * pass fuses what became straight line code. A deopt resumes the
+	 * baseline code at the instruction the guard would have gone to,
+	 * the frame is laid out the same in both, so nothing is
+	 * materialized. After max_deopts of them the function is settled and
+	 * runs its baseline code from then on.
+	 *
+	 * A guard costs what the jump did, so speculative code is kept only
+	 * if the code it still reaches runs fewer instructions: jumps that
+	 * now go to the next instruction are dropped and pairs fuse where a
+	 * jump target went away. A jump always taken is guarded only where
+	 * the code up to its target is dropped, anywhere else the guard
+	 * would need a jump more. A function where nothing pays off is
+	 * settled right away.
+	 *
+	 * The feedback and the speculative code live in the Code, a module
+	 * run by several interpreters shares them; every interpreter adds
+	 * its counts to the Code in batches, so hot_calls is reached up to
+	 * Interpreter::flush_calls calls late. One speculator may serve
+	 * interpreters on several threads.
+	 */
+	class Speculator
+	{
+	public:
+		static std::uint64_t const default_hot_calls = 1000;
+		static std::uint64_t const default_min_samples = 100;
+		static std::uint64_t const default_max_deopts = 16;
+
+		Speculator() noexcept;
+
+		Speculator(Speculator const &) = delete;
+		Speculator & operator=(Speculator const &) = delete;
+
+		void set_hot_calls(std::uint64_t calls) noexcept;
+		void set_min_samples(std::uint64_t samples) noexcept;
+		void set_max_deopts(std::uint64_t deopts) noexcept;
+
+		/* the code a call of baseline runs, the caller counted the call */
+		Code const * enter(Code const & baseline);
+
+		/* a guard of speculative code failed and it went back to its baseline */
+		void deoptimized(Code const & speculative) noexcept;
+
+		/* the speculative code for baseline, nullptr if it would not run fewer instructions */
+		std::unique_ptr<Code> speculate(Code const & baseline) const;
+
+		std::size_t speculated() const noexcept;
+		std::size_t deopts() const noexcept;
+		std::size_t abandoned() const noexcept;
+
+		void report(std::ostream & out) const;
+
+	private:
+		std::uint64_t hot_calls_;
+		std::uint64_t min_samples_;
+		std::uint64_t max_deopts_;
+		std::atomic<std::size_t> speculated_;
+		std::atomic<std::size_t> deopts_;
+		std::atomic<std::size_t> abandoned_;
+	};
+
+}
+
+#endif /*__SPECULATOR_HPP__*/
@@ -0,0 +1,46 @@
+#ifndef __STACK_HPP__
+#define __STACK_HPP__
+
+#include <cstddef>
+
+namespace vm
+{
+
+	/*
+	 * address space of an interpreter stack, reserved once with mmap; the
+	 * kernel commits and zeroes a page only when it is first touched, so
+	 * the stack grows in memory as deep as a program gets, and a guard
+	 * page past the end faults on an access the overflow checks missed
+	 */
+	class StackMemory
+	{
+	public:
+		StackMemory() noexcept;
+		~StackMemory();
+
+		StackMemory(StackMemory const &) = delete;
+		StackMemory & operator=(StackMemory const &) = delete;
+
+		/* false if the address space cannot be reserved */
+		bool reserve(std::size_t size);
+
+		void * address() const noexcept;
+		std::size_t size() const noexcept;
+
+		template <typename T>
+		T * begin() const noexcept
+		{ return static_cast<T *>(memory_); }
+
+		template <typename T>
+		T * end() const noexcept
+		{ return begin<T>() + size_ / sizeof(T); }
+
+	private:
+		void * memory_;
+		std::size_t size_;
+		std::size_t mapped_;
+	};
+
+}
+
+#endif /*__STACK_HPP__*/
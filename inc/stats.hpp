@@ -0,0 +1,107 @@
+#ifndef __STATS_HPP__
+#define __STATS_HPP__
+
+/*
+ * per phase counters of the pipeline; everything here, including the
+ * allocation counting operator new, exists only in builds with VM_STATS
+ * defined (make STATS=-DVM_STATS), otherwise the macros expand to nothing;
+ * the counters belong to the thread that updates them, so threads running
+ * contexts concurrently never share one
+ */
+#if defined(VM_STATS)
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+
+#define FOR_PHASES(PHASE)	\
+	PHASE(read)				\
+	PHASE(scan)				\
+	PHASE(parse)			\
+	PHASE(link)				\
+	PHASE(optimize)			\
+	PHASE(compile)			\
+	PHASE(run)
+
+namespace vm
+{
+
+	class Phase
+	{
+	public:
+		#define PHASE_KIND(name) name,
+		enum Kind
+		{
+			FOR_PHASES(PHASE_KIND)
+			phase_count
+		};
+		#undef PHASE_KIND
+
+		static char const * name(Kind kind) noexcept;
+	};
+
+	struct PhaseStats
+	{
+		std::size_t calls;
+		double wall;
+		double cpu;
+		std::size_t bytes;
+		std::size_t allocations;
+		std::size_t tokens;
+		std::size_t nodes;
+		std::size_t code_size;
+	};
+
+	class Stats
+	{
+	public:
+		/* stats of the calling thread */
+		static Stats & instance() noexcept;
+
+		PhaseStats & phase(Phase::Kind kind) noexcept;
+		PhaseStats const & phase(Phase::Kind kind) const noexcept;
+
+		/* totals of operator new of the calling thread since it started */
+		static std::size_t allocated_bytes() noexcept;
+		static std::size_t allocations() noexcept;
+
+		void report(std::ostream & out) const;
+		void report_json(std::ostream & out) const;
+
+	private:
+		Stats() noexcept;
+
+		PhaseStats phases_[Phase::phase_count];
+	};
+
+	/* charges the time and allocations of its lifetime to a phase */
+	class PhaseTimer
+	{
+	public:
+		explicit PhaseTimer(Phase::Kind kind) noexcept;
+		~PhaseTimer();
+
+		PhaseTimer(PhaseTimer const &) = delete;
+		PhaseTimer & operator=(PhaseTimer const &) = delete;
+
+	private:
+		Phase::Kind kind_;
+		std::chrono::steady_clock::time_point wall_;
+		double cpu_;
+		std::size_t bytes_;
+		std::size_t allocations_;
+	};
+
+}
+
+#define VM_STATS_PHASE(kind) ::vm::PhaseTimer const vm_stats_timer(::vm::Phase::kind)
+#define VM_STATS_COUNT(kind, field, value) (::vm::Stats::instance().phase(::vm::Phase::kind).field += (value))
+
+#else
+
+#define VM_STATS_PHASE(kind) ((void)0)
+#define VM_STATS_COUNT(kind, field, value) ((void)0)
+
+#endif
+
+#endif /*__STATS_HPP__*/
@@ -76,19 +76,38 @@ namespace vm {
 		static Kind get_token_kind(char const * value) noexcept;
 		static int get_precedence(Token::Kind kind) noexcept;
 		static bool is_keyword(Token::Kind kind) noexcept;
-		static bool is_assignment(Token::Kind kind) noexcept;
 		static bool is_typename(Token::Kind kind) noexcept;
 
+		static constexpr bool is_assignment(Token::Kind kind) noexcept
+		{ return kind == incrset || kind == decrset || kind == assign; }
+
+		/*
+		 * how tightly a binary operator holds its operands, generated from
+		 * the precedence column of FOR_TOKENS; 0 for any other token,
+		 * assignments included since they are statements
+		 */
+		#define BINDING_POWER(k, s, p) ((k == incrset || k == decrset || k == assign) ? 0 : p),
+		static constexpr int binding_powers[token_count] = { FOR_TOKENS(BINDING_POWER) };
+		#undef BINDING_POWER
+
+		static constexpr int binding_power(Token::Kind kind) noexcept
+		{ return binding_powers[kind]; }
+
 		explicit Token(Kind kind, Location loc = Location())
 			: Token(kind, get_token_value(kind), std::move(loc))
 		{ }
 
 		Token(Kind kind, std::string value, Location loc = Location())
-			: kind_(kind), value_(std::move(value)), location_(std::move(loc))
+			: kind_(kind), value_(std::move(value)), literal_(), location_(std::move(loc))
 		{ }
 
 		Token(Kind kind, char const * const value, Location loc = Location())
-			: kind_(kind), value_(value), location_(std::move(loc))
+			: kind_(kind), value_(value), literal_(), location_(std::move(loc))
+		{ }
+
+		/* a number literal, already converted by the scanner and without text */
+		Token(Kind kind, Value literal, Location loc = Location())
+			: kind_(kind), literal_(literal), location_(std::move(loc))
 		{ }
 
 		Token(Token const &) = default;
@@ -105,12 +124,20 @@ namespace vm {
 		std::string const & value() const noexcept
 		{ return value_; }
 
+		/* value of an int_l or double_l token */
+		Value literal() const noexcept
+		{ return literal_; }
+
 		Location const & location() const noexcept
 		{ return location_; }
 
+		void set_location(Location loc) noexcept
+		{ location_ = std::move(loc); }
+
 	private:
 		Kind kind_;
 		std::string value_;
+		Value literal_;
 		Location location_;
 	};
 
@@ -0,0 +1,86 @@
+#ifndef __VECTORIZER_HPP__
+#define __VECTORIZER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <ast.hpp>
+
+namespace vm
+{
+
+	/*
+	 * Vector form of a counted loop whose body is a single reduction
+	 * 'acc += expr' or 'acc -= expr' where expr is pure int/double
+	 * arithmetic over the loop variable, literals and variables the loop
+	 * does not write. The expression is evaluated for several iterations
+	 * at once in SIMD lanes. Int sums keep one partial sum per lane and a
+	 * scalar tail. Double sums keep partial sums only when reassociation
+	 * is allowed (fast math); otherwise the lanes are added to the
+	 * accumulator one by one, in iteration order, so the result is the
+	 * same as the scalar loop.
+	 */
+	class Reduction
+	{
+	public:
+		static std::size_t const lanes = 4;
+		static std::size_t const max_depth = 16;
+
+		static std::unique_ptr<Reduction> recognize(ForNode & loop, bool fast_math);
+
+		Reduction(Reduction const &) = delete;
+		Reduction & operator=(Reduction const &) = delete;
+
+		Variable * accumulator() const noexcept;
+		Token::Kind kind() const noexcept;
+		bool reassociates() const noexcept;
+
+		/* values of these variables are passed to run in the same order */
+		std::size_t invariants_number() const noexcept;
+		Variable * invariant_at(std::size_t index) const noexcept;
+
+		/*
+		 * runs the whole loop and returns the new accumulator value; the
+		 * caller still assigns 'to' to the loop variable if from <= to
+		 */
+		Value run(Value acc, std::int64_t from, std::int64_t to, Value const * invariants) const noexcept;
+
+		/* the expression is kept as postfix code over lanes */
+		enum Opcode
+		{
+			LoadIndex,
+			LoadConst,
+			LoadInvariant,
+			IntToDouble,
+			Add,
+			Sub,
+			Mul,
+			Div,
+			Neg
+		};
+
+		struct Instruction
+		{
+			Opcode opcode;
+			Type type;
+			Value value;
+			std::size_t slot;
+		};
+
+	private:
+		friend class ReductionCompiler;
+
+		Reduction(Variable * acc, Token::Kind kind, bool reassociates);
+
+		Variable * accumulator_;
+		Token::Kind kind_;
+		bool reassociates_;
+		std::vector<Variable *> invariants_;
+		std::vector<Instruction> code_;
+	};
+
+}
+
+#endif /*__VECTORIZER_HPP__*/
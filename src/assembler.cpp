@@ -0,0 +1,201 @@
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <assembler.hpp>
+
+namespace vm
+{
+
+	Assembler::Assembler()
+	{ }
+
+	std::vector<std::uint8_t> const & Assembler::code() const noexcept
+	{ return code_; }
+
+	std::size_t Assembler::size() const noexcept
+	{ return code_.size(); }
+
+	void Assembler::emit(std::uint8_t byte)
+	{ code_.push_back(byte); }
+
+	void Assembler::emit32(std::uint32_t value)
+	{
+		for (int shift = 0; shift != 32; shift += 8)
+			emit(static_cast<std::uint8_t>(value >> shift));
+	}
+
+	void Assembler::rex(bool wide, unsigned reg, unsigned base)
+	{
+		std::uint8_t const prefix = 0x40 | (wide ? 0x08 : 0x00)
+								| ((reg & 0x8) ? 0x04 : 0x00)
+								| ((base & 0x8) ? 0x01 : 0x00);
+		if (prefix != 0x40)
+			emit(prefix);
+	}
+
+	void Assembler::modrm(unsigned mod, unsigned reg, unsigned rm)
+	{ emit(static_cast<std::uint8_t>((mod << 6) | ((reg & 0x7) << 3) | (rm & 0x7))); }
+
+	void Assembler::memory(unsigned reg, x64::Register base, std::int32_t disp)
+	{
+		modrm(2, reg, base);
+		if ((base & 0x7) == x64::rsp)
+			emit(0x24);
+		emit32(static_cast<std::uint32_t>(disp));
+	}
+
+	void Assembler::push(x64::Register reg)
+	{
+		rex(false, 0, reg);
+		emit(0x50 + (reg & 0x7));
+	}
+
+	void Assembler::push(x64::Register base, std::int32_t disp)
+	{
+		rex(false, 0, base);
+		emit(0xFF);
+		memory(6, base, disp);
+	}
+
+	void Assembler::pop(x64::Register reg)
+	{
+		rex(false, 0, reg);
+		emit(0x58 + (reg & 0x7));
+	}
+
+	void Assembler::mov(x64::Register dst, x64::Register src)
+	{
+		rex(true, src, dst);
+		emit(0x89);
+		modrm(3, src, dst);
+	}
+
+	void Assembler::mov(x64::Register dst, x64::Register base, std::int32_t disp)
+	{
+		rex(true, dst, base);
+		emit(0x8B);
+		memory(dst, base, disp);
+	}
+
+	void Assembler::mov(x64::Register dst, std::uint32_t imm)
+	{
+		rex(false, 0, dst);
+		emit(0xB8 + (dst & 0x7));
+		emit32(imm);
+	}
+
+	void Assembler::movsd(x64::XmmRegister dst, x64::Register base, std::int32_t disp)
+	{
+		emit(0xF2);
+		rex(false, dst, base);
+		emit(0x0F);
+		emit(0x10);
+		memory(dst, base, disp);
+	}
+
+	void Assembler::movq(x64::Register dst, x64::XmmRegister src)
+	{
+		emit(0x66);
+		rex(true, src, dst);
+		emit(0x0F);
+		emit(0x7E);
+		modrm(3, src, dst);
+	}
+
+	void Assembler::sub(x64::Register dst, std::int32_t imm)
+	{
+		rex(true, 0, dst);
+		emit(0x81);
+		modrm(3, 5, dst);
+		emit32(static_cast<std::uint32_t>(imm));
+	}
+
+	void Assembler::add(x64::Register dst, std::int32_t imm)
+	{
+		rex(true, 0, dst);
+		emit(0x81);
+		modrm(3, 0, dst);
+		emit32(static_cast<std::uint32_t>(imm));
+	}
+
+	void Assembler::call(x64::Register target)
+	{
+		rex(false, 0, target);
+		emit(0xFF);
+		modrm(3, 2, target);
+	}
+
+	void Assembler::leave()
+	{ emit(0xC9); }
+
+	void Assembler::ret()
+	{ emit(0xC3); }
+
+
+
+	ExecutableMemory::ExecutableMemory() noexcept
+		: memory_(nullptr), size_(0)
+	{ }
+
+	ExecutableMemory::~ExecutableMemory()
+	{
+		if (memory_)
+			munmap(memory_, size_);
+	}
+
+	ExecutableMemory::ExecutableMemory(ExecutableMemory && other) noexcept
+		: ExecutableMemory()
+	{ swap(other); }
+
+	ExecutableMemory & ExecutableMemory::operator=(ExecutableMemory && other) noexcept
+	{
+		ExecutableMemory(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	ExecutableMemory & ExecutableMemory::swap(ExecutableMemory & other) noexcept
+	{
+		using std::swap;
+
+		swap(memory_, other.memory_);
+		swap(size_, other.size_);
+
+		return *this;
+	}
+
+	bool ExecutableMemory::install(Assembler const & code)
+	{
+		assert(!memory_);
+
+		std::size_t const page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+		std::size_t const size = (code.size() + page - 1) / page * page;
+
+		void * const memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+									MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			return false;
+
+		std::memcpy(memory, code.code().data(), code.size());
+		if (mprotect(memory, size, PROT_READ | PROT_EXEC))
+		{
+			munmap(memory, size);
+			return false;
+		}
+
+		memory_ = memory;
+		size_ = size;
+
+		return true;
+	}
+
+	void const * ExecutableMemory::address() const noexcept
+	{ return memory_; }
+
+	std::size_t ExecutableMemory::size() const noexcept
+	{ return size_; }
+
+}
@@ -3,10 +3,18 @@
 
 #include <utils.hpp>
 #include <ast.hpp>
+#include <vectorizer.hpp>
 
 namespace vm
 {
 
+	namespace detail
+	{
+
+		static ASTNode * transform(Transformer & transformer, ASTNode * node)
+		{ return transformer.transform(std::unique_ptr<ASTNode>(node)).release(); }
+
+	}
 
 	Signature::Signature(Type rtype, std::string name)
 		: return_type_(rtype)
@@ -99,6 +107,27 @@ namespace vm
 		node.release();
 	}
 
+	void Block::erase(iterator first, iterator last)
+	{
+		std::for_each(first, last, [](ASTNode * node) { delete node; });
+		instructions_.erase(first, last);
+	}
+
+	void Block::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
+	void Block::visit_children(Visitor & visitor)
+	{ std::for_each(begin(), end(), [&visitor](ASTNode * node) { node->visit(visitor); }); }
+
+	void Block::transform_children(Transformer & transformer)
+	{
+		for (ASTNode *& node : instructions_)
+			node = detail::transform(transformer, node);
+
+		instructions_.erase(std::remove(instructions_.begin(), instructions_.end(), nullptr),
+							instructions_.end());
+	}
+
 
 
 	Scope::Scope(Scope *owner)
@@ -166,12 +195,29 @@ namespace vm
 		fun.release();
 	}
 
+	std::unique_ptr<Function> Scope::release_function(Function * fun)
+	{
+		Scope::function_iterator it(functions_.find(fun->name()));
+		assert(it != functions_.end() && it->second == fun);
+		functions_.erase(it);
+		return std::unique_ptr<Function>(fun);
+	}
+
 	Scope * Scope::owner() noexcept
 	{ return owner_; }
 
 	Scope const * Scope::owner() const noexcept
 	{ return owner_; }
 
+	void Scope::set_owner(Scope * owner)
+	{
+		if (owner_)
+			owner_->unregister_child(this);
+		owner_ = owner;
+		if (owner_)
+			owner_->register_child(this);
+	}
+
 	Scope::variable_iterator const Scope::variables_begin() noexcept
 	{ return variables_.begin(); }
 
@@ -196,9 +242,22 @@ namespace vm
 	Scope::const_function_iterator const Scope::functions_end() const noexcept
 	{ return functions_.end(); }
 
-	void Scope::register_child(Scope const * child)
+	Scope::child_iterator const Scope::children_begin() const noexcept
+	{ return children_.cbegin(); }
+
+	Scope::child_iterator const Scope::children_end() const noexcept
+	{ return children_.cend(); }
+
+	void Scope::register_child(Scope * child)
 	{ children_.push_back(child); }
 
+	void Scope::unregister_child(Scope * child) noexcept
+	{
+		std::vector<Scope *>::iterator const it(std::find(children_.begin(), children_.end(), child));
+		if (it != children_.end())
+			children_.erase(it);
+	}
+
 
 
 	LocatedInFile::LocatedInFile(Location start, Location finish) noexcept
@@ -238,12 +297,12 @@ namespace vm
 		static Token::Kind binaries[] = {
 			Token::lor, Token::land, Token::eq, Token::neq, Token::ge, Token::le,
 			Token::aor, Token::aand, Token::axor, Token::gt, Token::lt, Token::add,
-			Token::sub, Token::mul, Token::div, Token::mod
+			Token::sub, Token::mul, Token::div, Token::mod, Token::range
 		};
 
 		assert(std::find(binaries, binaries + utils::array_size(binaries), kind) != binaries + utils::array_size(binaries));
-		assert(left);
-		assert(right);
+		assert(left_);
+		assert(right_);
 	}
 
 	BinaryExprNode::~BinaryExprNode()
@@ -267,6 +326,22 @@ namespace vm
 	ASTNode * BinaryExprNode::right() noexcept
 	{ return right_; }
 
+	void BinaryExprNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
+	void BinaryExprNode::visit_children(Visitor & visitor)
+	{
+		left()->visit(visitor);
+		right()->visit(visitor);
+	}
+
+	void BinaryExprNode::transform_children(Transformer & transformer)
+	{
+		left_ = detail::transform(transformer, left_);
+		right_ = detail::transform(transformer, right_);
+		assert(left_ && right_);
+	}
+
 
 
 	UnaryExprNode::UnaryExprNode(Token::Kind kind,
@@ -280,7 +355,7 @@ namespace vm
 		static Token::Kind unaries[] = { Token::anot, Token::lnot, Token::sub };
 
 		assert(std::find(unaries, unaries + utils::array_size(unaries), kind) != unaries + utils::array_size(unaries));
-		assert(node);
+		assert(operand_);
 	}
 
 	UnaryExprNode::~UnaryExprNode()
@@ -295,17 +370,40 @@ namespace vm
 	ASTNode const * UnaryExprNode::operand() const noexcept
 	{ return operand_; }
 
+	void UnaryExprNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
+	void UnaryExprNode::visit_children(Visitor & visitor)
+	{ operand()->visit(visitor); }
+
+	void UnaryExprNode::transform_children(Transformer & transformer)
+	{
+		operand_ = detail::transform(transformer, operand_);
+		assert(operand_);
+	}
+
 
 
-	StringLitNode::StringLitNode(std::string value,
+	std::string const * StringPool::intern(std::string const & value)
+	{ return &*strings_.insert(value).first; }
+
+	std::size_t StringPool::size() const noexcept
+	{ return strings_.size(); }
+
+
+
+	StringLitNode::StringLitNode(std::string const * value,
 									Location start,
-									Location finish)
+									Location finish) noexcept
 		: ASTNode(std::move(start), std::move(finish))
-		, value_(std::move(value))
-	{ }
+		, value_(value)
+	{ assert(value_); }
 
 	std::string const & StringLitNode::value() const noexcept
-	{ return value_; }
+	{ return *value_; }
+
+	void StringLitNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
 
 
 
@@ -319,6 +417,9 @@ namespace vm
 	std::int64_t IntLitNode::value() const noexcept
 	{ return value_; }
 
+	void IntLitNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
 
 
 	DoubleLitNode::DoubleLitNode(double value,
@@ -331,6 +432,9 @@ namespace vm
 	double DoubleLitNode::value() const noexcept
 	{ return value_; }
 
+	void DoubleLitNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
 
 
 	LoadNode::LoadNode(Variable *var,
@@ -346,6 +450,9 @@ namespace vm
 	Variable const * LoadNode::variable() const noexcept
 	{ return variable_; }
 
+	void LoadNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
 
 
 	StoreNode::StoreNode(Variable *var,
@@ -363,8 +470,8 @@ namespace vm
 		};
 
 		assert(std::find(assignments, assignments + utils::array_size(assignments), kind) != assignments + utils::array_size(assignments));
-		assert(expr);
-		assert(var);
+		assert(expression_);
+		assert(variable_);
 	}
 
 	StoreNode::~StoreNode()
@@ -385,13 +492,86 @@ namespace vm
 	Token::Kind StoreNode::kind() const noexcept
 	{ return kind_; }
 
+	void StoreNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
+	void StoreNode::visit_children(Visitor & visitor)
+	{ expression()->visit(visitor); }
+
+	void StoreNode::transform_children(Transformer & transformer)
+	{
+		expression_ = detail::transform(transformer, expression_);
+		assert(expression_);
+	}
+
+
+
+	LetNode::LetNode(Variable * var,
+						std::unique_ptr<ASTNode> init,
+						std::unique_ptr<ASTNode> value,
+						Location start,
+						Location finish) noexcept
+		: ASTNode(std::move(start), std::move(finish))
+		, variable_(var)
+		, init_(init.release())
+		, value_(value.release())
+	{
+		assert(variable_);
+		assert(init_);
+		assert(value_);
+	}
+
+	LetNode::~LetNode()
+	{
+		delete init_;
+		delete value_;
+	}
+
+	Variable * LetNode::variable() noexcept
+	{ return variable_; }
+
+	Variable const * LetNode::variable() const noexcept
+	{ return variable_; }
+
+	ASTNode * LetNode::init() noexcept
+	{ return init_; }
 
+	ASTNode const * LetNode::init() const noexcept
+	{ return init_; }
 
-	NativeCallNode::NativeCallNode(std::unique_ptr<Signature> signature,
+	ASTNode * LetNode::value() noexcept
+	{ return value_; }
+
+	ASTNode const * LetNode::value() const noexcept
+	{ return value_; }
+
+	void LetNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
+	void LetNode::visit_children(Visitor & visitor)
+	{
+		init_->visit(visitor);
+		value_->visit(visitor);
+	}
+
+	void LetNode::transform_children(Transformer & transformer)
+	{
+		init_ = detail::transform(transformer, init_);
+		value_ = detail::transform(transformer, value_);
+		assert(init_ && value_);
+	}
+
+
+
+	NativeCallNode::NativeCallNode(std::string native_name,
+									std::unique_ptr<Signature> signature,
 									Location start,
 									Location finish) noexcept
 		: ASTNode(std::move(start), std::move(finish))
+		, native_name_(std::move(native_name))
 		, signature_(signature.release())
+		, address_(nullptr)
+		, trampoline_(nullptr)
 	{ assert(signature_); }
 
 	NativeCallNode::~NativeCallNode()
@@ -400,6 +580,12 @@ namespace vm
 	std::string const & NativeCallNode::name() const noexcept
 	{ return signature_->name(); }
 
+	std::string const & NativeCallNode::native_name() const noexcept
+	{ return native_name_; }
+
+	Signature const & NativeCallNode::signature() const noexcept
+	{ return *signature_; }
+
 	Type NativeCallNode::return_type() const noexcept
 	{ return signature_->return_type(); }
 
@@ -412,6 +598,30 @@ namespace vm
 	Type NativeCallNode::operator[](std::size_t index) const noexcept
 	{ return at(index); }
 
+	bool NativeCallNode::is_bound() const noexcept
+	{ return address_ && trampoline_; }
+
+	void NativeCallNode::bind(NativeAddress address, NativeTrampoline trampoline) noexcept
+	{
+		address_ = address;
+		trampoline_ = trampoline;
+	}
+
+	NativeAddress NativeCallNode::address() const noexcept
+	{ return address_; }
+
+	NativeTrampoline NativeCallNode::trampoline() const noexcept
+	{ return trampoline_; }
+
+	Value NativeCallNode::invoke(Value const * args) const noexcept
+	{
+		assert(is_bound());
+		return trampoline_(address_, args);
+	}
+
+	void NativeCallNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
 
 
 	ForNode::ForNode(Variable *var,
@@ -423,6 +633,9 @@ namespace vm
 		, variable_(var)
 		, expr_(expr.release())
 		, body_(body.release())
+		, counted_(false)
+		, writes_variable_(true)
+		, reduction_(nullptr)
 	{
 		assert(variable_);
 		assert(expr_);
@@ -433,6 +646,7 @@ namespace vm
 	{
 		delete expression();
 		delete body();
+		delete reduction_;
 	}
 
 	Variable * ForNode::variable() noexcept
@@ -453,6 +667,61 @@ namespace vm
 	Block const * ForNode::body() const noexcept
 	{ return body_; }
 
+	ASTNode * ForNode::from() noexcept
+	{ return const_cast<ASTNode *>(const_cast<ForNode const *>(this)->from()); }
+
+	ASTNode const * ForNode::from() const noexcept
+	{
+		BinaryExprNode const * const range = dynamic_cast<BinaryExprNode const *>(expression());
+		return (range && range->kind() == Token::range) ? range->left() : nullptr;
+	}
+
+	ASTNode * ForNode::to() noexcept
+	{ return const_cast<ASTNode *>(const_cast<ForNode const *>(this)->to()); }
+
+	ASTNode const * ForNode::to() const noexcept
+	{
+		BinaryExprNode const * const range = dynamic_cast<BinaryExprNode const *>(expression());
+		return (range && range->kind() == Token::range) ? range->right() : nullptr;
+	}
+
+	bool ForNode::is_counted() const noexcept
+	{ return counted_; }
+
+	bool ForNode::writes_variable() const noexcept
+	{ return writes_variable_; }
+
+	void ForNode::set_counted(bool counted, bool writes_variable) noexcept
+	{
+		counted_ = counted;
+		writes_variable_ = writes_variable;
+	}
+
+	Reduction const * ForNode::reduction() const noexcept
+	{ return reduction_; }
+
+	void ForNode::set_reduction(std::unique_ptr<Reduction> reduction) noexcept
+	{
+		delete reduction_;
+		reduction_ = reduction.release();
+	}
+
+	void ForNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
+	void ForNode::visit_children(Visitor & visitor)
+	{
+		expression()->visit(visitor);
+		body()->visit(visitor);
+	}
+
+	void ForNode::transform_children(Transformer & transformer)
+	{
+		expr_ = detail::transform(transformer, expr_);
+		assert(expr_);
+		body()->transform_children(transformer);
+	}
+
 
 
 	WhileNode::WhileNode(std::unique_ptr<ASTNode> expr,
@@ -462,6 +731,8 @@ namespace vm
 		: ASTNode(std::move(start), std::move(finish))
 		, expr_(expr.release())
 		, body_(body.release())
+		, held_(0)
+		, failed_(0)
 	{
 		assert(expr_);
 		assert(body_);
@@ -485,6 +756,34 @@ namespace vm
 	Block const * WhileNode::body() const noexcept
 	{ return body_; }
 
+	std::uint64_t WhileNode::held() const noexcept
+	{ return held_; }
+
+	std::uint64_t WhileNode::failed() const noexcept
+	{ return failed_; }
+
+	void WhileNode::count_branches(std::uint64_t held, std::uint64_t failed) noexcept
+	{
+		held_ += held;
+		failed_ += failed;
+	}
+
+	void WhileNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
+	void WhileNode::visit_children(Visitor & visitor)
+	{
+		expression()->visit(visitor);
+		body()->visit(visitor);
+	}
+
+	void WhileNode::transform_children(Transformer & transformer)
+	{
+		expr_ = detail::transform(transformer, expr_);
+		assert(expr_);
+		body()->transform_children(transformer);
+	}
+
 
 
 	ReturnNode::ReturnNode(std::unique_ptr<ASTNode> expr,
@@ -503,6 +802,24 @@ namespace vm
 	ASTNode const * ReturnNode::expression() const noexcept
 	{ return expr_; }
 
+	void ReturnNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
+	void ReturnNode::visit_children(Visitor & visitor)
+	{
+		if (expression())
+			expression()->visit(visitor);
+	}
+
+	void ReturnNode::transform_children(Transformer & transformer)
+	{
+		if (expr_)
+		{
+			expr_ = detail::transform(transformer, expr_);
+			assert(expr_);
+		}
+	}
+
 
 
 	IfNode::IfNode(std::unique_ptr<ASTNode> expr,
@@ -514,10 +831,11 @@ namespace vm
 		, expr_(expr.release())
 		, thn_(if_true.release())
 		, els_(if_false.release())
+		, held_(0)
+		, failed_(0)
 	{
 		assert(expr_);
 		assert(thn_);
-		assert(els_);
 	}
 
 	IfNode::~IfNode()
@@ -545,6 +863,55 @@ namespace vm
 	Block const * IfNode::else_block() const noexcept
 	{ return els_; }
 
+	std::unique_ptr<Block> IfNode::release_then_block() noexcept
+	{
+		std::unique_ptr<Block> block(thn_);
+		thn_ = nullptr;
+		return block;
+	}
+
+	std::unique_ptr<Block> IfNode::release_else_block() noexcept
+	{
+		std::unique_ptr<Block> block(els_);
+		els_ = nullptr;
+		return block;
+	}
+
+	std::uint64_t IfNode::held() const noexcept
+	{ return held_; }
+
+	std::uint64_t IfNode::failed() const noexcept
+	{ return failed_; }
+
+	void IfNode::count_branches(std::uint64_t held, std::uint64_t failed) noexcept
+	{
+		held_ += held;
+		failed_ += failed;
+	}
+
+	bool IfNode::else_first() const noexcept
+	{ return els_ && failed_ > held_; }
+
+	void IfNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
+	void IfNode::visit_children(Visitor & visitor)
+	{
+		expression()->visit(visitor);
+		then_block()->visit(visitor);
+		if (else_block())
+			else_block()->visit(visitor);
+	}
+
+	void IfNode::transform_children(Transformer & transformer)
+	{
+		expr_ = detail::transform(transformer, expr_);
+		assert(expr_);
+		then_block()->transform_children(transformer);
+		if (else_block())
+			else_block()->transform_children(transformer);
+	}
+
 
 
 	CallNode::CallNode(std::string name,
@@ -552,6 +919,8 @@ namespace vm
 						Location finish)
 		: ASTNode(std::move(start), std::move(finish))
 		, name_(std::move(name))
+		, function_(nullptr)
+		, calls_(0)
 	{ }
 
 	CallNode::~CallNode()
@@ -584,6 +953,36 @@ namespace vm
 		arg.release();
 	}
 
+	Function * CallNode::function() noexcept
+	{ return function_; }
+
+	Function const * CallNode::function() const noexcept
+	{ return function_; }
+
+	void CallNode::set_function(Function * fun) noexcept
+	{ function_ = fun; }
+
+	std::uint64_t CallNode::calls() const noexcept
+	{ return calls_; }
+
+	void CallNode::count_call(std::uint64_t calls) noexcept
+	{ calls_ += calls; }
+
+	void CallNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
+	void CallNode::visit_children(Visitor & visitor)
+	{ std::for_each(params_.begin(), params_.end(), [&visitor](ASTNode * n) { n->visit(visitor); }); }
+
+	void CallNode::transform_children(Transformer & transformer)
+	{
+		for (ASTNode *& param : params_)
+		{
+			param = detail::transform(transformer, param);
+			assert(param);
+		}
+	}
+
 
 
 	PrintNode::PrintNode(Location start,
@@ -618,6 +1017,21 @@ namespace vm
 		expr.release();
 	}
 
+	void PrintNode::visit(Visitor & visitor)
+	{ visitor.visit(*this); }
+
+	void PrintNode::visit_children(Visitor & visitor)
+	{ std::for_each(params_.begin(), params_.end(), [&visitor](ASTNode * n) { n->visit(visitor); }); }
+
+	void PrintNode::transform_children(Transformer & transformer)
+	{
+		for (ASTNode *& param : params_)
+		{
+			param = detail::transform(transformer, param);
+			assert(param);
+		}
+	}
+
 
 
 	Function::Function(std::unique_ptr<Signature> signature,
@@ -627,6 +1041,7 @@ namespace vm
 		: LocatedInFile(start, finish)
 		, signature_(signature.release())
 		, body_(body.release())
+		, calls_(0)
 	{
 		assert(signature_);
 		assert(body_);
@@ -644,6 +1059,9 @@ namespace vm
 	Type Function::return_type() const noexcept
 	{ return signature_->return_type(); }
 
+	std::size_t Function::parameters_number() const noexcept
+	{ return signature_->parameters_number(); }
+
 	Type Function::type_at(std::size_t index) const noexcept
 	{ return signature_->at(index).first; }
 
@@ -656,6 +1074,22 @@ namespace vm
 	Block const * Function::body() const noexcept
 	{ return body_; }
 
+	NativeCallNode * Function::native() noexcept
+	{ return const_cast<NativeCallNode *>(const_cast<Function const *>(this)->native()); }
+
+	NativeCallNode const * Function::native() const noexcept
+	{
+		if (body()->empty())
+			return nullptr;
+		return dynamic_cast<NativeCallNode const *>(body()->at(0));
+	}
+
+	std::uint64_t Function::calls() const noexcept
+	{ return calls_; }
+
+	void Function::count_call(std::uint64_t calls) noexcept
+	{ calls_ += calls; }
+
 
 
 	Variable::Variable(Type type,
@@ -684,4 +1118,12 @@ namespace vm
 	{ owner_ = scope; }
 
 
+
+	#define VISIT(n)						\
+		void Visitor::visit(n & node)		\
+		{ node.visit_children(*this); }
+	FOR_NODES(VISIT)
+	#undef VISIT
+
+
 }
@@ -0,0 +1,887 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/resource.h>
+
+#include <engine.hpp>
+#include <generator.hpp>
+#include <parser.hpp>
+#include <speculator.hpp>
+
+/* shape of a synthetic program, see ProgramGenerator */
+struct Workload
+{
+	char const * name;
+	std::size_t functions;
+	std::size_t statements;
+	std::size_t expression_depth;
+	std::size_t expression_width;
+	std::size_t string_length;
+	std::size_t comment_lines;
+};
+
+static Workload const workloads[] = {
+	{ "expressions", 64, 8, 48, 4, 0, 0 },
+	{ "functions", 4096, 4, 1, 2, 0, 0 },
+	{ "strings", 64, 16, 1, 2, 2048, 0 },
+	{ "comments", 256, 16, 1, 3, 0, 6 },
+	{ "mixed", 512, 24, 3, 3, 48, 1 }
+};
+
+/*
+ * engines every corpus program runs under, see the jit --engine option;
+ * both run the same bytecode interpreter, optimized only adds the AST
+ * passes and is not faster on every program
+ */
+static char const * const engines[] = { "interpreter", "optimized" };
+
+struct Result
+{
+	std::string name;
+	std::string phase;
+	std::string engine;
+	std::size_t bytes;
+	std::size_t tokens;
+	std::size_t nodes;
+	std::size_t iterations;
+	double compile;
+	double median;
+	double p99;
+	double best;
+	long peak_rss_kb;
+};
+
+struct Options
+{
+	double min_time;
+	std::size_t min_iterations;
+	std::size_t scale;
+	std::string filter;
+	std::string json;
+	std::string dump;
+	std::string corpus;
+	std::size_t warmup;
+	std::size_t runs;
+	std::size_t threads;
+};
+
+/* swallows the output of corpus programs, but still pays for formatting */
+class NullBuffer : public std::streambuf
+{
+protected:
+	virtual int overflow(int c)
+	{ return traits_type::not_eof(c); }
+
+	virtual std::streamsize xsputn(char const *, std::streamsize count)
+	{ return count; }
+};
+
+/*
+ * writing 5 to clear_refs resets VmHWM, so the peak of every phase is
+ * measured on its own; without it only the process peak is available
+ */
+static void reset_peak_rss()
+{
+	std::ofstream clear("/proc/self/clear_refs");
+	if (clear)
+		clear << "5";
+}
+
+static long peak_rss_kb()
+{
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line))
+		if (line.compare(0, 6, "VmHWM:") == 0)
+			return std::strtol(line.c_str() + 6, nullptr, 10);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/* the resident set now, unlike the peak it also goes down */
+static long rss_kb()
+{
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line))
+		if (line.compare(0, 6, "VmRSS:") == 0)
+			return std::strtol(line.c_str() + 6, nullptr, 10);
+	return 0;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{ return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+
+template <typename Body>
+static void measure(Options const & options, Result & result, Body body)
+{
+	std::vector<double> times;
+	double total = 0.0;
+
+	reset_peak_rss();
+	while (times.size() < options.min_iterations || total < options.min_time)
+	{
+		double const time = body();
+		times.push_back(time);
+		total += time;
+	}
+	result.peak_rss_kb = peak_rss_kb();
+
+	std::sort(times.begin(), times.end());
+	result.iterations = times.size();
+	result.median = times[times.size() / 2];
+	result.p99 = times[std::min(times.size() - 1, times.size() * 99 / 100)];
+	result.best = times.front();
+}
+
+static std::string generate(Workload const & workload, std::size_t scale)
+{
+	vm::ProgramGenerator generator;
+	generator.set_functions(workload.functions * scale);
+	generator.set_statements(workload.statements);
+	generator.set_expression_depth(workload.expression_depth);
+	generator.set_expression_width(workload.expression_width);
+	generator.set_string_length(workload.string_length);
+	generator.set_comment_lines(workload.comment_lines);
+	return generator.generate();
+}
+
+/* errors are rare, the line table is only built for them */
+static void report_error(char const * name, std::string const & code, vm::Status const & status)
+{
+	vm::LineTable const lines(code);
+	std::cout << "ERROR(" << name << ":" << lines.line(status.location())
+				<< ":" << lines.offset(status.location()) << "): "
+				<< status.message() << std::endl;
+}
+
+static bool bench_scan(Options const & options, Workload const & workload, std::string const & code, Result & result)
+{
+	vm::TokenList tokens;
+	vm::Status status;
+	if (vm::Scanner().scan(code, tokens, status) == vm::Status::ERROR)
+	{
+		report_error(workload.name, code, status);
+		return false;
+	}
+
+	result.name = std::string("scan/") + workload.name;
+	result.phase = "scan";
+	result.bytes = code.size();
+	result.tokens = tokens.size();
+	result.nodes = 0;
+	result.compile = 0.0;
+
+	measure(options, result, [&code]()
+		{
+			vm::TokenList tokens;
+			vm::Status status;
+			std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+			vm::Scanner().scan(code, tokens, status);
+			return seconds_since(start);
+		});
+
+	return true;
+}
+
+static bool bench_parse(Options const & options, Workload const & workload, std::string const & code, Result & result)
+{
+	vm::Status status;
+	std::unique_ptr<vm::Program> program = vm::Parser().parse(code, status);
+	if (!program || status.code() == vm::Status::ERROR)
+	{
+		report_error(workload.name, code, status);
+		return false;
+	}
+
+	vm::TokenList tokens;
+	vm::Scanner().scan(code, tokens, status);
+
+	result.name = std::string("parse/") + workload.name;
+	result.phase = "parse";
+	result.bytes = code.size();
+	result.tokens = tokens.size();
+	result.nodes = 0;
+	result.compile = 0.0;
+	for (vm::Function * function : program->functions())
+		result.nodes += vm::count_nodes(*function->body());
+	program.reset();
+
+	/* Parser::parse scans as well; the AST is freed outside of the timed region */
+	measure(options, result, [&code]()
+		{
+			vm::Status status;
+			std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+			std::unique_ptr<vm::Program> program = vm::Parser().parse(code, status);
+			double const time = seconds_since(start);
+			program.reset();
+			return time;
+		});
+
+	return true;
+}
+
+/*
+ * an edit of one digit of a literal in the middle of the source, the
+ * way a keystroke changes it; the literal is turned back and forth, so
+ * every reparse takes the program of the one before
+ */
+static bool bench_reparse(Options const & options, Workload const & workload, std::string const & code, Result & result)
+{
+	std::size_t offset = code.size() / 2;
+	while (offset != code.size() && !(std::isdigit(static_cast<unsigned char>(code[offset]))
+				&& !std::isalnum(static_cast<unsigned char>(code[offset - 1])) && code[offset - 1] != '_'))
+		++offset;
+	if (offset == code.size())
+	{
+		std::cout << "ERROR(" << workload.name << "): no literal to edit" << std::endl;
+		return false;
+	}
+
+	std::string const digits[] = { std::string(1, code[offset]), code[offset] == '1' ? "2" : "1" };
+	vm::Edit edits[] = { { offset, 1, digits[1] }, { offset, 1, digits[0] } };
+
+	vm::Status status;
+	vm::Parser parser;
+	vm::Parser::Changes changes;
+	std::unique_ptr<vm::Program> program = parser.parse(code, status);
+	if (program && status.code() != vm::Status::ERROR)
+		program = parser.reparse(std::move(program), edits[0], status, changes);
+	if (!program || status.code() == vm::Status::ERROR)
+	{
+		report_error(workload.name, code, status);
+		return false;
+	}
+
+	result.name = std::string("reparse/") + workload.name;
+	result.phase = "reparse";
+	result.bytes = code.size();
+	result.tokens = 0;
+	result.nodes = 0;
+	result.compile = 0.0;
+	for (vm::Function * function : changes.parsed)
+		result.nodes += vm::count_nodes(*function->body());
+
+	/* the previous program, but for the functions taken over, is freed in the timed region */
+	std::size_t next = 1;
+	measure(options, result, [&parser, &program, &edits, &next]()
+		{
+			vm::Status status;
+			vm::Parser::Changes changes;
+			std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+			program = parser.reparse(std::move(program), edits[next], status, changes);
+			double const time = seconds_since(start);
+			next ^= 1;
+			return time;
+		});
+
+	return true;
+}
+
+static bool read_file(std::string const & file_name, std::string & code)
+{
+	std::ifstream input(file_name);
+	if (!input)
+		return false;
+
+	std::string((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>()).swap(code);
+	return true;
+}
+
+static std::vector<std::string> corpus_programs(std::string const & corpus)
+{
+	std::vector<std::string> names;
+	DIR * const dir = opendir(corpus.c_str());
+	if (!dir)
+		return names;
+
+	std::string const suffix = ".input";
+	while (struct dirent const * entry = readdir(dir))
+	{
+		std::string const name = entry->d_name;
+		if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+			names.push_back(name.substr(0, name.size() - suffix.size()));
+	}
+	closedir(dir);
+
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+/*
+ * compiles a corpus program once for the engine and times whole runs of
+ * it after the warm up runs, with a speculator as jit --speculate runs
+ * it when speculate is set; print output goes nowhere
+ */
+static bool bench_run(Options const & options, std::string const & name, std::string const & engine,
+						bool speculate, std::string const & code, Result & result)
+{
+	vm::Engine vm;
+	vm.set_optimize(engine == "optimized");
+	vm::Speculator speculator;
+	vm::Status status;
+
+	std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+	std::shared_ptr<vm::Module const> module = vm.compile(code, status);
+	double const compile = seconds_since(start);
+
+	if (!module)
+	{
+		report_error(name.c_str(), code, status);
+		return false;
+	}
+
+	NullBuffer buffer;
+	std::ostream out(&buffer);
+	vm::Context context(module, out, vm::Interpreter::default_stack_size);
+	if (speculate)
+		context.set_speculator(&speculator);
+
+	for (std::size_t index = 0; index != options.warmup; ++index)
+	{
+		if (context.run(status) == vm::Status::ERROR)
+		{
+			report_error(name.c_str(), code, status);
+			return false;
+		}
+	}
+
+	result.name = "run/" + name;
+	result.phase = "run";
+	result.engine = speculate ? engine + "+spec" : engine;
+	result.bytes = code.size();
+	result.tokens = 0;
+	result.nodes = 0;
+	result.compile = compile;
+
+	Options runs = options;
+	runs.min_iterations = options.runs;
+	measure(runs, result, [&context, &status]()
+		{
+			std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+			context.run(status);
+			return seconds_since(start);
+		});
+
+	return true;
+}
+
+/* a request handler as an embedding service would call it, once per request */
+static char const handler_program[] =
+	"function int handler(int request) {\n"
+	"\treturn request * 2 + 1;\n"
+	"}\n";
+
+/* a handler that builds strings, what it returns must not pile up in a context */
+static char const strings_program[] =
+	"function string handler(int request) {\n"
+	"\tstring parity = 'odd';\n"
+	"\tif (request % 2 == 0) {\n"
+	"\t\tparity = 'even';\n"
+	"\t}\n"
+	"\treturn 'request ' + parity;\n"
+	"}\n";
+
+/*
+ * per request cost of the embedding API: a context that already ran the
+ * top level code calls the handler; every sample is a batch of calls,
+ * the times are per call. A context serves requests for good, so the
+ * memory it holds is checked to stay flat over leak_calls more calls
+ */
+static bool bench_call(Options const & options, std::string const & engine, char const * name,
+						std::string const & program, Result & result)
+{
+	static std::size_t const batch = 1000;
+	static std::size_t const leak_calls = 200000;
+	static long const max_growth_kb = 2048;
+
+	vm::Engine vm;
+	vm.set_optimize(engine == "optimized");
+	vm::Status status;
+
+	std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+	std::shared_ptr<vm::Module const> module = vm.compile(program, status);
+	double const compile = seconds_since(start);
+
+	if (!module)
+	{
+		report_error(name, program, status);
+		return false;
+	}
+
+	NullBuffer buffer;
+	std::ostream out(&buffer);
+	vm::Context context(module, out);
+	std::size_t const handler = module->find_function("handler");
+	if (context.run(status) == vm::Status::ERROR || handler == vm::Module::npos)
+	{
+		report_error(name, program, status);
+		return false;
+	}
+
+	result.name = std::string("call/") + name;
+	result.phase = "call";
+	result.engine = engine;
+	result.bytes = program.size();
+	result.tokens = 0;
+	result.nodes = 0;
+	result.compile = compile;
+
+	std::vector<vm::Value> args(1);
+	vm::Value value;
+	measure(options, result, [&context, &args, &value, &status, handler]()
+		{
+			std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+			for (std::size_t request = 0; request != batch; ++request)
+			{
+				args[0].as_int = static_cast<std::int64_t>(request);
+				context.call(handler, args, value, status);
+			}
+			return seconds_since(start);
+		});
+
+	result.median /= batch;
+	result.p99 /= batch;
+	result.best /= batch;
+
+	long const before = rss_kb();
+	for (std::size_t request = 0; request != leak_calls && status.code() != vm::Status::ERROR; ++request)
+	{
+		args[0].as_int = static_cast<std::int64_t>(request);
+		context.call(handler, args, value, status);
+	}
+	long const growth = rss_kb() - before;
+	if (growth > max_growth_kb)
+	{
+		std::cout << "ERROR(" << result.name << "): " << growth << " KiB more held after "
+					<< leak_calls << " calls" << std::endl;
+		return false;
+	}
+
+	return status.code() != vm::Status::ERROR;
+}
+
+/* the same fib as the corpus one, called by every thread of bench_threads */
+static char const fib_program[] =
+	"function int fib(int n) {\n"
+	"\tif (n < 2) {\n"
+	"\t\treturn n;\n"
+	"\t}\n"
+	"\treturn fib(n - 1) + fib(n - 2);\n"
+	"}\n";
+
+/* fib(20) calls every thread makes in one sample */
+static std::size_t const thread_calls = 8;
+
+/*
+ * throughput of independent instances of one compiled module: every
+ * thread calls fib(20) through a context and an output of its own, a
+ * sample is the wall time until all of them are done; nothing but the
+ * immutable module is shared
+ */
+static bool bench_threads(Options const & options, std::string const & engine, std::size_t threads, Result & result)
+{
+	static std::int64_t const argument = 20;
+	static std::int64_t const expected = 6765;
+
+	vm::Engine vm;
+	vm.set_optimize(engine == "optimized");
+	vm::Status status;
+
+	std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+	std::shared_ptr<vm::Module const> module = vm.compile(fib_program, status);
+	double const compile = seconds_since(start);
+
+	if (!module)
+	{
+		report_error("fib", fib_program, status);
+		return false;
+	}
+
+	std::size_t const fib = module->find_function("fib");
+	std::vector<std::unique_ptr<NullBuffer> > buffers;
+	std::vector<std::unique_ptr<std::ostream> > outs;
+	std::vector<std::unique_ptr<vm::Context> > contexts;
+	for (std::size_t thread = 0; thread != threads; ++thread)
+	{
+		buffers.push_back(std::unique_ptr<NullBuffer>(new NullBuffer()));
+		outs.push_back(std::unique_ptr<std::ostream>(new std::ostream(buffers.back().get())));
+		contexts.push_back(std::unique_ptr<vm::Context>(new vm::Context(module, *outs.back())));
+		if (contexts.back()->run(status) == vm::Status::ERROR || fib == vm::Module::npos)
+		{
+			report_error("fib", fib_program, status);
+			return false;
+		}
+	}
+
+	result.name = "threads/" + std::to_string(threads);
+	result.phase = "threads";
+	result.engine = engine;
+	result.bytes = sizeof(fib_program) - 1;
+	result.tokens = 0;
+	result.nodes = 0;
+	result.compile = compile;
+
+	std::vector<char> failed(threads, 0);
+	measure(options, result, [&contexts, &failed, fib, threads]()
+		{
+			std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+
+			std::vector<std::thread> workers;
+			for (std::size_t thread = 0; thread != threads; ++thread)
+				workers.push_back(std::thread([&contexts, &failed, fib, thread]()
+					{
+						std::vector<vm::Value> args(1);
+						args[0].as_int = argument;
+						vm::Value value;
+						vm::Status status;
+
+						for (std::size_t call = 0; call != thread_calls; ++call)
+							if (contexts[thread]->call(fib, args, value, status) == vm::Status::ERROR
+									|| value.as_int != expected)
+								failed[thread] = 1;
+					}));
+
+			for (std::thread & worker : workers)
+				worker.join();
+			return seconds_since(start);
+		});
+
+	if (std::find(failed.begin(), failed.end(), 1) != failed.end())
+	{
+		std::cout << "ERROR: a thread computed a wrong fib" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+static double per_second(std::size_t count, double seconds)
+{ return seconds > 0.0 ? count / seconds : 0.0; }
+
+static void report(std::ostream & out, Result const & result)
+{
+	out << std::left << std::setw(20) << result.name << std::right
+		<< std::setw(10) << result.bytes
+		<< std::setw(10) << result.iterations
+		<< std::fixed << std::setprecision(3)
+		<< std::setw(12) << result.median * 1000.0
+		<< std::setw(12) << per_second(result.bytes, result.median) / (1024.0 * 1024.0)
+		<< std::setw(12) << per_second(result.tokens, result.median) / 1000000.0
+		<< std::setw(12) << per_second(result.nodes, result.median) / 1000000.0
+		<< std::setw(12) << result.peak_rss_kb
+		<< std::endl;
+}
+
+static void report_run(std::ostream & out, Result const & result)
+{
+	out << std::left << std::setw(20) << result.name
+		<< std::setw(18) << result.engine << std::right
+		<< std::setw(10) << result.iterations
+		<< std::fixed << std::setprecision(3)
+		<< std::setw(12) << result.compile * 1000.0
+		<< std::setw(12) << result.median * 1000.0
+		<< std::setw(12) << result.p99 * 1000.0
+		<< std::setw(12) << result.best * 1000.0
+		<< std::setw(12) << result.peak_rss_kb
+		<< std::endl;
+}
+
+static void report_call(std::ostream & out, Result const & result)
+{
+	out << std::left << std::setw(20) << result.name
+		<< std::setw(18) << result.engine << std::right
+		<< std::setw(10) << result.iterations
+		<< std::fixed << std::setprecision(3)
+		<< std::setw(12) << result.compile * 1000.0
+		<< std::setw(12) << result.median * 1000000.0
+		<< std::setw(12) << result.p99 * 1000000.0
+		<< std::setw(12) << result.best * 1000000.0
+		<< std::setw(12) << result.peak_rss_kb
+		<< std::endl;
+}
+
+/* fib calls per second over all threads and their ratio to the single thread ones */
+static void report_threads(std::ostream & out, Result const & result, std::size_t threads, double single)
+{
+	double const throughput = per_second(threads * thread_calls, result.median);
+
+	out << std::left << std::setw(20) << result.name
+		<< std::setw(18) << result.engine << std::right
+		<< std::setw(10) << result.iterations
+		<< std::fixed << std::setprecision(3)
+		<< std::setw(12) << result.compile * 1000.0
+		<< std::setw(12) << result.median * 1000.0
+		<< std::setw(12) << throughput
+		<< std::setw(12) << (single > 0.0 ? throughput / single : 0.0)
+		<< std::setw(12) << result.peak_rss_kb
+		<< std::endl;
+}
+
+static void report_json(std::ostream & out, Options const & options, std::vector<Result> const & results)
+{
+	out << "{\n"
+		<< "\t\"context\": {\n"
+#if defined(__VERSION__)
+		<< "\t\t\"compiler\": \"" << __VERSION__ << "\",\n"
+#endif
+		<< "\t\t\"min_time\": " << options.min_time << ",\n"
+		<< "\t\t\"scale\": " << options.scale << ",\n"
+		<< "\t\t\"warmup\": " << options.warmup << ",\n"
+		<< "\t\t\"runs\": " << options.runs << ",\n"
+		<< "\t\t\"threads\": " << options.threads << "\n"
+		<< "\t},\n"
+		<< "\t\"benchmarks\": [";
+
+	out << std::setprecision(9);
+	for (std::size_t index = 0; index != results.size(); ++index)
+	{
+		Result const & result = results[index];
+		out << (index ? ",\n" : "\n")
+			<< "\t\t{\n"
+			<< "\t\t\t\"name\": \"" << result.name << "\",\n"
+			<< "\t\t\t\"phase\": \"" << result.phase << "\",\n"
+			<< "\t\t\t\"engine\": \"" << result.engine << "\",\n"
+			<< "\t\t\t\"bytes\": " << result.bytes << ",\n"
+			<< "\t\t\t\"tokens\": " << result.tokens << ",\n"
+			<< "\t\t\t\"nodes\": " << result.nodes << ",\n"
+			<< "\t\t\t\"iterations\": " << result.iterations << ",\n"
+			<< "\t\t\t\"compile_seconds\": " << result.compile << ",\n"
+			<< "\t\t\t\"median_seconds\": " << result.median << ",\n"
+			<< "\t\t\t\"p99_seconds\": " << result.p99 << ",\n"
+			<< "\t\t\t\"best_seconds\": " << result.best << ",\n"
+			<< "\t\t\t\"bytes_per_second\": " << per_second(result.bytes, result.median) << ",\n"
+			<< "\t\t\t\"tokens_per_second\": " << per_second(result.tokens, result.median) << ",\n"
+			<< "\t\t\t\"nodes_per_second\": " << per_second(result.nodes, result.median) << ",\n"
+			<< "\t\t\t\"peak_rss_kb\": " << result.peak_rss_kb << "\n"
+			<< "\t\t}";
+	}
+	out << "\n\t]\n}\n";
+}
+
+static void usage(char const * name)
+{
+	std::cout << "usage: " << name << " [--json FILE] [--min-time SECONDS] [--min-iterations N]"
+				<< " [--scale N] [--filter NAME] [--dump WORKLOAD]"
+				<< " [--corpus DIR] [--warmup N] [--runs N] [--threads N]" << std::endl;
+}
+
+static bool parse_options(int argc, char ** argv, Options & options)
+{
+	for (int index = 1; index != argc; ++index)
+	{
+		std::string const arg = argv[index];
+		if (index + 1 == argc)
+			return false;
+
+		char const * const value = argv[++index];
+		if (arg == "--json")
+			options.json = value;
+		else if (arg == "--min-time")
+			options.min_time = std::strtod(value, nullptr);
+		else if (arg == "--min-iterations")
+			options.min_iterations = std::max<std::size_t>(1, std::strtoul(value, nullptr, 10));
+		else if (arg == "--scale")
+			options.scale = std::max<std::size_t>(1, std::strtoul(value, nullptr, 10));
+		else if (arg == "--filter")
+			options.filter = value;
+		else if (arg == "--dump")
+			options.dump = value;
+		else if (arg == "--corpus")
+			options.corpus = value;
+		else if (arg == "--warmup")
+			options.warmup = std::strtoul(value, nullptr, 10);
+		else if (arg == "--runs")
+			options.runs = std::max<std::size_t>(1, std::strtoul(value, nullptr, 10));
+		else if (arg == "--threads")
+			options.threads = std::max<std::size_t>(1, std::strtoul(value, nullptr, 10));
+		else
+			return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	Options options = { 0.5, 5, 1, "", "", "", "", 2, 20,
+				std::max<std::size_t>(1, std::thread::hardware_concurrency()) };
+	if (!parse_options(argc, argv, options))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!options.dump.empty())
+	{
+		for (Workload const & workload : workloads)
+			if (options.dump == workload.name)
+				std::cout << generate(workload, options.scale);
+		return 0;
+	}
+
+	std::cout << std::left << std::setw(20) << "benchmark" << std::right
+				<< std::setw(10) << "bytes"
+				<< std::setw(10) << "iters"
+				<< std::setw(12) << "ms"
+				<< std::setw(12) << "MiB/s"
+				<< std::setw(12) << "Mtok/s"
+				<< std::setw(12) << "Mnode/s"
+				<< std::setw(12) << "peak KiB"
+				<< std::endl;
+
+	std::vector<Result> results;
+	for (Workload const & workload : workloads)
+	{
+		if (!options.filter.empty() && std::strstr(workload.name, options.filter.c_str()) == nullptr)
+			continue;
+
+		std::string const code = generate(workload, options.scale);
+
+		Result scan;
+		if (!bench_scan(options, workload, code, scan))
+			return 1;
+		report(std::cout, scan);
+		results.push_back(scan);
+
+		Result parse;
+		if (!bench_parse(options, workload, code, parse))
+			return 1;
+		report(std::cout, parse);
+		results.push_back(parse);
+
+		Result reparse;
+		if (!bench_reparse(options, workload, code, reparse))
+			return 1;
+		report(std::cout, reparse);
+		results.push_back(reparse);
+	}
+
+	if (!options.corpus.empty())
+	{
+		std::vector<std::string> const names = corpus_programs(options.corpus);
+		if (names.empty())
+		{
+			std::cout << "ERROR: no programs in " << options.corpus << std::endl;
+			return 1;
+		}
+
+		std::cout << std::endl
+					<< std::left << std::setw(20) << "program"
+					<< std::setw(18) << "engine" << std::right
+					<< std::setw(10) << "iters"
+					<< std::setw(12) << "compile ms"
+					<< std::setw(12) << "median ms"
+					<< std::setw(12) << "p99 ms"
+					<< std::setw(12) << "best ms"
+					<< std::setw(12) << "peak KiB"
+					<< std::endl;
+
+		for (std::string const & name : names)
+		{
+			if (!options.filter.empty() && name.find(options.filter) == std::string::npos)
+				continue;
+
+			std::string code;
+			if (!read_file(options.corpus + "/" + name + ".input", code))
+			{
+				std::cout << "ERROR: cannot read " << name << std::endl;
+				return 1;
+			}
+
+			/* without and with speculation, which only pays where it removes work */
+			for (char const * engine : engines)
+				for (bool speculate : { false, true })
+				{
+					Result run;
+					if (!bench_run(options, name, engine, speculate, code, run))
+						return 1;
+					report_run(std::cout, run);
+					results.push_back(run);
+				}
+		}
+	}
+
+	std::cout << std::endl
+				<< std::left << std::setw(20) << "request"
+				<< std::setw(18) << "engine" << std::right
+				<< std::setw(10) << "iters"
+				<< std::setw(12) << "compile ms"
+				<< std::setw(12) << "median us"
+				<< std::setw(12) << "p99 us"
+				<< std::setw(12) << "best us"
+				<< std::setw(12) << "peak KiB"
+				<< std::endl;
+
+	for (char const * engine : engines)
+	{
+		Result call;
+		if (!bench_call(options, engine, "handler", handler_program, call))
+			return 1;
+		report_call(std::cout, call);
+		results.push_back(call);
+
+		Result strings;
+		if (!bench_call(options, engine, "strings", strings_program, strings))
+			return 1;
+		report_call(std::cout, strings);
+		results.push_back(strings);
+	}
+
+	std::cout << std::endl
+				<< std::left << std::setw(20) << "threads"
+				<< std::setw(18) << "engine" << std::right
+				<< std::setw(10) << "iters"
+				<< std::setw(12) << "compile ms"
+				<< std::setw(12) << "median ms"
+				<< std::setw(12) << "fib/s"
+				<< std::setw(12) << "speedup"
+				<< std::setw(12) << "peak KiB"
+				<< std::endl;
+
+	/* 1, 2, 4 and so on up to --threads, which defaults to the number of cores */
+	for (char const * engine : engines)
+	{
+		double single = 0.0;
+		for (std::size_t threads = 1; ; threads = std::min(threads * 2, options.threads))
+		{
+			Result result;
+			if (!bench_threads(options, engine, threads, result))
+				return 1;
+			if (threads == 1)
+				single = per_second(thread_calls, result.median);
+			report_threads(std::cout, result, threads, single);
+			results.push_back(result);
+
+			if (threads == options.threads)
+				break;
+		}
+	}
+
+	if (!options.json.empty())
+	{
+		std::ofstream out(options.json);
+		report_json(out, options, results);
+		if (!out)
+		{
+			std::cout << "ERROR: cannot write " << options.json << std::endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}
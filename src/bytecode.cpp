@@ -0,0 +1,349 @@
+#include <cassert>
+#include <cstring>
+
+#include <bytecode.hpp>
+
+namespace vm
+{
+
+	char const * Opcode::name(Kind kind) noexcept
+	{
+		switch (kind)
+		{
+		default: assert(0); return "";
+
+		#define NAME(o, a, e) case o: return #o;
+		FOR_OPCODES(NAME)
+		#undef NAME
+		}
+	}
+
+	bool Opcode::has_argument(Kind kind) noexcept
+	{
+		switch (kind)
+		{
+		default: assert(0); return false;
+
+		#define ARGUMENT(o, a, e) case o: return a;
+		FOR_OPCODES(ARGUMENT)
+		#undef ARGUMENT
+		}
+	}
+
+	int Opcode::stack_effect(Kind kind) noexcept
+	{
+		switch (kind)
+		{
+		default: assert(0); return 0;
+
+		#define EFFECT(o, a, e) case o: return e;
+		FOR_OPCODES(EFFECT)
+		#undef EFFECT
+		}
+	}
+
+	bool Opcode::is_jump(Kind kind) noexcept
+	{
+		switch (kind)
+		{
+		default: return false;
+		case jmp: case jz: case jnz:
+		case jieq: case jine: case jilt: case jile: case jigt: case jige:
+			return true;
+		}
+	}
+
+	bool Opcode::is_conditional(Kind kind) noexcept
+	{ return kind != jmp && is_jump(kind); }
+
+	Opcode::Kind Opcode::inverse(Kind kind) noexcept
+	{
+		switch (kind)
+		{
+		default: assert(0); return kind;
+		case jz: return jnz;
+		case jnz: return jz;
+		case jieq: return jine;
+		case jine: return jieq;
+		case jilt: return jige;
+		case jige: return jilt;
+		case jile: return jigt;
+		case jigt: return jile;
+		}
+	}
+
+	bool Opcode::has_operands(Kind kind) noexcept
+	{ return kind == load2 || kind == loadi; }
+
+
+	Code::Code(std::string name, Type return_type, std::size_t parameters, std::size_t captures)
+		: name_(std::move(name))
+		, return_type_(return_type)
+		, parameters_(parameters)
+		, captures_(captures)
+		, locals_(parameters + captures)
+		, stack_(0)
+		, max_stack_(0)
+		, lines_(nullptr)
+		, baseline_(nullptr)
+		, speculative_(nullptr)
+		, settled_(false)
+		, slot_(0)
+	{ }
+
+	Code::~Code()
+	{ delete speculative_.load(); }
+
+	std::string const & Code::name() const noexcept
+	{ return name_; }
+
+	Type Code::return_type() const noexcept
+	{ return return_type_; }
+
+	std::size_t Code::parameters_number() const noexcept
+	{ return parameters_; }
+
+	std::size_t Code::captures_number() const noexcept
+	{ return captures_; }
+
+	std::size_t Code::locals_number() const noexcept
+	{ return locals_; }
+
+	std::size_t Code::allocate_local() noexcept
+	{ return locals_++; }
+
+	std::size_t Code::stack() const noexcept
+	{ return stack_; }
+
+	std::size_t Code::max_stack() const noexcept
+	{ return max_stack_; }
+
+	void Code::set_stack(std::size_t depth) noexcept
+	{ stack_ = depth; }
+
+	void Code::adjust_stack(int effect) noexcept
+	{
+		assert(effect >= 0 || stack_ >= static_cast<std::size_t>(-effect));
+		stack_ += effect;
+		if (stack_ > max_stack_)
+			max_stack_ = stack_;
+	}
+
+	std::size_t Code::size() const noexcept
+	{ return code_.size(); }
+
+	Instruction const * Code::instructions() const noexcept
+	{ return code_.data(); }
+
+	Instruction const & Code::at(std::size_t index) const noexcept
+	{ return code_[index]; }
+
+	Location const & Code::location_at(std::size_t index) const noexcept
+	{ return locations_[index]; }
+
+	std::size_t Code::line_at(std::size_t index) const noexcept
+	{ return lines_ ? lines_->line(locations_[index]) : LineTable::npos; }
+
+	void Code::set_lines(LineTable const * lines) noexcept
+	{ lines_ = lines; }
+
+	void Code::relocate(std::ptrdiff_t delta) noexcept
+	{
+		for (Location & location : locations_)
+			if (location.is_reachable())
+				Location(static_cast<std::uint32_t>(location.position() + delta)).swap(location);
+		if (Code * const speculative = speculative_.load())
+			speculative->relocate(delta);
+	}
+
+	std::size_t Code::emit(Opcode::Kind opcode, std::int32_t arg, Location const & location)
+	{
+		Instruction const insn = { opcode, arg };
+		code_.push_back(insn);
+		locations_.push_back(location);
+		adjust_stack(Opcode::stack_effect(opcode));
+		return code_.size() - 1;
+	}
+
+	void Code::patch(std::size_t index, std::int32_t arg) noexcept
+	{ code_[index].arg = arg; }
+
+	void Code::rewrite(InstructionsType code, std::vector<Location> locations) noexcept
+	{
+		assert(code.size() == locations.size());
+		code_.swap(code);
+		locations_.swap(locations);
+	}
+
+	std::size_t Code::add_constant(Value value)
+	{
+		std::uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+
+		std::pair<std::unordered_map<std::uint64_t, std::size_t>::iterator, bool> const added
+			= constant_indices_.insert(std::make_pair(bits, constants_.size()));
+		if (added.second)
+			constants_.push_back(value);
+		return added.first->second;
+	}
+
+	Value const & Code::constant(std::size_t index) const noexcept
+	{ return constants_[index]; }
+
+	void Code::seal()
+	{ branches_.reset(new Counter[2 * code_.size()]); }
+
+	Counter const & Code::calls() const noexcept
+	{ return calls_; }
+
+	Counter const & Code::taken(std::size_t index) const noexcept
+	{ return branches_[2 * index]; }
+
+	Counter const & Code::fallen(std::size_t index) const noexcept
+	{ return branches_[2 * index + 1]; }
+
+	std::unique_ptr<Code> Code::derive(InstructionsType code, std::vector<Location> locations,
+				std::vector<std::size_t> targets) const
+	{
+		std::unique_ptr<Code> derived(new Code(name_, return_type_, parameters_, captures_));
+		derived->locals_ = locals_;
+		derived->max_stack_ = max_stack_;
+		derived->rewrite(std::move(code), std::move(locations));
+		derived->constants_ = constants_;
+		derived->constant_indices_ = constant_indices_;
+		derived->lines_ = lines_;
+		derived->baseline_ = this;
+		derived->deopt_targets_ = std::move(targets);
+		derived->slot_ = slot_;
+		return derived;
+	}
+
+	Code const * Code::baseline() const noexcept
+	{ return baseline_; }
+
+	std::size_t Code::deopt_target(std::size_t index) const noexcept
+	{ return deopt_targets_[index]; }
+
+	Counter const & Code::deopts() const noexcept
+	{ return deopts_; }
+
+	Code const * Code::speculative() const noexcept
+	{ return speculative_.load(std::memory_order_acquire); }
+
+	bool Code::install(std::unique_ptr<Code> speculative) const noexcept
+	{
+		Code * expected = nullptr;
+		if (!speculative_.compare_exchange_strong(expected, speculative.get(), std::memory_order_acq_rel))
+			return false;
+		speculative.release();
+		return true;
+	}
+
+	bool Code::settled() const noexcept
+	{ return settled_.load(std::memory_order_relaxed); }
+
+	void Code::settle() const noexcept
+	{ settled_.store(true, std::memory_order_relaxed); }
+
+	std::size_t Code::slot() const noexcept
+	{ return slot_; }
+
+	void Code::set_slot(std::size_t slot) noexcept
+	{ slot_ = slot; }
+
+
+	Module::Module()
+		: entry_(0)
+		, globals_(0)
+	{ }
+
+	Module::~Module()
+	{
+		for (Code * code : functions_)
+			delete code;
+		for (Code * code : retired_)
+			delete code;
+	}
+
+	std::size_t Module::functions_number() const noexcept
+	{ return functions_.size(); }
+
+	Code const & Module::function(std::size_t index) const noexcept
+	{ return *functions_[index]; }
+
+	Code & Module::function(std::size_t index) noexcept
+	{ return *functions_[index]; }
+
+	std::size_t Module::add_function(std::unique_ptr<Code> code)
+	{
+		code->set_lines(&lines_);
+		code->set_slot(functions_.size());
+		functions_.push_back(code.get());
+		code.release();
+		return functions_.size() - 1;
+	}
+
+	std::size_t Module::find_function(std::string const & name) const noexcept
+	{
+		for (std::size_t index = 0; index != functions_.size(); ++index)
+			if (functions_[index]->name() == name)
+				return index;
+		return npos;
+	}
+
+	void Module::replace_function(std::size_t index, std::unique_ptr<Code> code)
+	{
+		code->set_lines(&lines_);
+		code->set_slot(index);
+		retired_.push_back(functions_[index]);
+		functions_[index] = code.release();
+	}
+
+	std::size_t Module::entry() const noexcept
+	{ return entry_; }
+
+	void Module::set_entry(std::size_t index) noexcept
+	{ entry_ = index; }
+
+	std::size_t Module::globals_number() const noexcept
+	{ return globals_; }
+
+	std::size_t Module::allocate_global() noexcept
+	{ return globals_++; }
+
+	std::size_t Module::natives_number() const noexcept
+	{ return natives_.size(); }
+
+	Module::Native const & Module::native(std::size_t index) const noexcept
+	{ return natives_[index]; }
+
+	std::size_t Module::add_native(Native native)
+	{
+		natives_.push_back(native);
+		return natives_.size() - 1;
+	}
+
+	std::size_t Module::reductions_number() const noexcept
+	{ return reductions_.size(); }
+
+	Reduction const & Module::reduction(std::size_t index) const noexcept
+	{ return *reductions_[index]; }
+
+	std::size_t Module::add_reduction(Reduction const * reduction)
+	{
+		reductions_.push_back(reduction);
+		return reductions_.size() - 1;
+	}
+
+	char const * Module::intern(std::string const & value)
+	{
+		return strings_.insert(value).first->c_str();
+	}
+
+	LineTable const & Module::lines() const noexcept
+	{ return lines_; }
+
+	void Module::set_lines(LineTable lines)
+	{ lines_ = std::move(lines); }
+
+}
@@ -0,0 +1,1380 @@
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <set>
+#include <string>
+#include <utility>
+
+#include <compiler.hpp>
+#include <optimizer.hpp>
+#include <peephole.hpp>
+#include <stats.hpp>
+#include <vectorizer.hpp>
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		typedef std::set<Scope const *> ScopesType;
+		typedef std::set<Variable const *> VariablesType;
+
+		static bool is_numeric(Type type) noexcept
+		{ return type == Type::Int || type == Type::Double; }
+
+		static char const * type_name(Type type) noexcept
+		{
+			switch (type)
+			{
+			default: return "invalid";
+			case Type::Double: return "double";
+			case Type::Int: return "int";
+			case Type::String: return "string";
+			case Type::Void: return "void";
+			}
+		}
+
+		/* statements leave nothing on the stack, expressions leave their value */
+		static bool is_expression(ASTNode * node) noexcept
+		{
+			return dynamic_cast<BinaryExprNode *>(node) || dynamic_cast<UnaryExprNode *>(node)
+				|| dynamic_cast<IntLitNode *>(node) || dynamic_cast<DoubleLitNode *>(node)
+				|| dynamic_cast<StringLitNode *>(node) || dynamic_cast<LoadNode *>(node)
+				|| dynamic_cast<CallNode *>(node);
+		}
+
+		/* the scope that holds the parameters, or the top scope for the top level code */
+		static Scope const * root_scope(Function const & function) noexcept
+		{
+			Block const * const body = function.body();
+			return body->owner() ? body->owner() : body->scope();
+		}
+
+		typedef std::vector<Variable const *> EnvironmentType;
+		typedef std::map<Function const *, EnvironmentType> EnvironmentsType;
+
+		/*
+		 * escape and free variable analysis: a use is resolved up the scope
+		 * chain, the first function root on it owns the variable, and if
+		 * that is not the root of the function the use is in the variable
+		 * escapes its frame. The environment of a function is what it uses
+		 * that way plus what the functions it calls need and it does not
+		 * own, so a caller can always pass it on; a function that uses
+		 * nothing of an enclosing one has an empty environment and is
+		 * called as any other. Every other local lives and dies with one
+		 * activation.
+		 */
+		class Captures : public Visitor
+		{
+		public:
+			using Visitor::visit;
+
+			Captures(Compiler::SlotsType const & globals, ScopesType const & roots)
+				: globals_(globals)
+				, roots_(roots)
+				, function_(nullptr)
+				, root_(nullptr)
+			{ }
+
+			/* functions called before they are analyzed are revisited */
+			void analyze(std::vector<Function *> const & functions)
+			{
+				for (Function * function : functions)
+				{
+					function_ = function;
+					root_ = root_scope(*function);
+					environments_[function];
+					function->body()->visit(*this);
+				}
+
+				for (bool changed = true; changed; )
+				{
+					changed = false;
+					for (CallsType::value_type const & call : calls_)
+					{
+						EnvironmentType const callee = environments_[call.second];
+						for (Variable const * var : callee)
+							changed = capture(*call.first, root_scope(*call.first), var) || changed;
+					}
+				}
+			}
+
+			/* captured by some function, the owner keeps its slot for good */
+			VariablesType const & captured() const noexcept
+			{ return captured_; }
+
+			/* in the order the captures are passed */
+			EnvironmentsType const & environments() const noexcept
+			{ return environments_; }
+
+			virtual void visit(LoadNode & node)
+			{ use(node.variable()); }
+
+			virtual void visit(StoreNode & node)
+			{
+				use(node.variable());
+				node.visit_children(*this);
+			}
+
+			virtual void visit(LetNode & node)
+			{
+				use(node.variable());
+				node.visit_children(*this);
+			}
+
+			virtual void visit(ForNode & node)
+			{
+				use(node.variable());
+				Reduction const * const reduction = node.reduction();
+				if (reduction)
+				{
+					use(reduction->accumulator());
+					for (std::size_t index = 0; index != reduction->invariants_number(); ++index)
+						use(reduction->invariant_at(index));
+				}
+				node.visit_children(*this);
+			}
+
+			virtual void visit(CallNode & node)
+			{
+				Function const * const callee = node.function();
+				if (callee && !callee->native())
+					calls_.insert(std::make_pair(function_, callee));
+				node.visit_children(*this);
+			}
+
+		private:
+			typedef std::set<std::pair<Function const *, Function const *> > CallsType;
+
+			Compiler::SlotsType const & globals_;
+			ScopesType const & roots_;
+			Function const * function_;
+			Scope const * root_;
+			CallsType calls_;
+			VariablesType captured_;
+			EnvironmentsType environments_;
+
+			void use(Variable const * var)
+			{ capture(*function_, root_, var); }
+
+			bool capture(Function const & function, Scope const * root, Variable const * var)
+			{
+				if (globals_.count(var))
+					return false;
+
+				for (Scope const * scope = var->owner(); scope; scope = scope->owner())
+				{
+					if (scope == root)
+						return false;
+
+					if (roots_.count(scope))
+					{
+						EnvironmentType & environment = environments_[&function];
+						if (std::find(environment.begin(), environment.end(), var) != environment.end())
+							return false;
+
+						environment.push_back(var);
+						captured_.insert(var);
+						return true;
+					}
+				}
+				return false;
+			}
+		};
+
+		class FunctionCompiler : public Visitor
+		{
+		public:
+			using Visitor::visit;
+
+			FunctionCompiler(Module & module, Code & code, Function & function,
+								Compiler::SlotsType const & globals,
+								Compiler::FunctionsType const & functions,
+								Compiler::NativesType & natives,
+								ScopesType const & roots,
+								Captures const & captures, Status & status)
+				: module_(module)
+				, code_(code)
+				, function_(function)
+				, globals_(globals)
+				, functions_(functions)
+				, natives_(natives)
+				, roots_(roots)
+				, captured_(captures.captured())
+				, environments_(captures.environments())
+				, root_(root_scope(function))
+				, status_(status)
+			{
+				for (std::size_t index = 0; index != function.parameters_number(); ++index)
+				{
+					Variable const * const param = root_->lookup_variable(function.name_at(index));
+					assert(param);
+					locals_[param] = index;
+				}
+
+				EnvironmentType const & environment = environments_.at(&function);
+				for (std::size_t index = 0; index != environment.size(); ++index)
+					refs_[environment[index]] = function.parameters_number() + index;
+			}
+
+			bool compile()
+			{
+				/*
+				 * a nested function may run before the declaration of what it
+				 * captured, the captured variables of the frame start out zero
+				 */
+				for (Variable const * var : captured_)
+					if (!locals_.count(var) && !refs_.count(var) && owned(var))
+					{
+						emit(Opcode::ipush, 0, function_.start());
+						store(var, function_.start());
+					}
+
+				function_.body()->visit(*this);
+
+				Location const end = function_.body()->finish();
+				switch (function_.return_type())
+				{
+				default:
+					emit(Opcode::retv, 0, end);
+					break;
+				case Type::Int:
+					emit(Opcode::ipush, 0, end);
+					emit(Opcode::ret, 0, end);
+					break;
+				case Type::Double:
+					constant(Opcode::dconst, Value(), end);
+					emit(Opcode::ret, 0, end);
+					break;
+				case Type::String:
+				{
+					Value empty;
+					empty.as_string = module_.intern("");
+					constant(Opcode::sconst, empty, end);
+					emit(Opcode::ret, 0, end);
+					break;
+				}
+				}
+
+				return is_ok();
+			}
+
+			virtual void visit(Block & node)
+			{
+				for (ASTNode * stmt : node)
+				{
+					if (!is_ok())
+						return;
+
+					stmt->visit(*this);
+					if (is_expression(stmt) && expression_type(stmt) != Type::Void)
+						emit(Opcode::pop, 0, stmt->finish());
+				}
+				release(node.scope());
+			}
+
+			virtual void visit(BinaryExprNode & node)
+			{
+				Token::Kind const kind = node.kind();
+				if (kind == Token::land || kind == Token::lor)
+				{
+					logical(node);
+					return;
+				}
+
+				if (kind == Token::range)
+				{
+					error("range is only allowed in a for loop", node.start());
+					return;
+				}
+
+				Type const left = expression_type(node.left());
+				Type const right = expression_type(node.right());
+				if (left == Type::String && right == Type::String)
+				{
+					strings(node);
+					return;
+				}
+
+				if (!is_numeric(left) || !is_numeric(right))
+				{
+					error(std::string("invalid operands to ") + Token::get_token_value(kind), node.start());
+					return;
+				}
+
+				bool const is_double = left == Type::Double || right == Type::Double;
+				Opcode::Kind opcode;
+				switch (kind)
+				{
+				default:
+					error(std::string("unexpected binary operator ") + Token::get_token_value(kind), node.start());
+					return;
+				case Token::add: opcode = is_double ? Opcode::dadd : Opcode::iadd; break;
+				case Token::sub: opcode = is_double ? Opcode::dsub : Opcode::isub; break;
+				case Token::mul: opcode = is_double ? Opcode::dmul : Opcode::imul; break;
+				case Token::div: opcode = is_double ? Opcode::ddiv : Opcode::idiv; break;
+				case Token::eq: opcode = is_double ? Opcode::deq : Opcode::ieq; break;
+				case Token::neq: opcode = is_double ? Opcode::dne : Opcode::ine; break;
+				case Token::lt: opcode = is_double ? Opcode::dlt : Opcode::ilt; break;
+				case Token::le: opcode = is_double ? Opcode::dle : Opcode::ile; break;
+				case Token::gt: opcode = is_double ? Opcode::dgt : Opcode::igt; break;
+				case Token::ge: opcode = is_double ? Opcode::dge : Opcode::ige; break;
+				case Token::mod: opcode = Opcode::imod; break;
+				case Token::aor: opcode = Opcode::ior; break;
+				case Token::aand: opcode = Opcode::iand; break;
+				case Token::axor: opcode = Opcode::ixor; break;
+				}
+
+				Type const type = is_double ? Type::Double : Type::Int;
+				if (is_double && (opcode == Opcode::imod || opcode == Opcode::ior
+						|| opcode == Opcode::iand || opcode == Opcode::ixor))
+				{
+					error(std::string("int operands expected for ") + Token::get_token_value(kind), node.start());
+					return;
+				}
+
+				expression(node.left(), type);
+				expression(node.right(), type);
+				emit(opcode, 0, node.start());
+			}
+
+			virtual void visit(UnaryExprNode & node)
+			{
+				Type const type = expression_type(node.operand());
+				switch (node.kind())
+				{
+				default:
+					break;
+				case Token::sub:
+					if (!is_numeric(type))
+						break;
+					node.operand()->visit(*this);
+					emit(type == Type::Int ? Opcode::ineg : Opcode::dneg, 0, node.start());
+					return;
+				case Token::lnot:
+					condition(node.operand());
+					emit(Opcode::lnot, 0, node.start());
+					return;
+				case Token::anot:
+					if (type != Type::Int)
+						break;
+					node.operand()->visit(*this);
+					emit(Opcode::inot, 0, node.start());
+					return;
+				}
+
+				error(std::string("invalid operand to unary ") + Token::get_token_value(node.kind()), node.start());
+			}
+
+			virtual void visit(StringLitNode & node)
+			{
+				Value value;
+				value.as_string = module_.intern(node.value());
+				constant(Opcode::sconst, value, node.start());
+			}
+
+			virtual void visit(IntLitNode & node)
+			{
+				if (node.value() >= std::numeric_limits<std::int32_t>::min()
+						&& node.value() <= std::numeric_limits<std::int32_t>::max())
+				{
+					emit(Opcode::ipush, static_cast<std::int32_t>(node.value()), node.start());
+					return;
+				}
+
+				Value value;
+				value.as_int = node.value();
+				constant(Opcode::iconst, value, node.start());
+			}
+
+			virtual void visit(DoubleLitNode & node)
+			{
+				Value value;
+				value.as_double = node.value();
+				constant(Opcode::dconst, value, node.start());
+			}
+
+			virtual void visit(LoadNode & node)
+			{ load(node.variable(), node.start()); }
+
+			virtual void visit(StoreNode & node)
+			{
+				Variable * const var = node.variable();
+				Type const type = var->type();
+
+				if (node.kind() == Token::assign)
+				{
+					expression(node.expression(), type);
+					store(var, node.start());
+					return;
+				}
+
+				Type const expr = expression_type(node.expression());
+				if (type == Type::String && expr == Type::String && node.kind() == Token::incrset)
+				{
+					load(var, node.start());
+					node.expression()->visit(*this);
+					emit(Opcode::sadd, 0, node.start());
+					store(var, node.start());
+					return;
+				}
+
+				if (!is_numeric(type) || !is_numeric(expr))
+				{
+					error(std::string("invalid operands to ") + Token::get_token_value(node.kind()), node.start());
+					return;
+				}
+
+				/* int x += 0.5 is computed in double and converted back */
+				Type const op = (type == Type::Double || expr == Type::Double) ? Type::Double : Type::Int;
+				load(var, node.start());
+				convert(type, op, node.start());
+				expression(node.expression(), op);
+				if (node.kind() == Token::incrset)
+					emit(op == Type::Int ? Opcode::iadd : Opcode::dadd, 0, node.start());
+				else
+					emit(op == Type::Int ? Opcode::isub : Opcode::dsub, 0, node.start());
+				convert(op, type, node.start());
+				store(var, node.start());
+			}
+
+			virtual void visit(LetNode & node)
+			{
+				Variable * const var = node.variable();
+				expression(node.init(), var->type());
+				store(var, node.start());
+				node.value()->visit(*this);
+			}
+
+			/*
+			 * the bounds are evaluated once and the loop never computes
+			 * to + 1, so 'to' may be INT64_MAX; a counted loop runs on a
+			 * hidden trip count, any other one stops after the iteration
+			 * that leaves the variable at or past the upper bound
+			 */
+			virtual void visit(ForNode & node)
+			{
+				Variable * const var = node.variable();
+				if (var->type() != Type::Int)
+				{
+					error("int loop variable expected", node.start());
+					return;
+				}
+
+				if (!node.from() || !node.to())
+				{
+					error("range expected in for loop", node.expression()->start());
+					return;
+				}
+
+				std::int32_t const end = allocate();
+				expression(node.from(), Type::Int);
+				store(var, node.start());
+				expression(node.to(), Type::Int);
+				emit(Opcode::store, end, node.start());
+
+				if (node.reduction())
+					reduce(node, end);
+				else
+					loop(node, end);
+
+				free_.push_back(end);
+				if (node.body()->owner() != root_)
+					release(node.body()->owner());
+			}
+
+			void loop(ForNode & node, std::int32_t end)
+			{
+				Variable * const var = node.variable();
+				bool const counted = node.is_counted() && !node.writes_variable();
+
+				load(var, node.start());
+				emit(Opcode::load, end, node.start());
+				emit(Opcode::igt, 0, node.start());
+				std::size_t const skip = emit(Opcode::jnz, 0, node.start());
+
+				/* from - to counts up to zero, it wraps for the whole int range */
+				if (counted)
+				{
+					load(var, node.start());
+					emit(Opcode::load, end, node.start());
+					emit(Opcode::isub, 0, node.start());
+					emit(Opcode::store, end, node.start());
+				}
+
+				std::size_t const top = code_.size();
+				node.body()->visit(*this);
+
+				std::size_t done;
+				if (counted)
+				{
+					emit(Opcode::load, end, node.finish());
+					done = emit(Opcode::jz, 0, node.finish());
+					emit(Opcode::iinc, end, node.finish());
+				}
+				else
+				{
+					load(var, node.finish());
+					emit(Opcode::load, end, node.finish());
+					emit(Opcode::ige, 0, node.finish());
+					done = emit(Opcode::jnz, 0, node.finish());
+				}
+				increment(var, node.finish());
+				emit(Opcode::jmp, static_cast<std::int32_t>(top), node.finish());
+
+				code_.patch(skip, static_cast<std::int32_t>(code_.size()));
+				code_.patch(done, static_cast<std::int32_t>(code_.size()));
+			}
+
+			virtual void visit(WhileNode & node)
+			{
+				std::size_t const top = code_.size();
+				condition(node.expression());
+				std::size_t const exit = emit(Opcode::jz, 0, node.start());
+
+				node.body()->visit(*this);
+				emit(Opcode::jmp, static_cast<std::int32_t>(top), node.finish());
+				code_.patch(exit, static_cast<std::int32_t>(code_.size()));
+			}
+
+			virtual void visit(IfNode & node)
+			{
+				condition(node.expression());
+				if (node.else_first())
+				{
+					std::size_t const skip = emit(Opcode::jnz, 0, node.start());
+					node.else_block()->visit(*this);
+					std::size_t const done = emit(Opcode::jmp, 0, node.finish());
+					code_.patch(skip, static_cast<std::int32_t>(code_.size()));
+					node.then_block()->visit(*this);
+					code_.patch(done, static_cast<std::int32_t>(code_.size()));
+					return;
+				}
+
+				std::size_t const skip = emit(Opcode::jz, 0, node.start());
+
+				node.then_block()->visit(*this);
+				if (!node.else_block())
+				{
+					code_.patch(skip, static_cast<std::int32_t>(code_.size()));
+					return;
+				}
+
+				std::size_t const done = emit(Opcode::jmp, 0, node.finish());
+				code_.patch(skip, static_cast<std::int32_t>(code_.size()));
+				node.else_block()->visit(*this);
+				code_.patch(done, static_cast<std::int32_t>(code_.size()));
+			}
+
+			virtual void visit(ReturnNode & node)
+			{
+				Type const type = function_.return_type();
+				if (!node.expression())
+				{
+					if (type != Type::Void)
+						error("return value expected", node.start());
+					emit(Opcode::retv, 0, node.start());
+					return;
+				}
+
+				if (type == Type::Void)
+				{
+					error("void function cannot return a value", node.start());
+					return;
+				}
+
+				expression(node.expression(), type);
+				emit(Opcode::ret, 0, node.start());
+			}
+
+			virtual void visit(PrintNode & node)
+			{
+				for (std::size_t index = 0; index != node.parameters_number(); ++index)
+				{
+					ASTNode * const expr = node.at(index);
+					Type const type = expression_type(expr);
+
+					expr->visit(*this);
+					switch (type)
+					{
+					default:
+						error(std::string("cannot print ") + type_name(type), expr->start());
+						return;
+					case Type::Int: emit(Opcode::iprint, 0, expr->start()); break;
+					case Type::Double: emit(Opcode::dprint, 0, expr->start()); break;
+					case Type::String: emit(Opcode::sprint, 0, expr->start()); break;
+					}
+				}
+			}
+
+			virtual void visit(CallNode & node)
+			{
+				Function * const callee = node.function();
+				assert(callee);
+
+				for (std::size_t index = 0; index != node.parameters_number(); ++index)
+					expression(node.at(index), callee->type_at(index));
+
+				EnvironmentType const & environment = environments_.at(callee);
+				for (Variable const * var : environment)
+				{
+					std::int32_t slot;
+					switch (resolve(var, slot))
+					{
+					default:
+						break;
+					case Storage::local:
+						emit(Opcode::ref, slot, node.start());
+						break;
+					case Storage::reference:
+						emit(Opcode::load, slot, node.start());
+						break;
+					}
+				}
+
+				int const params = static_cast<int>(node.parameters_number() + environment.size());
+				int const result = (callee->return_type() == Type::Void) ? 0 : 1;
+
+				/* a native is called directly, without its bytecode stub */
+				NativeCallNode * const target = callee->native();
+				if (target)
+					emit(Opcode::native, native(*target), node.start());
+				else
+					emit(Opcode::call, static_cast<std::int32_t>(functions_.at(callee)), node.start());
+				code_.adjust_stack(result - params);
+			}
+
+			virtual void visit(NativeCallNode & node)
+			{
+				for (std::size_t index = 0; index != node.parameters_number(); ++index)
+					emit(Opcode::load, static_cast<std::int32_t>(index), node.start());
+
+				std::int32_t const index = native(node);
+				emit(Opcode::native, index, node.start());
+
+				bool const is_void = node.return_type() == Type::Void;
+				code_.adjust_stack((is_void ? 0 : 1) - static_cast<int>(node.parameters_number()));
+				emit(is_void ? Opcode::retv : Opcode::ret, 0, node.start());
+			}
+
+		private:
+			typedef std::map<Variable const *, std::size_t> LocalsType;
+
+			/* where a variable lives: a reference is a local holding its address */
+			enum class Storage
+			{
+				none,
+				global,
+				local,
+				reference
+			};
+
+			Module & module_;
+			Code & code_;
+			Function & function_;
+			Compiler::SlotsType const & globals_;
+			Compiler::FunctionsType const & functions_;
+			Compiler::NativesType & natives_;
+			ScopesType const & roots_;
+			VariablesType const & captured_;
+			EnvironmentsType const & environments_;
+			Scope const * root_;
+			LocalsType locals_;
+			LocalsType refs_;
+
+			/* slots of the scopes that have been compiled, taken again first */
+			std::vector<std::int32_t> free_;
+
+			Status & status_;
+
+			bool is_ok() const noexcept
+			{ return status_.code() != Status::ERROR; }
+
+			void error(std::string message, Location const & location)
+			{
+				if (is_ok())
+					Status(Status::ERROR, std::move(message), location).swap(status_);
+			}
+
+			/* nothing is emitted after an error, so the stack depth stays consistent */
+			std::size_t emit(Opcode::Kind opcode, std::int32_t arg, Location const & location)
+			{
+				if (!is_ok())
+					return 0;
+				return code_.emit(opcode, arg, location);
+			}
+
+			std::int32_t allocate()
+			{
+				if (free_.empty())
+					return static_cast<std::int32_t>(code_.allocate_local());
+
+				std::int32_t const slot = free_.back();
+				free_.pop_back();
+				return slot;
+			}
+
+			/*
+			 * a declaration always stores before the first load, so once the
+			 * code of a scope is over the slots of its variables are dead and
+			 * may be taken by a later scope; captured variables keep theirs
+			 */
+			void release(Scope const * scope)
+			{
+				for (Scope::const_variable_iterator it = scope->variables_begin(); it != scope->variables_end(); ++it)
+				{
+					LocalsType::iterator const slot = locals_.find(it->second);
+					if (slot == locals_.end() || captured_.count(it->second))
+						continue;
+
+					free_.push_back(static_cast<std::int32_t>(slot->second));
+					locals_.erase(slot);
+				}
+			}
+
+			void constant(Opcode::Kind opcode, Value value, Location const & location)
+			{ emit(opcode, static_cast<std::int32_t>(code_.add_constant(value)), location); }
+
+			void convert(Type from, Type to, Location const & location)
+			{
+				if (from == to)
+					return;
+
+				if (from == Type::Int && to == Type::Double)
+					emit(Opcode::i2d, 0, location);
+				else if (from == Type::Double && to == Type::Int)
+					emit(Opcode::d2i, 0, location);
+				else
+					error(std::string("cannot convert ") + type_name(from) + " to " + type_name(to), location);
+			}
+
+			void expression(ASTNode * node, Type type)
+			{
+				/* an int literal used as a double is converted here instead of by i2d */
+				IntLitNode const * const literal = dynamic_cast<IntLitNode const *>(node);
+				if (literal && type == Type::Double)
+				{
+					Value value;
+					value.as_double = static_cast<double>(literal->value());
+					constant(Opcode::dconst, value, node->start());
+					return;
+				}
+
+				node->visit(*this);
+				convert(expression_type(node), type, node->start());
+			}
+
+			/* leaves an int that is zero for false */
+			void condition(ASTNode * node)
+			{
+				Type const type = expression_type(node);
+				if (type == Type::Int)
+				{
+					node->visit(*this);
+					return;
+				}
+
+				if (type == Type::Double)
+				{
+					node->visit(*this);
+					constant(Opcode::dconst, Value(), node->start());
+					emit(Opcode::dne, 0, node->start());
+					return;
+				}
+
+				error(std::string("int or double condition expected, got ") + type_name(type), node->start());
+			}
+
+			void logical(BinaryExprNode & node)
+			{
+				bool const is_and = node.kind() == Token::land;
+
+				condition(node.left());
+				std::size_t const shortcut = emit(is_and ? Opcode::jz : Opcode::jnz, 0, node.start());
+
+				condition(node.right());
+				emit(Opcode::ipush, 0, node.start());
+				emit(Opcode::ine, 0, node.start());
+				std::size_t const done = emit(Opcode::jmp, 0, node.start());
+
+				code_.set_stack(code_.stack() - 1);
+				code_.patch(shortcut, static_cast<std::int32_t>(code_.size()));
+				emit(Opcode::ipush, is_and ? 0 : 1, node.start());
+				code_.patch(done, static_cast<std::int32_t>(code_.size()));
+			}
+
+			void strings(BinaryExprNode & node)
+			{
+				Opcode::Kind opcode;
+				switch (node.kind())
+				{
+				default:
+					error(std::string("invalid string operation ") + Token::get_token_value(node.kind()), node.start());
+					return;
+				case Token::add: opcode = Opcode::sadd; break;
+				case Token::eq: opcode = Opcode::seq; break;
+				case Token::neq: opcode = Opcode::sne; break;
+				}
+
+				node.left()->visit(*this);
+				node.right()->visit(*this);
+				emit(opcode, 0, node.start());
+			}
+
+			/* declared in this function and not in a function nested in it */
+			bool owned(Variable const * var) const noexcept
+			{
+				for (Scope const * scope = var->owner(); scope; scope = scope->owner())
+				{
+					if (scope == root_)
+						return true;
+					if (roots_.count(scope))
+						return false;
+				}
+				return false;
+			}
+
+			/*
+			 * a global, a slot of this function or a variable of an
+			 * enclosing function reached through the address its caller
+			 * passed in the environment
+			 */
+			Storage resolve(Variable const * var, std::int32_t & slot)
+			{
+				Compiler::SlotsType::const_iterator const git = globals_.find(var);
+				if (git != globals_.end())
+				{
+					slot = static_cast<std::int32_t>(git->second);
+					return Storage::global;
+				}
+
+				LocalsType::const_iterator const lit = locals_.find(var);
+				if (lit != locals_.end())
+				{
+					slot = static_cast<std::int32_t>(lit->second);
+					return Storage::local;
+				}
+
+				LocalsType::const_iterator const rit = refs_.find(var);
+				if (rit != refs_.end())
+				{
+					slot = static_cast<std::int32_t>(rit->second);
+					return Storage::reference;
+				}
+
+				if (owned(var))
+				{
+					slot = allocate();
+					locals_[var] = static_cast<std::size_t>(slot);
+					return Storage::local;
+				}
+
+				error("variable " + var->name() + " of an enclosing function is not accessible", var->start());
+				return Storage::none;
+			}
+
+			void load(Variable const * var, Location const & location)
+			{
+				std::int32_t slot;
+				switch (resolve(var, slot))
+				{
+				case Storage::none: break;
+				case Storage::global: emit(Opcode::gload, slot, location); break;
+				case Storage::local: emit(Opcode::load, slot, location); break;
+				case Storage::reference: emit(Opcode::rload, slot, location); break;
+				}
+			}
+
+			void store(Variable const * var, Location const & location)
+			{
+				std::int32_t slot;
+				switch (resolve(var, slot))
+				{
+				case Storage::none: break;
+				case Storage::global: emit(Opcode::gstore, slot, location); break;
+				case Storage::local: emit(Opcode::store, slot, location); break;
+				case Storage::reference: emit(Opcode::rstore, slot, location); break;
+				}
+			}
+
+			void increment(Variable const * var, Location const & location)
+			{
+				std::int32_t slot;
+				Storage const storage = resolve(var, slot);
+				if (storage == Storage::none)
+					return;
+
+				if (storage == Storage::local)
+				{
+					emit(Opcode::iinc, slot, location);
+					return;
+				}
+
+				load(var, location);
+				emit(Opcode::ipush, 1, location);
+				emit(Opcode::iadd, 0, location);
+				store(var, location);
+			}
+
+			/*
+			 * reduce pops from, to, the accumulator and the invariants and
+			 * pushes the new accumulator; the loop variable is left at 'to'
+			 * as the scalar loop would leave it
+			 */
+			void reduce(ForNode & node, std::int32_t end)
+			{
+				Reduction const & reduction = *node.reduction();
+				Variable * const var = node.variable();
+
+				load(var, node.start());
+				emit(Opcode::load, end, node.start());
+				load(reduction.accumulator(), node.start());
+				for (std::size_t index = 0; index != reduction.invariants_number(); ++index)
+					load(reduction.invariant_at(index), node.start());
+
+				std::size_t const index = module_.add_reduction(&reduction);
+				emit(Opcode::reduce, static_cast<std::int32_t>(index), node.start());
+				code_.adjust_stack(-2 - static_cast<int>(reduction.invariants_number()));
+				store(reduction.accumulator(), node.start());
+
+				load(var, node.finish());
+				emit(Opcode::load, end, node.finish());
+				emit(Opcode::igt, 0, node.finish());
+				std::size_t const skip = emit(Opcode::jnz, 0, node.finish());
+				emit(Opcode::load, end, node.finish());
+				store(var, node.finish());
+				code_.patch(skip, static_cast<std::int32_t>(code_.size()));
+			}
+
+			std::int32_t native(NativeCallNode & node)
+			{
+				Compiler::NativesType::const_iterator const it = natives_.find(&node);
+				if (it != natives_.end())
+					return static_cast<std::int32_t>(it->second);
+
+				if (!node.is_bound())
+				{
+					error("native " + node.native_name() + " is not linked", node.start());
+					return 0;
+				}
+
+				Module::Native const native = {
+					node.address(), node.trampoline(), node.parameters_number(), node.return_type()
+				};
+				std::size_t const index = module_.add_native(native);
+				natives_[&node] = index;
+				return static_cast<std::int32_t>(index);
+			}
+		};
+
+		typedef std::map<Function const *, std::string> KeysType;
+
+		/* the name of a function, numbered among the functions of the same name */
+		static KeysType function_keys(std::vector<Function *> const & functions)
+		{
+			std::map<std::string, std::size_t> seen;
+			KeysType keys;
+			for (Function const * function : functions)
+				keys[function] = function->name() + "#" + std::to_string(seen[function->name()]++);
+			return keys;
+		}
+
+		/*
+		 * what the code of a function is compiled from, as a string: the
+		 * nodes with their locations relative to the function, variables
+		 * by type and order of first use, globals by name and callees by
+		 * name and signature; inlined callees are part of the nodes, so
+		 * functions of the same shape compile to the same code, moved by
+		 * the distance between the functions
+		 */
+		class Shape : public Visitor
+		{
+		public:
+			using Visitor::visit;
+
+			Shape(Function & function, KeysType const & keys, Scope const * globals, Captures const & captures)
+				: keys_(keys)
+				, globals_(globals)
+				, captured_(captures.captured())
+				, environments_(captures.environments())
+				, start_(function.start().is_reachable() ? function.start().position() : 0)
+			{
+				type(function.return_type());
+
+				Scope const * const root = root_scope(function);
+				for (std::size_t index = 0; index != function.parameters_number(); ++index)
+					variable(root->lookup_variable(function.name_at(index)));
+
+				shape_ += 'e';
+				for (Variable const * var : environments_.at(&function))
+					variable(var);
+
+				function.body()->visit(*this);
+			}
+
+			std::string const & shape() const noexcept
+			{ return shape_; }
+
+			virtual void visit(Block & node)
+			{ children('{', node); }
+
+			virtual void visit(BinaryExprNode & node)
+			{
+				open('b', node);
+				number(node.kind());
+				close(node);
+			}
+
+			virtual void visit(UnaryExprNode & node)
+			{
+				open('u', node);
+				number(node.kind());
+				close(node);
+			}
+
+			virtual void visit(StringLitNode & node)
+			{
+				open('s', node);
+				number(static_cast<std::int64_t>(node.value().size()));
+				shape_ += node.value();
+				shape_ += ')';
+			}
+
+			virtual void visit(IntLitNode & node)
+			{
+				open('i', node);
+				number(node.value());
+				shape_ += ')';
+			}
+
+			virtual void visit(DoubleLitNode & node)
+			{
+				double const value = node.value();
+				open('d', node);
+				shape_.append(reinterpret_cast<char const *>(&value), sizeof(value));
+				shape_ += ')';
+			}
+
+			virtual void visit(LoadNode & node)
+			{
+				open('l', node);
+				variable(node.variable());
+				shape_ += ')';
+			}
+
+			virtual void visit(StoreNode & node)
+			{
+				open('=', node);
+				number(node.kind());
+				variable(node.variable());
+				close(node);
+			}
+
+			virtual void visit(LetNode & node)
+			{
+				open('t', node);
+				variable(node.variable());
+				close(node);
+			}
+
+			virtual void visit(ForNode & node)
+			{
+				open('f', node);
+				variable(node.variable());
+				number(node.is_counted());
+				number(node.writes_variable());
+
+				Reduction const * const reduction = node.reduction();
+				if (reduction)
+				{
+					shape_ += 'v';
+					variable(reduction->accumulator());
+					number(reduction->kind());
+					number(reduction->reassociates());
+					for (std::size_t index = 0; index != reduction->invariants_number(); ++index)
+						variable(reduction->invariant_at(index));
+				}
+				close(node);
+			}
+
+			virtual void visit(WhileNode & node)
+			{ children('w', node); }
+
+			virtual void visit(NativeCallNode & node)
+			{
+				open('n', node);
+				shape_ += node.native_name();
+				shape_ += ' ';
+				number(node.is_bound());
+				type(node.return_type());
+				for (std::size_t index = 0; index != node.parameters_number(); ++index)
+					type(node.at(index));
+				shape_ += ')';
+			}
+
+			virtual void visit(ReturnNode & node)
+			{ children('r', node); }
+
+			virtual void visit(IfNode & node)
+			{
+				open('?', node);
+				number(node.else_block() != nullptr);
+				close(node);
+			}
+
+			virtual void visit(CallNode & node)
+			{
+				Function const * const callee = node.function();
+
+				open('c', node);
+				shape_ += keys_.at(callee);
+				shape_ += ' ';
+				type(callee->return_type());
+				for (std::size_t index = 0; index != callee->parameters_number(); ++index)
+					type(callee->type_at(index));
+				for (Variable const * var : environments_.at(callee))
+					variable(var);
+				close(node);
+			}
+
+			virtual void visit(PrintNode & node)
+			{ children('p', node); }
+
+		private:
+			KeysType const & keys_;
+			Scope const * globals_;
+			VariablesType const & captured_;
+			EnvironmentsType const & environments_;
+			std::int64_t start_;
+			std::map<Variable const *, std::size_t> variables_;
+			std::string shape_;
+
+			void number(std::int64_t value)
+			{
+				shape_ += std::to_string(value);
+				shape_ += ' ';
+			}
+
+			void type(Type type)
+			{ number(static_cast<std::int64_t>(type)); }
+
+			void location(Location const & location)
+			{
+				if (location.is_reachable())
+					number(static_cast<std::int64_t>(location.position()) - start_);
+				else
+					shape_ += "? ";
+			}
+
+			void variable(Variable const * var)
+			{
+				if (var->owner() == globals_)
+				{
+					shape_ += 'g';
+					shape_ += var->name();
+					shape_ += ' ';
+				}
+				else
+				{
+					std::size_t const index = variables_.insert(std::make_pair(var, variables_.size())).first->second;
+					shape_ += captured_.count(var) ? 'c' : 'v';
+					number(static_cast<std::int64_t>(index));
+				}
+				type(var->type());
+			}
+
+			void open(char tag, ASTNode & node)
+			{
+				shape_ += tag;
+				location(node.start());
+				location(node.finish());
+			}
+
+			void close(ASTNode & node)
+			{
+				node.visit_children(*this);
+				shape_ += ')';
+			}
+
+			void children(char tag, ASTNode & node)
+			{
+				open(tag, node);
+				close(node);
+			}
+		};
+
+	}
+
+	Compiler::Compiler()
+		: peephole_(true)
+	{ }
+
+	bool Compiler::peephole() const noexcept
+	{ return peephole_; }
+
+	void Compiler::set_peephole(bool enable) noexcept
+	{ peephole_ = enable; }
+
+	std::unique_ptr<Module> Compiler::compile(Program & program, Status & status)
+	{
+		VM_STATS_PHASE(compile);
+		globals_.clear();
+		functions_.clear();
+		natives_.clear();
+		names_.clear();
+		compiled_.clear();
+
+		std::unique_ptr<Module> module(new Module());
+		module->set_lines(program.lines());
+		allocate_globals(*module, program);
+
+		std::vector<Function *> const functions = program.functions();
+		detail::KeysType const keys = detail::function_keys(functions);
+		detail::ScopesType roots;
+		for (Function * function : functions)
+			roots.insert(detail::root_scope(*function));
+
+		detail::Captures captures(globals_, roots);
+		captures.analyze(functions);
+
+		for (Function * function : functions)
+		{
+			std::unique_ptr<Code> code(new Code(function->name(), function->return_type(),
+						function->parameters_number(), captures.environments().at(function).size()));
+			functions_[function] = module->add_function(std::move(code));
+		}
+		module->set_entry(functions_.at(program.top_level()));
+
+		for (Function * function : functions)
+		{
+			Code & code = module->function(functions_.at(function));
+			detail::FunctionCompiler compiler(*module, code, *function, globals_, functions_, natives_, roots, captures, status);
+			if (!compiler.compile())
+				return nullptr;
+			if (peephole_)
+				vm::peephole(code);
+			code.seal();
+			VM_STATS_COUNT(compile, code_size, code.size() * sizeof(Instruction));
+
+			Compiled const compiled = {
+				functions_.at(function), function->start(),
+				detail::Shape(*function, keys, program.scope(), captures).shape()
+			};
+			compiled_[keys.at(function)] = compiled;
+		}
+
+		return module;
+	}
+
+	Status::Code Compiler::reload(Module & module, Program & program, ReloadedType & reloaded, Status & status)
+	{
+		VM_STATS_PHASE(compile);
+		globals_.clear();
+		functions_.clear();
+		natives_.clear();
+		reloaded.clear();
+
+		allocate_globals(module, program);
+
+		std::vector<Function *> const functions = program.functions();
+		detail::KeysType const keys = detail::function_keys(functions);
+		detail::ScopesType roots;
+		for (Function * function : functions)
+			roots.insert(detail::root_scope(*function));
+
+		detail::Captures captures(globals_, roots);
+		captures.analyze(functions);
+
+		/* a new name takes the next free slot, the first of them is added first */
+		CompiledType compiled;
+		std::vector<Function *> changed;
+		std::size_t next = module.functions_number();
+		for (Function * function : functions)
+		{
+			Compiled entry = {
+				next, function->start(),
+				detail::Shape(*function, keys, program.scope(), captures).shape()
+			};
+
+			CompiledType::const_iterator const it = compiled_.find(keys.at(function));
+			if (it == compiled_.end())
+			{
+				++next;
+				changed.push_back(function);
+			}
+			else
+			{
+				entry.index = it->second.index;
+				if (entry.shape != it->second.shape)
+					changed.push_back(function);
+			}
+
+			functions_[function] = entry.index;
+			compiled[keys.at(function)] = std::move(entry);
+		}
+
+		std::vector<std::unique_ptr<Code> > codes;
+		for (Function * function : changed)
+		{
+			std::unique_ptr<Code> code(new Code(function->name(), function->return_type(),
+						function->parameters_number(), captures.environments().at(function).size()));
+			detail::FunctionCompiler compiler(module, *code, *function, globals_, functions_, natives_, roots, captures, status);
+			if (!compiler.compile())
+				return status.code();
+			if (peephole_)
+				vm::peephole(*code);
+			code->seal();
+			VM_STATS_COUNT(compile, code_size, code->size() * sizeof(Instruction));
+			codes.push_back(std::move(code));
+		}
+
+		/* nothing can fail from here on */
+		module.set_lines(program.lines());
+		for (CompiledType::value_type const & entry : compiled)
+		{
+			CompiledType::const_iterator const it = compiled_.find(entry.first);
+			if (it == compiled_.end() || entry.second.shape != it->second.shape)
+				continue;
+
+			Location const & from = it->second.start;
+			Location const & to = entry.second.start;
+			if (from.is_reachable() && to.is_reachable() && from.position() != to.position())
+				module.function(entry.second.index).relocate(static_cast<std::ptrdiff_t>(to.position()) - from.position());
+		}
+
+		for (std::size_t index = 0; index != changed.size(); ++index)
+		{
+			std::size_t const slot = functions_.at(changed[index]);
+			if (slot < module.functions_number())
+				module.replace_function(slot, std::move(codes[index]));
+			else
+				module.add_function(std::move(codes[index]));
+			reloaded.push_back(slot);
+		}
+
+		module.set_entry(functions_.at(program.top_level()));
+		compiled_.swap(compiled);
+		return status.code();
+	}
+
+	/* globals keep their slots by name, so the kept code still finds them */
+	void Compiler::allocate_globals(Module & module, Program & program)
+	{
+		Scope * const top = program.scope();
+		for (Scope::variable_iterator it = top->variables_begin(); it != top->variables_end(); ++it)
+		{
+			NamesType::const_iterator const name = names_.find(it->first);
+			if (name != names_.end())
+			{
+				globals_[it->second] = name->second;
+				continue;
+			}
+
+			std::size_t const slot = module.allocate_global();
+			names_[it->first] = slot;
+			globals_[it->second] = slot;
+		}
+	}
+
+}
@@ -0,0 +1,111 @@
+#include <string>
+#include <utility>
+
+#include <compiler.hpp>
+#include <engine.hpp>
+#include <native.hpp>
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		/* owns what the code of a module points to, destroyed after the module */
+		struct Compiled
+		{
+			std::shared_ptr<NativeLinker> linker;
+			std::unique_ptr<Program> program;
+			std::unique_ptr<Module> module;
+		};
+
+	}
+
+	Engine::Engine()
+		: linker_(new NativeLinker())
+		, optimize_(false)
+	{ }
+
+	Engine::~Engine()
+	{ }
+
+	Status::Code Engine::load_library(std::string const & path, Status & status)
+	{ return linker_->load_library(path, status); }
+
+	bool Engine::optimize() const noexcept
+	{ return optimize_; }
+
+	void Engine::set_optimize(bool enable) noexcept
+	{ optimize_ = enable; }
+
+	Optimizer & Engine::optimizer() noexcept
+	{ return optimizer_; }
+
+	/* errors are located in code, LineTable(code) resolves them to lines */
+	std::shared_ptr<Module const> Engine::compile(std::string const & code, Status & status)
+	{
+		std::shared_ptr<detail::Compiled> compiled(new detail::Compiled());
+		compiled->linker = linker_;
+
+		compiled->program = Parser().parse(code, status);
+		if (!compiled->program || status.code() == Status::ERROR)
+			return nullptr;
+
+		if (linker_->link(*compiled->program, status) == Status::ERROR)
+			return nullptr;
+
+		if (optimize_)
+			optimizer_.optimize(*compiled->program);
+
+		compiled->module = Compiler().compile(*compiled->program, status);
+		if (!compiled->module)
+			return nullptr;
+
+		return std::shared_ptr<Module const>(compiled, compiled->module.get());
+	}
+
+	Context::Context(std::shared_ptr<Module const> module, std::ostream & out,
+				std::size_t stack_size, std::size_t max_frames)
+		: module_(std::move(module))
+		, interpreter_(out, stack_size, max_frames)
+	{ }
+
+	Module const & Context::module() const noexcept
+	{ return *module_; }
+
+	Status::Code Context::run(Status & status)
+	{ return interpreter_.run(*module_, status); }
+
+	Status::Code Context::call(std::size_t function, std::vector<Value> const & args,
+				Value & result, Status & status)
+	{
+		if (function >= module_->functions_number())
+		{
+			Status(Status::ERROR, "no function " + std::to_string(function)).swap(status);
+			return status.code();
+		}
+
+		Code const & code = module_->function(function);
+		if (args.size() != code.parameters_number())
+		{
+			Status(Status::ERROR, code.name() + " takes " + std::to_string(code.parameters_number())
+						+ " arguments, " + std::to_string(args.size()) + " given").swap(status);
+			return status.code();
+		}
+
+		if (code.captures_number())
+		{
+			Status(Status::ERROR, code.name() + " captures variables of an enclosing function").swap(status);
+			return status.code();
+		}
+
+		return interpreter_.call(*module_, function, args.data(), result, status);
+	}
+
+	void Context::set_output(std::ostream & out) noexcept
+	{ interpreter_.set_output(out); }
+
+	void Context::set_speculator(Speculator * speculator) noexcept
+	{ interpreter_.set_speculator(speculator); }
+
+}
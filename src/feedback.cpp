@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include <feedback.hpp>
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		struct Range
+		{
+			std::uint32_t begin;
+			std::uint32_t end;
+		};
+
+		/* the top level code has no location, it spans the whole source */
+		static Range range(Function const & function, std::string const & source) noexcept
+		{
+			std::uint32_t const size = static_cast<std::uint32_t>(source.size());
+			Range const range = {
+				function.start().is_reachable() ? std::min(function.start().position(), size) : 0,
+				function.finish().is_reachable() ? std::min(function.finish().position(), size) : size
+			};
+			return range;
+		}
+
+		/*
+		 * the IfNode, WhileNode and CallNode of a function by position;
+		 * the ones the optimizer inlined from other functions sit in the
+		 * source of those functions and are left out
+		 */
+		class Sites : public Visitor
+		{
+		public:
+			enum Kind
+			{
+				if_node,
+				while_node,
+				call_node
+			};
+
+			struct Site
+			{
+				Kind kind;
+				ASTNode * node;
+			};
+
+			typedef std::map<std::uint32_t, Site> SitesType;
+
+			Sites(std::vector<Range> const & ranges, std::size_t owner)
+				: ranges_(ranges)
+				, owner_(owner)
+			{ }
+
+			SitesType const & sites() const noexcept
+			{ return sites_; }
+
+			virtual void visit(IfNode & node)
+			{
+				add(if_node, node);
+				node.visit_children(*this);
+			}
+
+			virtual void visit(WhileNode & node)
+			{
+				add(while_node, node);
+				node.visit_children(*this);
+			}
+
+			virtual void visit(CallNode & node)
+			{
+				add(call_node, node);
+				node.visit_children(*this);
+			}
+
+		private:
+			void add(Kind kind, ASTNode & node)
+			{
+				if (!node.start().is_reachable() || !owns(node.start().position()))
+					return;
+				Site const site = { kind, &node };
+				sites_.insert(std::make_pair(node.start().position(), site));
+			}
+
+			/* the innermost function around position is the owner */
+			bool owns(std::uint32_t position) const noexcept
+			{
+				std::size_t innermost = ranges_.size();
+				for (std::size_t index = 0; index != ranges_.size(); ++index)
+				{
+					Range const & range = ranges_[index];
+					if (position < range.begin || position >= range.end)
+						continue;
+					if (innermost == ranges_.size()
+							|| range.end - range.begin < ranges_[innermost].end - ranges_[innermost].begin)
+						innermost = index;
+				}
+				return innermost == owner_;
+			}
+
+			std::vector<Range> const & ranges_;
+			std::size_t owner_;
+			SitesType sites_;
+		};
+
+		/* whether the jump of a site is taken when its condition holds */
+		static bool taken_holds(Sites::Site const & site) noexcept
+		{ return site.kind == Sites::if_node && static_cast<IfNode const *>(site.node)->else_first(); }
+
+		/*
+		 * calls visit(function, code, sites, begin) for every function
+		 * of program with its code in module; the compiler adds the code
+		 * of the functions in the order of the program
+		 */
+		template <typename Visit>
+		static void match(Program & program, std::string const & source, Module const & module, Visit visit)
+		{
+			std::vector<Function *> const functions = program.functions();
+			std::vector<Range> ranges;
+			for (Function const * function : functions)
+				ranges.push_back(range(*function, source));
+
+			for (std::size_t index = 0; index != functions.size() && index != module.functions_number(); ++index)
+			{
+				Function & function = *functions[index];
+				Code const & code = module.function(index);
+				if (code.name() != function.name())
+					continue;
+
+				Sites sites(ranges, index);
+				function.body()->visit(sites);
+				visit(function, code, sites.sites(), ranges[index].begin);
+			}
+		}
+
+	}
+
+	std::uint64_t Feedback::hash(std::string const & source, Function const & function) noexcept
+	{
+		detail::Range const range = detail::range(function, source);
+
+		/* FNV-1a */
+		std::uint64_t hash = 14695981039346656037ull;
+		for (std::uint32_t position = range.begin; position < range.end; ++position)
+		{
+			hash ^= static_cast<unsigned char>(source[position]);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	void Feedback::record(Program & program, std::string const & source, Module const & module)
+	{
+		typedef detail::Sites::SitesType SitesType;
+		detail::match(program, source, module, [&](Function & function, Code const & code,
+					SitesType const & sites, std::uint32_t begin) {
+			if (!code.calls().value())
+				return;
+
+			Entry & entry = entries_[KeyType(function.name(), hash(source, function))];
+			entry.calls += code.calls().value();
+
+			/* speculative code made calls too, its guards are not the branches of the source */
+			Code const * const versions[] = { &code, code.speculative() };
+			for (Code const * version : versions)
+				for (std::size_t index = 0; version && index != version->size(); ++index)
+				{
+					Location const location = version->location_at(index);
+					SitesType::const_iterator const it = location.is_reachable() ? sites.find(location.position()) : sites.end();
+					if (it == sites.end())
+						continue;
+
+					std::uint32_t const offset = it->first - begin;
+					Opcode::Kind const opcode = version->instructions()[index].opcode;
+					if (it->second.kind == detail::Sites::call_node)
+					{
+						if (opcode == Opcode::call)
+							entry.sites[offset] += version->taken(index).value();
+					}
+					else if (version == &code && Opcode::is_conditional(opcode))
+					{
+						bool const holds = detail::taken_holds(it->second);
+						Branch & branch = entry.branches[offset];
+						branch.held += (holds ? code.taken(index) : code.fallen(index)).value();
+						branch.failed += (holds ? code.fallen(index) : code.taken(index)).value();
+					}
+				}
+		});
+	}
+
+	std::size_t Feedback::apply(Program & program, std::string const & source) const
+	{
+		std::vector<Function *> const functions = program.functions();
+		std::vector<detail::Range> ranges;
+		for (Function const * function : functions)
+			ranges.push_back(detail::range(*function, source));
+
+		std::size_t found = 0;
+		for (std::size_t index = 0; index != functions.size(); ++index)
+		{
+			Function & function = *functions[index];
+			EntriesType::const_iterator const it = entries_.find(KeyType(function.name(), hash(source, function)));
+			if (it == entries_.end())
+				continue;
+
+			++found;
+			Entry const & entry = it->second;
+			function.count_call(entry.calls);
+
+			detail::Sites sites(ranges, index);
+			function.body()->visit(sites);
+			for (detail::Sites::SitesType::value_type const & site : sites.sites())
+			{
+				std::uint32_t const offset = site.first - ranges[index].begin;
+				if (site.second.kind == detail::Sites::call_node)
+				{
+					std::map<std::uint32_t, std::uint64_t>::const_iterator const calls = entry.sites.find(offset);
+					if (calls != entry.sites.end())
+						static_cast<CallNode *>(site.second.node)->count_call(calls->second);
+					continue;
+				}
+
+				std::map<std::uint32_t, Branch>::const_iterator const branch = entry.branches.find(offset);
+				if (branch == entry.branches.end())
+					continue;
+				if (site.second.kind == detail::Sites::if_node)
+					static_cast<IfNode *>(site.second.node)->count_branches(branch->second.held, branch->second.failed);
+				else
+					static_cast<WhileNode *>(site.second.node)->count_branches(branch->second.held, branch->second.failed);
+			}
+		}
+		return found;
+	}
+
+	void Feedback::seed(Program & program, std::string const & source, Module const & module) const
+	{
+		typedef detail::Sites::SitesType SitesType;
+		detail::match(program, source, module, [&](Function & function, Code const & code,
+					SitesType const & sites, std::uint32_t begin) {
+			EntriesType::const_iterator const it = entries_.find(KeyType(function.name(), hash(source, function)));
+			if (it == entries_.end())
+				return;
+
+			Entry const & entry = it->second;
+			code.calls().add(entry.calls);
+			for (std::size_t index = 0; index != code.size(); ++index)
+			{
+				Location const location = code.location_at(index);
+				SitesType::const_iterator const site = location.is_reachable() ? sites.find(location.position()) : sites.end();
+				if (site == sites.end())
+					continue;
+
+				std::uint32_t const offset = site->first - begin;
+				Opcode::Kind const opcode = code.instructions()[index].opcode;
+				if (site->second.kind == detail::Sites::call_node)
+				{
+					std::map<std::uint32_t, std::uint64_t>::const_iterator const calls = entry.sites.find(offset);
+					if (opcode == Opcode::call && calls != entry.sites.end())
+						code.taken(index).add(calls->second);
+					continue;
+				}
+
+				std::map<std::uint32_t, Branch>::const_iterator const branch = entry.branches.find(offset);
+				if (!Opcode::is_conditional(opcode) || branch == entry.branches.end())
+					continue;
+
+				bool const holds = detail::taken_holds(site->second);
+				code.taken(index).add(holds ? branch->second.held : branch->second.failed);
+				code.fallen(index).add(holds ? branch->second.failed : branch->second.held);
+			}
+		});
+	}
+
+	bool Feedback::read(std::istream & in)
+	{
+		EntriesType entries;
+		Entry * entry = nullptr;
+
+		std::string line;
+		if (!std::getline(in, line) || line != "feedback 1")
+			return false;
+
+		while (std::getline(in, line))
+		{
+			std::istringstream fields(line);
+			std::string kind;
+			fields >> kind;
+
+			if (kind == "function")
+			{
+				std::string name;
+				std::uint64_t hash, calls;
+				if (!(fields >> name >> std::hex >> hash >> std::dec >> calls))
+					return false;
+				entry = &entries[KeyType(name, hash)];
+				entry->calls += calls;
+			}
+			else if (kind == "branch" && entry)
+			{
+				std::uint32_t offset;
+				Branch branch;
+				if (!(fields >> offset >> branch.held >> branch.failed))
+					return false;
+				Branch & counts = entry->branches[offset];
+				counts.held += branch.held;
+				counts.failed += branch.failed;
+			}
+			else if (kind == "call" && entry)
+			{
+				std::uint32_t offset;
+				std::uint64_t calls;
+				if (!(fields >> offset >> calls))
+					return false;
+				entry->sites[offset] += calls;
+			}
+			else if (!kind.empty())
+				return false;
+		}
+
+		entries_.swap(entries);
+		return true;
+	}
+
+	void Feedback::write(std::ostream & out) const
+	{
+		out << "feedback 1" << std::endl;
+		for (EntriesType::value_type const & entry : entries_)
+		{
+			out << "function " << entry.first.first
+				<< " " << std::hex << entry.first.second << std::dec
+				<< " " << entry.second.calls << std::endl;
+			for (std::map<std::uint32_t, Branch>::value_type const & branch : entry.second.branches)
+				out << "branch " << branch.first << " " << branch.second.held << " " << branch.second.failed << std::endl;
+			for (std::map<std::uint32_t, std::uint64_t>::value_type const & site : entry.second.sites)
+				out << "call " << site.first << " " << site.second << std::endl;
+		}
+	}
+
+	Feedback::EntriesType const & Feedback::entries() const noexcept
+	{ return entries_; }
+
+}
@@ -0,0 +1,317 @@
+#include <generator.hpp>
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		static char const * const binary_ops[] = {
+			" + ", " - ", " * ", " / ", " % ", " < ", " > ", " == ", " != ", " && ", " || "
+		};
+		static std::size_t const binary_ops_number = sizeof(binary_ops) / sizeof(binary_ops[0]);
+
+		static char const * const words[] = {
+			"the", "scanner", "skips", "comments", "until", "end", "of", "line",
+			"and", "never", "produces", "tokens", "for", "them", "so", "this"
+		};
+		static std::size_t const words_number = sizeof(words) / sizeof(words[0]);
+
+		static char const string_chars[] =
+			"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .,:;-+*/=<>()[]{}";
+
+	}
+
+	ProgramGenerator::ProgramGenerator() noexcept
+		: seed_(1)
+		, functions_(16)
+		, statements_(16)
+		, expression_depth_(2)
+		, expression_width_(3)
+		, string_length_(0)
+		, comment_lines_(0)
+		, function_(0)
+		, locals_(0)
+		, strings_(0)
+		, indent_(0)
+		, loops_(0)
+	{ }
+
+	std::uint32_t ProgramGenerator::seed() const noexcept
+	{ return seed_; }
+
+	void ProgramGenerator::set_seed(std::uint32_t seed) noexcept
+	{ seed_ = seed; }
+
+	std::size_t ProgramGenerator::functions() const noexcept
+	{ return functions_; }
+
+	void ProgramGenerator::set_functions(std::size_t count) noexcept
+	{ functions_ = count; }
+
+	std::size_t ProgramGenerator::statements() const noexcept
+	{ return statements_; }
+
+	void ProgramGenerator::set_statements(std::size_t count) noexcept
+	{ statements_ = count; }
+
+	std::size_t ProgramGenerator::expression_depth() const noexcept
+	{ return expression_depth_; }
+
+	void ProgramGenerator::set_expression_depth(std::size_t depth) noexcept
+	{ expression_depth_ = depth; }
+
+	std::size_t ProgramGenerator::expression_width() const noexcept
+	{ return expression_width_; }
+
+	void ProgramGenerator::set_expression_width(std::size_t width) noexcept
+	{ expression_width_ = width ? width : 1; }
+
+	std::size_t ProgramGenerator::string_length() const noexcept
+	{ return string_length_; }
+
+	void ProgramGenerator::set_string_length(std::size_t length) noexcept
+	{ string_length_ = length; }
+
+	std::size_t ProgramGenerator::comment_lines() const noexcept
+	{ return comment_lines_; }
+
+	void ProgramGenerator::set_comment_lines(std::size_t lines) noexcept
+	{ comment_lines_ = lines; }
+
+	std::string ProgramGenerator::generate()
+	{
+		random_.seed(seed_);
+		out_.clear();
+		indent_ = 0;
+
+		for (std::size_t index = 0; index != functions_; ++index)
+			generate_function(index);
+
+		std::string program;
+		program.swap(out_);
+		return program;
+	}
+
+	/* modulo keeps the output the same across standard libraries */
+	std::size_t ProgramGenerator::pick(std::size_t bound) noexcept
+	{ return bound ? static_cast<std::size_t>(random_() % bound) : 0; }
+
+	void ProgramGenerator::indent()
+	{ out_.append(indent_, '\t'); }
+
+	void ProgramGenerator::line(std::string const & text)
+	{
+		indent();
+		out_ += text;
+		out_ += '\n';
+	}
+
+	void ProgramGenerator::comments()
+	{
+		for (std::size_t count = 0; count != comment_lines_; ++count)
+		{
+			indent();
+			out_ += "//";
+			for (std::size_t word = 0, words = 4 + pick(8); word != words; ++word)
+			{
+				out_ += ' ';
+				out_ += detail::words[pick(detail::words_number)];
+			}
+			out_ += '\n';
+		}
+	}
+
+	void ProgramGenerator::generate_function(std::size_t index)
+	{
+		function_ = index;
+		locals_ = 0;
+		strings_ = 0;
+		loops_ = 0;
+
+		comments();
+		line("function int f" + std::to_string(index) + "(int a, int b)");
+		line("{");
+		++indent_;
+
+		for (std::size_t count = 0; count != statements_; ++count)
+			generate_statement(0);
+
+		comments();
+		indent();
+		out_ += "return ";
+		generate_expression(expression_depth_);
+		out_ += ";\n";
+
+		--indent_;
+		line("}");
+		line("");
+	}
+
+	void ProgramGenerator::generate_block(std::size_t level)
+	{
+		line("{");
+		++indent_;
+
+		for (std::size_t count = 0, statements = 1 + pick(2); count != statements; ++count)
+			generate_statement(level);
+
+		--indent_;
+		line("}");
+	}
+
+	void ProgramGenerator::generate_statement(std::size_t level)
+	{
+		comments();
+
+		/* locals are declared at the function level only, so every later statement sees them */
+		std::size_t const kinds = level ? 5 : 7;
+		std::size_t kind = pick(kinds);
+		if (!locals_ && kind < 5)
+			kind = level ? 4 : 5;
+
+		indent();
+		switch (kind)
+		{
+		case 0:
+			out_ += "v" + std::to_string(pick(locals_)) + " = ";
+			generate_expression(expression_depth_);
+			out_ += ";\n";
+			break;
+		case 1:
+			out_ += "v" + std::to_string(pick(locals_)) + (pick(2) ? " += " : " -= ");
+			generate_expression(expression_depth_);
+			out_ += ";\n";
+			break;
+		case 2:
+			if (level > 2)
+			{
+				out_ += "v" + std::to_string(pick(locals_)) + " += 1;\n";
+				break;
+			}
+			out_ += "if (";
+			generate_expression(expression_depth_);
+			out_ += ")\n";
+			generate_block(level + 1);
+			if (pick(2))
+			{
+				line("else");
+				generate_block(level + 1);
+			}
+			break;
+		case 3:
+			if (level > 2)
+			{
+				out_ += "v" + std::to_string(pick(locals_)) + " -= 1;\n";
+				break;
+			}
+			out_ += "for (int i" + std::to_string(loops_) + " in 0..";
+			generate_operand(false);
+			out_ += ")\n";
+			++loops_;
+			generate_block(level + 1);
+			--loops_;
+			break;
+		case 4:
+			if (function_)
+			{
+				out_ += "f" + std::to_string(pick(function_)) + "(";
+				generate_expression(0, false);
+				out_ += ", ";
+				generate_expression(0, false);
+				out_ += ");\n";
+				break;
+			}
+			out_ += "a = ";
+			generate_expression(expression_depth_);
+			out_ += ";\n";
+			break;
+		case 5:
+			out_ += "int v" + std::to_string(locals_) + " = ";
+			generate_expression(expression_depth_);
+			out_ += ";\n";
+			++locals_;
+			break;
+		case 6:
+			if (!string_length_)
+			{
+				out_ += "b = ";
+				generate_expression(expression_depth_);
+				out_ += ";\n";
+				break;
+			}
+			out_ += "string s" + std::to_string(strings_++) + " = ";
+			generate_string();
+			out_ += ";\n";
+			break;
+		}
+	}
+
+	/*
+	 * a chain of up to expression_width operands; exactly one of them is
+	 * a parenthesized subexpression while depth allows, so the nesting
+	 * reaches depth without the size growing exponentially; for the same
+	 * reason call arguments never contain calls
+	 */
+	void ProgramGenerator::generate_expression(std::size_t depth, bool calls)
+	{
+		std::size_t const operands = 1 + pick(expression_width_);
+		std::size_t const nested = depth ? pick(operands) : operands;
+
+		for (std::size_t index = 0; index != operands; ++index)
+		{
+			if (index)
+				out_ += detail::binary_ops[pick(detail::binary_ops_number)];
+
+			if (index != nested)
+			{
+				generate_operand(calls);
+				continue;
+			}
+
+			out_ += '(';
+			generate_expression(depth - 1, calls);
+			out_ += ')';
+		}
+	}
+
+	void ProgramGenerator::generate_operand(bool calls)
+	{
+		std::size_t const kind = pick((calls && function_) ? 5 : 4);
+		if (kind == 0)
+		{
+			out_ += std::to_string(pick(1000));
+			return;
+		}
+
+		if (kind == 4)
+		{
+			out_ += "f" + std::to_string(pick(function_)) + "(";
+			generate_expression(0, false);
+			out_ += ", ";
+			generate_expression(0, false);
+			out_ += ")";
+			return;
+		}
+
+		if (kind == 1)
+			out_ += '-';
+
+		std::size_t const var = pick(2 + locals_ + loops_);
+		if (var < 2)
+			out_ += var ? "b" : "a";
+		else if (var < 2 + locals_)
+			out_ += "v" + std::to_string(var - 2);
+		else
+			out_ += "i" + std::to_string(var - 2 - locals_);
+	}
+
+	void ProgramGenerator::generate_string()
+	{
+		out_ += '\'';
+		for (std::size_t count = 0; count != string_length_; ++count)
+			out_ += detail::string_chars[pick(sizeof(detail::string_chars) - 1)];
+		out_ += '\'';
+	}
+
+}
@@ -0,0 +1,605 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <interpreter.hpp>
+#include <profiler.hpp>
+#include <speculator.hpp>
+#include <stats.hpp>
+#include <vectorizer.hpp>
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		typedef std::uint64_t U;
+
+		/* int arithmetic wraps around instead of being undefined */
+		static std::int64_t wrap(U value) noexcept
+		{ return static_cast<std::int64_t>(value); }
+
+		/* out of range doubles saturate and NaN becomes zero */
+		static std::int64_t to_int(double value) noexcept
+		{
+			if (std::isnan(value))
+				return 0;
+			if (value >= 9223372036854775807.0)
+				return std::numeric_limits<std::int64_t>::max();
+			if (value < -9223372036854775808.0)
+				return std::numeric_limits<std::int64_t>::min();
+			return static_cast<std::int64_t>(value);
+		}
+
+	}
+
+	Interpreter::Interpreter(std::ostream & out, std::size_t stack_size, std::size_t max_frames)
+		: out_(&out)
+		, profiler_(nullptr)
+		, pairs_(nullptr)
+		, speculator_(nullptr)
+		, feedback_(false)
+		, string_bytes_(0)
+		, collect_bytes_(min_collect_bytes)
+	{
+		/* a failed reserve leaves the stack empty, execute reports it */
+		if (stack_.reserve(stack_size * sizeof(Value)))
+			frames_.reserve(max_frames * sizeof(Frame));
+	}
+
+	void Interpreter::set_profiler(Profiler * profiler) noexcept
+	{ profiler_ = profiler; }
+
+	void Interpreter::set_pair_counter(PairCounter * pairs) noexcept
+	{ pairs_ = pairs; }
+
+	void Interpreter::set_speculator(Speculator * speculator) noexcept
+	{ speculator_ = speculator; }
+
+	void Interpreter::set_feedback(bool record) noexcept
+	{ feedback_ = record; }
+
+	void Interpreter::set_output(std::ostream & out) noexcept
+	{ out_ = &out; }
+
+	Status::Code Interpreter::run(Module const & module, Status & status)
+	{
+		VM_STATS_PHASE(run);
+		globals_.assign(module.globals_number(), Value());
+		strings_.clear();
+		string_bytes_ = 0;
+		collect_bytes_ = min_collect_bytes;
+		return start(module, module.entry(), nullptr, nullptr, status);
+	}
+
+	Status::Code Interpreter::call(Module const & module, std::size_t function,
+				Value const * args, Value & result, Status & status)
+	{
+		VM_STATS_PHASE(run);
+		if (globals_.size() != module.globals_number())
+			globals_.assign(module.globals_number(), Value());
+		/* what the last call left behind is dropped, only globals and args still reach a string */
+		if (!strings_.empty())
+			collect(stack_.begin<Value>(), args, args + module.function(function).parameters_number());
+		return start(module, function, args, &result, status);
+	}
+
+	Status::Code Interpreter::start(Module const & module, std::size_t function,
+				Value const * args, Value * result, Status & status)
+	{
+		bool const recording = speculator_ || feedback_;
+		if (!profiler_ && !pairs_ && !recording)
+			return execute<false, false>(module, function, args, result, status);
+
+		if (recording)
+		{
+			if (counts_.size() < 2 * module.functions_number())
+				counts_.resize(2 * module.functions_number());
+			if (profiler_ || pairs_)
+				execute<true, true>(module, function, args, result, status);
+			else
+				execute<false, true>(module, function, args, result, status);
+		}
+		else
+			execute<true, false>(module, function, args, result, status);
+		flush();
+		return status.code();
+	}
+
+	/* callers are sampled at their call instruction, the callee at the next one to run */
+	void Interpreter::sample(Frame const * top, Code const * code, Instruction const * pc)
+	{
+		Frame const * const bottom = frames_.begin<Frame>();
+
+		Profiler::StackType stack;
+		stack.reserve(top - bottom + 1);
+		for (Frame const * frame = bottom; frame != top; ++frame)
+		{
+			Profiler::Site const site = { frame->code, static_cast<std::size_t>(frame->pc - 1 - frame->code->instructions()) };
+			stack.push_back(site);
+		}
+
+		Profiler::Site const site = { code, static_cast<std::size_t>(pc - code->instructions()) };
+		stack.push_back(site);
+		profiler_->sample(stack);
+	}
+
+	Code const * Interpreter::enter(Code const & baseline, Counts * & counts)
+	{
+		Counts & called = count(baseline);
+		++called.calls;
+		refresh(baseline, called);
+		counts = called.runs_counts;
+		return called.runs;
+	}
+
+	void Interpreter::refresh(Code const & baseline, Counts & called)
+	{
+		if (called.calls >= flush_calls)
+			flush(baseline, called);
+
+		Code const * const code = speculator_ ? speculator_->enter(baseline) : &baseline;
+		called.runs = code;
+		called.runs_counts = code == &baseline ? &called : &count(*code);
+	}
+
+	Interpreter::Counts & Interpreter::count(Code const & code)
+	{
+		Counts & counts = counts_[2 * code.slot() + (code.baseline() ? 1 : 0)];
+		if (counts.code != &code)
+		{
+			/* a reload put other code in the slot, frames that called the old one still run it */
+			if (counts.code)
+				flush(*counts.code, counts);
+			counts.code = &code;
+			counts.branches.assign(2 * code.size(), 0);
+			counts.runs = nullptr;
+		}
+		return counts;
+	}
+
+	void Interpreter::flush(Code const & code, Counts & counts) noexcept
+	{
+		if (counts.calls)
+			code.calls().add(counts.calls);
+		counts.calls = 0;
+
+		for (std::size_t index = 0; index != code.size(); ++index)
+		{
+			std::uint64_t & taken = counts.branches[2 * index];
+			std::uint64_t & fallen = counts.branches[2 * index + 1];
+			if (taken)
+				code.taken(index).add(taken);
+			if (fallen)
+				code.fallen(index).add(fallen);
+			taken = fallen = 0;
+		}
+	}
+
+	/* a reload may free the code counted, so nothing is kept between runs */
+	void Interpreter::flush() noexcept
+	{
+		for (Counts & counts : counts_)
+			if (counts.code)
+			{
+				flush(*counts.code, counts);
+				counts.code = nullptr;
+			}
+	}
+
+	char const * Interpreter::make_string(std::string value, Value const * top)
+	{
+		if (string_bytes_ + value.size() + 1 > collect_bytes_)
+			collect(top);
+
+		std::unique_ptr<std::string> string(new std::string(std::move(value)));
+		char const * const chars = string->c_str();
+		string_bytes_ += string->size() + 1;
+		strings_.insert(std::make_pair(chars, std::move(string)));
+		return chars;
+	}
+
+	void Interpreter::collect(Value const * top, Value const * begin, Value const * end)
+	{
+		StringsType reached;
+		std::size_t bytes = 0;
+		auto const mark = [&](Value const & value) {
+			StringsType::iterator const it = strings_.find(value.as_string);
+			if (it == strings_.end())
+				return;
+			bytes += it->second->size() + 1;
+			reached.insert(std::move(*it));
+			strings_.erase(it);
+		};
+
+		for (Value const & value : globals_)
+			mark(value);
+		for (Value const * value = stack_.begin<Value>(); value != top; ++value)
+			mark(*value);
+		for (Value const * value = begin; value != end; ++value)
+			mark(*value);
+
+		strings_.swap(reached);
+		string_bytes_ = bytes;
+		collect_bytes_ = 2 * bytes > min_collect_bytes ? 2 * bytes : min_collect_bytes;
+	}
+
+	/*
+	 * Profiling polls for ticks and counts pairs, Recording counts calls
+	 * and branches and runs speculative code; with neither the loop has
+	 * no overhead, with Recording alone it checks no profiler or counter
+	 */
+	template <bool Profiling, bool Recording>
+	Status::Code Interpreter::execute(Module const & module, std::size_t function,
+				Value const * args, Value * result, Status & status)
+	{
+		Status().swap(status);
+		if (!frames_.address())
+		{
+			Status(Status::ERROR, "cannot reserve the stack").swap(status);
+			return status.code();
+		}
+
+		Value * const globals = globals_.data();
+		Value * const limit = stack_.end<Value>();
+		Frame * const bottom = frames_.begin<Frame>();
+		Frame * const top = frames_.end<Frame>();
+		Frame * fp = bottom;
+
+		Code const * code = &module.function(function);
+		Counts * const slots = Recording ? counts_.data() : nullptr;
+		Counts * counts = nullptr;
+		if (Recording)
+		{
+			frame_counts_.resize(top - bottom);
+			code = enter(*code, counts);
+		}
+		Counts ** const frame_counts = Recording ? frame_counts_.data() : nullptr;
+		if (code->locals_number() + code->max_stack() > static_cast<std::size_t>(limit - stack_.begin<Value>()))
+		{
+			Status(Status::ERROR, "stack overflow").swap(status);
+			return status.code();
+		}
+
+		Value * locals = stack_.begin<Value>();
+		std::copy(args, args + code->parameters_number(), locals);
+
+		Value * sp = locals + code->locals_number();
+		Instruction const * pc = code->instructions();
+		Opcode::Kind previous = Opcode::opcode_count;
+
+		#define RUNTIME_ERROR(message)																\
+			do																				\
+			{																				\
+				Status(Status::ERROR, message, code->location_at(pc - 1 - code->instructions())).swap(status);	\
+				return status.code();														\
+			}																				\
+			while (0)
+
+		#define INT_BINARY(expr)															\
+			{																				\
+				--sp;																		\
+				std::int64_t const left = sp[-1].as_int, right = sp[0].as_int;				\
+				sp[-1].as_int = (expr);														\
+				break;																		\
+			}
+
+		#define DOUBLE_BINARY(expr)															\
+			{																				\
+				--sp;																		\
+				double const left = sp[-1].as_double, right = sp[0].as_double;				\
+				sp[-1].as_double = (expr);													\
+				break;																		\
+			}
+
+		#define DOUBLE_COMPARE(expr)														\
+			{																				\
+				--sp;																		\
+				double const left = sp[-1].as_double, right = sp[0].as_double;				\
+				sp[-1].as_int = (expr);														\
+				break;																		\
+			}
+
+		#define MIXED_BINARY(expr)															\
+			{																				\
+				--sp;																		\
+				double const left = sp[-1].as_double;										\
+				double const right = static_cast<double>(sp[0].as_int);					\
+				sp[-1].as_double = (expr);													\
+				break;																		\
+			}
+
+		#define BRANCH(expr)																\
+			{																				\
+				bool const jumps = (expr);													\
+				if (Recording)																	\
+				{																			\
+					std::size_t const index = pc - 1 - code->instructions();				\
+					++counts->branches[2 * index + (jumps ? 0 : 1)];						\
+				}																			\
+				if (jumps)																	\
+					pc = code->instructions() + insn.arg;									\
+				break;																		\
+			}
+
+		#define INT_JUMP(expr)																\
+			{																				\
+				sp -= 2;																	\
+				std::int64_t const left = sp[0].as_int, right = sp[1].as_int;				\
+				BRANCH(expr)																\
+			}
+
+		for (;;)
+		{
+			if (Profiling && profiler_ && profiler_->pending())
+				sample(fp, code, pc);
+
+			Instruction const insn = *pc++;
+			if (Profiling && pairs_)
+			{
+				if (previous != Opcode::opcode_count)
+					pairs_->count(previous, insn.opcode);
+				previous = insn.opcode;
+			}
+
+			switch (insn.opcode)
+			{
+			case Opcode::opcode_count:
+			case Opcode::nop:
+				break;
+
+			case Opcode::ipush:
+				(sp++)->as_int = insn.arg;
+				break;
+			case Opcode::iconst:
+			case Opcode::dconst:
+			case Opcode::sconst:
+				*sp++ = code->constant(insn.arg);
+				break;
+
+			case Opcode::load:
+				*sp++ = locals[insn.arg];
+				break;
+			case Opcode::store:
+				locals[insn.arg] = *--sp;
+				break;
+			case Opcode::gload:
+				*sp++ = globals[insn.arg];
+				break;
+			case Opcode::gstore:
+				globals[insn.arg] = *--sp;
+				break;
+			case Opcode::ref:
+				(sp++)->as_ref = locals + insn.arg;
+				break;
+			case Opcode::rload:
+				*sp++ = *locals[insn.arg].as_ref;
+				break;
+			case Opcode::rstore:
+				*locals[insn.arg].as_ref = *--sp;
+				break;
+			case Opcode::load2:
+				sp[0] = locals[insn.low()];
+				sp[1] = locals[insn.high()];
+				sp += 2;
+				break;
+			case Opcode::loadi:
+				sp[0] = locals[insn.low()];
+				sp[1].as_int = insn.high();
+				sp += 2;
+				break;
+			case Opcode::iinc:
+				locals[insn.arg].as_int = detail::wrap(detail::U(locals[insn.arg].as_int) + 1);
+				break;
+			case Opcode::pop:
+				--sp;
+				break;
+
+			case Opcode::i2d:
+				sp[-1].as_double = static_cast<double>(sp[-1].as_int);
+				break;
+			case Opcode::d2i:
+				sp[-1].as_int = detail::to_int(sp[-1].as_double);
+				break;
+
+			case Opcode::iadd: INT_BINARY(detail::wrap(detail::U(left) + detail::U(right)))
+			case Opcode::isub: INT_BINARY(detail::wrap(detail::U(left) - detail::U(right)))
+			case Opcode::imul: INT_BINARY(detail::wrap(detail::U(left) * detail::U(right)))
+			case Opcode::idiv:
+				if (!sp[-1].as_int)
+					RUNTIME_ERROR("division by zero");
+				INT_BINARY((right == -1) ? detail::wrap(0 - detail::U(left)) : left / right)
+			case Opcode::imod:
+				if (!sp[-1].as_int)
+					RUNTIME_ERROR("division by zero");
+				INT_BINARY((right == -1) ? 0 : left % right)
+			case Opcode::iaddi:
+				sp[-1].as_int = detail::wrap(detail::U(sp[-1].as_int) + detail::U(std::int64_t(insn.arg)));
+				break;
+			case Opcode::iand: INT_BINARY(left & right)
+			case Opcode::ior: INT_BINARY(left | right)
+			case Opcode::ixor: INT_BINARY(left ^ right)
+			case Opcode::ieq: INT_BINARY(left == right)
+			case Opcode::ine: INT_BINARY(left != right)
+			case Opcode::ilt: INT_BINARY(left < right)
+			case Opcode::ile: INT_BINARY(left <= right)
+			case Opcode::igt: INT_BINARY(left > right)
+			case Opcode::ige: INT_BINARY(left >= right)
+
+			case Opcode::ineg:
+				sp[-1].as_int = detail::wrap(0 - detail::U(sp[-1].as_int));
+				break;
+			case Opcode::inot:
+				sp[-1].as_int = ~sp[-1].as_int;
+				break;
+			case Opcode::lnot:
+				sp[-1].as_int = !sp[-1].as_int;
+				break;
+
+			case Opcode::dadd: DOUBLE_BINARY(left + right)
+			case Opcode::dsub: DOUBLE_BINARY(left - right)
+			case Opcode::dmul: DOUBLE_BINARY(left * right)
+			case Opcode::ddiv: DOUBLE_BINARY(left / right)
+			case Opcode::deq: DOUBLE_COMPARE(left == right)
+			case Opcode::dne: DOUBLE_COMPARE(left != right)
+			case Opcode::dlt: DOUBLE_COMPARE(left < right)
+			case Opcode::dle: DOUBLE_COMPARE(left <= right)
+			case Opcode::dgt: DOUBLE_COMPARE(left > right)
+			case Opcode::dge: DOUBLE_COMPARE(left >= right)
+
+			case Opcode::diadd: MIXED_BINARY(left + right)
+			case Opcode::disub: MIXED_BINARY(left - right)
+			case Opcode::dimul: MIXED_BINARY(left * right)
+			case Opcode::didiv: MIXED_BINARY(left / right)
+
+			case Opcode::dneg:
+				sp[-1].as_double = -sp[-1].as_double;
+				break;
+
+			/* both operands are still on the stack while a collection runs */
+			case Opcode::sadd:
+				--sp;
+				sp[-1].as_string = make_string(std::string(sp[-1].as_string) + sp[0].as_string, sp + 1);
+				break;
+			case Opcode::seq:
+				--sp;
+				sp[-1].as_int = std::strcmp(sp[-1].as_string, sp[0].as_string) == 0;
+				break;
+			case Opcode::sne:
+				--sp;
+				sp[-1].as_int = std::strcmp(sp[-1].as_string, sp[0].as_string) != 0;
+				break;
+
+			case Opcode::jmp:
+				pc = code->instructions() + insn.arg;
+				break;
+			case Opcode::jz: BRANCH(!(--sp)->as_int)
+			case Opcode::jnz: BRANCH((--sp)->as_int)
+			case Opcode::jieq: INT_JUMP(left == right)
+			case Opcode::jine: INT_JUMP(left != right)
+			case Opcode::jilt: INT_JUMP(left < right)
+			case Opcode::jile: INT_JUMP(left <= right)
+			case Opcode::jigt: INT_JUMP(left > right)
+			case Opcode::jige: INT_JUMP(left >= right)
+
+			case Opcode::call:
+			{
+				Code const * callee = &module.function(insn.arg);
+				Counts * called = nullptr;
+				/* enter without a call while the slot holds the callee and nothing is due */
+				if (Recording)
+				{
+					++counts->branches[2 * (pc - 1 - code->instructions())];
+					called = slots + 2 * callee->slot();
+					if (called->code != callee)
+						called = &count(*callee);
+					if (++called->calls == flush_calls || !called->runs)
+						refresh(*callee, *called);
+					callee = called->runs;
+					called = called->runs_counts;
+				}
+				Value * const args = sp - callee->parameters_number() - callee->captures_number();
+				if (fp == top || callee->locals_number() + callee->max_stack() > static_cast<std::size_t>(limit - args))
+					RUNTIME_ERROR("stack overflow");
+
+				Frame const frame = { code, pc, locals };
+				if (Recording)
+				{
+					frame_counts[fp - bottom] = counts;
+					counts = called;
+				}
+				*fp++ = frame;
+
+				locals = args;
+				sp = locals + callee->locals_number();
+				code = callee;
+				pc = code->instructions();
+				break;
+			}
+			case Opcode::ret:
+			case Opcode::retv:
+			{
+				if (fp == bottom)
+				{
+					if (result && insn.opcode == Opcode::ret)
+						*result = sp[-1];
+					return status.code();
+				}
+
+				if (insn.opcode == Opcode::ret)
+				{
+					Value const result = sp[-1];
+					sp = locals;
+					*sp++ = result;
+				}
+				else
+					sp = locals;
+
+				Frame const & frame = *--fp;
+				if (Recording)
+					counts = frame_counts[fp - bottom];
+				code = frame.code;
+				pc = frame.pc;
+				locals = frame.locals;
+				break;
+			}
+
+			/* the frame is the same in both, only the code changes */
+			case Opcode::deopt:
+			{
+				Code const * const baseline = code->baseline();
+				if (Recording && speculator_)
+					speculator_->deoptimized(*code);
+				pc = baseline->instructions() + code->deopt_target(insn.arg);
+				code = baseline;
+				/* the speculator may have settled it, the next call asks again */
+				if (Recording)
+				{
+					counts = &count(*code);
+					counts->runs = nullptr;
+				}
+				break;
+			}
+
+			case Opcode::native:
+			{
+				Module::Native const & native = module.native(insn.arg);
+				sp -= native.parameters;
+				Value const result = native.trampoline(native.address, sp);
+				if (native.return_type != Type::Void)
+					*sp++ = result;
+				break;
+			}
+			case Opcode::reduce:
+			{
+				Reduction const & reduction = module.reduction(insn.arg);
+				sp -= 3 + reduction.invariants_number();
+				*sp = reduction.run(sp[2], sp[0].as_int, sp[1].as_int, sp + 3);
+				++sp;
+				break;
+			}
+
+			case Opcode::iprint:
+				*out_ << (--sp)->as_int;
+				break;
+			case Opcode::dprint:
+				*out_ << (--sp)->as_double;
+				break;
+			case Opcode::sprint:
+				*out_ << (--sp)->as_string;
+				break;
+			}
+		}
+
+		#undef INT_JUMP
+		#undef BRANCH
+		#undef MIXED_BINARY
+		#undef DOUBLE_COMPARE
+		#undef DOUBLE_BINARY
+		#undef INT_BINARY
+		#undef RUNTIME_ERROR
+	}
+
+}
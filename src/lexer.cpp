@@ -41,8 +41,8 @@ int main(int argc, char **argv)
 
 		if (!vm::Scanner().scan(code, tokens, status))
 		{
-			std::cout << "ERROR(" << status.location().line()
-						<< ":" << status.location().offset() << "): "
+			std::cout << "ERROR(" << tokens.lines().line(status.location())
+						<< ":" << tokens.lines().offset(status.location()) << "): "
 						<< status.message() << std::endl;
 			tokens.dump(std::cout);
 			return 0;
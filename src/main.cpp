@@ -1,8 +1,402 @@
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <fstream>
+#include <string>
+#include <vector>
 
-int main()
+#include <compiler.hpp>
+#include <feedback.hpp>
+#include <interpreter.hpp>
+#include <native.hpp>
+#include <optimizer.hpp>
+#include <perf.hpp>
+#include <profiler.hpp>
+#include <speculator.hpp>
+#include <stats.hpp>
+
+static bool read_file(char const * file_name, std::string & code)
+{
+	std::vector<char> data;
+	std::ifstream input(file_name);
+
+	if (!input)
+		return false;
+
+	input >> std::noskipws;
+
+	std::istream_iterator<char> begin(input), end;
+
+	std::copy(begin, end, std::back_inserter(data));
+	std::string(data.cbegin(), data.cend()).swap(code);
+
+	return true;
+}
+
+#if defined(VM_STATS)
+static std::size_t count_nodes(vm::Program & program)
+{
+	std::size_t nodes = 0;
+	for (vm::Function * function : program.functions())
+		nodes += vm::count_nodes(*function->body());
+	return nodes;
+}
+#endif
+
+/* the single edit that turns before into after, everything between their common prefix and suffix */
+static vm::Edit difference(std::string const & before, std::string const & after)
+{
+	std::size_t prefix = 0;
+	while (prefix != before.size() && prefix != after.size() && before[prefix] == after[prefix])
+		++prefix;
+
+	std::size_t suffix = 0;
+	while (suffix != before.size() - prefix && suffix != after.size() - prefix
+			&& before[before.size() - suffix - 1] == after[after.size() - suffix - 1])
+		++suffix;
+
+	vm::Edit const edit = { prefix, before.size() - prefix - suffix, after.substr(prefix, after.size() - prefix - suffix) };
+	return edit;
+}
+
+/* the functions a reparse parsed anew and the ones it kept */
+static void report_changes(vm::Program & program, vm::Parser::Changes const & changes)
 {
-	std::cout << "Hello, World!" << std::endl;
+	std::cout << "reparsed";
+	for (vm::Function const * function : changes.parsed)
+		std::cout << " " << function->name();
+	std::cout << std::endl;
+
+	std::cout << "reused";
+	for (vm::Function const * function : program.functions())
+		if (std::find(changes.parsed.begin(), changes.parsed.end(), function) == changes.parsed.end())
+			std::cout << " " << function->name();
+	std::cout << std::endl;
+}
+
+static int report(vm::Status const & status, vm::LineTable const & lines)
+{
+	std::cout << "ERROR(" << lines.line(status.location())
+				<< ":" << lines.offset(status.location()) << "): "
+				<< status.message() << std::endl;
+	return 1;
+}
+
+/* reports every syntax error of a file at once, without running it */
+static bool check(char const * file_name, std::string const & code)
+{
+	vm::Status status;
+	vm::Parser::DiagnosticsType diagnostics;
+
+	vm::Parser parser;
+	parser.parse(code, status, diagnostics);
+	for (vm::Status const & diagnostic : diagnostics)
+	{
+		std::cout << file_name << ": ";
+		report(diagnostic, parser.lines());
+	}
+
+	return diagnostics.empty();
+}
+
+static void usage(char const * name)
+{
+	std::cout << "usage: " << name << " [--engine interpreter|optimized] [--fast-math] [--check] [--reload] [--reparse] [--dump] [--no-peephole] [--speculate] [--pgo-use FILE] [--pgo-record FILE] [--profile FOLDED] [--pairs] [--perf-map] [--jitdump] [--stats] [--stats-json FILE] FILE..." << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	std::string engine = "interpreter";
+	std::string profile;
+	bool dump = false;
+	bool peephole = true;
+	bool checking = false;
+	bool reloading = false;
+	bool reparsing = false;
+	bool failed = false;
+	bool perf_map = false;
+	bool jitdump = false;
+	bool stats = false;
+	bool pairs = false;
+	bool speculate = false;
+	bool fast_math = false;
+	std::string pgo_use;
+	std::string pgo_record;
+	std::string stats_json;
+
+	int index = 1;
+	for (; index != argc && argv[index][0] == '-'; ++index)
+	{
+		std::string const arg = argv[index];
+		if (arg == "--engine" && index + 1 != argc)
+			engine = argv[++index];
+		else if (arg == "--fast-math")
+			fast_math = true;
+		else if (arg == "--check")
+			checking = true;
+		else if (arg == "--reload")
+			reloading = true;
+		else if (arg == "--reparse")
+			reparsing = true;
+		else if (arg == "--dump")
+			dump = true;
+		else if (arg == "--no-peephole")
+			peephole = false;
+		else if (arg == "--speculate")
+			speculate = true;
+		else if (arg == "--pgo-use" && index + 1 != argc)
+			pgo_use = argv[++index];
+		else if (arg == "--pgo-record" && index + 1 != argc)
+			pgo_record = argv[++index];
+		else if (arg == "--profile" && index + 1 != argc)
+			profile = argv[++index];
+		else if (arg == "--pairs")
+			pairs = true;
+		else if (arg == "--perf-map")
+			perf_map = true;
+		else if (arg == "--jitdump")
+			jitdump = true;
+		else if (arg == "--stats")
+			stats = true;
+		else if (arg == "--stats-json" && index + 1 != argc)
+			stats_json = argv[++index];
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (index == argc || (engine != "interpreter" && engine != "optimized"))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* the optimizer rewrites the functions a reparse would take over as they are */
+	if (reparsing && (engine != "interpreter" || reloading || !pgo_record.empty()))
+	{
+		std::cout << "ERROR: --reparse runs the interpreter engine, without --reload or --pgo-record" << std::endl;
+		return 1;
+	}
+
+	if (fast_math && engine != "optimized")
+	{
+		std::cout << "ERROR: --fast-math reassociates the reductions the optimized engine vectorizes" << std::endl;
+		return 1;
+	}
+
+#if !defined(VM_STATS)
+	if (stats || !stats_json.empty())
+	{
+		std::cout << "ERROR: stats are not compiled in, build with STATS=-DVM_STATS" << std::endl;
+		return 1;
+	}
+#endif
+
+	/*
+	 * samples point into the modules, they are kept until the profile is
+	 * written; the code of a module calls natives through the trampolines
+	 * of its linker, a reloaded module through those of every version
+	 */
+	std::vector<std::unique_ptr<vm::NativeLinker>> linkers;
+	std::vector<std::unique_ptr<vm::Program>> programs;
+	std::vector<std::unique_ptr<vm::Module>> modules;
+
+	/* the program and the source every module was compiled from, for the feedback */
+	std::vector<vm::Program *> compiled;
+	std::vector<std::string> sources;
+
+	vm::Feedback feedback;
+	if (!pgo_use.empty())
+	{
+		std::ifstream in(pgo_use);
+		if (in && !feedback.read(in))
+			std::cerr << "WARNING: ignoring malformed profile " << pgo_use << std::endl;
+	}
+
+	vm::PerfWriter perf;
+	if ((perf_map && !perf.open_map()) || (jitdump && !perf.open_jitdump()))
+	{
+		std::cout << "ERROR: cannot write perf files" << std::endl;
+		return 1;
+	}
+
+	vm::Optimizer optimizer;
+	optimizer.set_fast_math(fast_math);
+	vm::Compiler compiler;
+	compiler.set_peephole(peephole);
+	vm::Profiler profiler;
+	vm::PairCounter pair_counter;
+	vm::Speculator speculator;
+	vm::Interpreter interpreter(std::cout);
+	if (pairs)
+		interpreter.set_pair_counter(&pair_counter);
+	if (speculate)
+		interpreter.set_speculator(&speculator);
+	if (!pgo_record.empty())
+		interpreter.set_feedback(true);
+	if (!profile.empty())
+	{
+		if (!profiler.start())
+		{
+			std::cout << "ERROR: cannot start the profiler" << std::endl;
+			return 1;
+		}
+		interpreter.set_profiler(&profiler);
+	}
+
+	/* with --reparse every file is a new version of the first one, only what the edit touched is parsed again */
+	vm::Parser reparser;
+	std::string reparsed;
+
+	for (; index != argc; ++index)
+	{
+		std::string code;
+		vm::Status status;
+
+		bool read;
+		{
+			VM_STATS_PHASE(read);
+			read = read_file(argv[index], code);
+		}
+
+		if (!read)
+		{
+			std::cout << "ERROR: cannot read file " << argv[index] << std::endl;
+			return 1;
+		}
+
+		if (checking)
+		{
+			failed = !check(argv[index], code) || failed;
+			continue;
+		}
+
+		vm::Parser fresh;
+		vm::Parser & parser = reparsing ? reparser : fresh;
+		std::unique_ptr<vm::Program> program;
+		if (reparsing && !programs.empty())
+		{
+			vm::Parser::Changes changes;
+			program = parser.reparse(std::move(programs.back()), difference(reparsed, code), status, changes);
+			programs.pop_back();
+			if (!program || status.code() == vm::Status::ERROR)
+				return report(status, parser.lines());
+			report_changes(*program, changes);
+		}
+		else
+			program = parser.parse(code, status);
+		if (!program || status.code() == vm::Status::ERROR)
+			return report(status, parser.lines());
+		if (reparsing)
+			reparsed = code;
+		VM_STATS_COUNT(parse, nodes, count_nodes(*program));
+
+		linkers.push_back(std::unique_ptr<vm::NativeLinker>(new vm::NativeLinker()));
+		vm::NativeLinker & linker = *linkers.back();
+		linker.set_perf(perf.is_open() ? &perf : nullptr);
+		if (linker.link(*program, status) == vm::Status::ERROR)
+			return report(status, program->lines());
+
+		/* a stale profile finds nothing to apply */
+		if (!pgo_use.empty())
+			feedback.apply(*program, code);
+
+		if (engine == "optimized")
+		{
+			optimizer.optimize(*program);
+			VM_STATS_COUNT(optimize, nodes, count_nodes(*program));
+		}
+
+		/* with --reload every file is a new version of the first one, loaded into its module */
+		if (reloading && !modules.empty())
+		{
+			vm::Module & module = *modules.back();
+			vm::Compiler::ReloadedType reloaded;
+			if (compiler.reload(module, *program, reloaded, status) == vm::Status::ERROR)
+				return report(status, program->lines());
+			programs.push_back(std::move(program));
+
+			std::cout << "reloaded";
+			for (std::size_t slot : reloaded)
+				std::cout << " " << module.function(slot).name();
+			std::cout << std::endl;
+
+			if (dump)
+				module.dump(std::cout);
+			else if (interpreter.run(module, status) == vm::Status::ERROR)
+				return report(status, module.lines());
+			continue;
+		}
+
+		std::unique_ptr<vm::Module> module = compiler.compile(*program, status);
+		if (!module)
+			return report(status, program->lines());
+		if (!pgo_use.empty())
+			feedback.seed(*program, code, *module);
+
+		if (dump)
+			module->dump(std::cout);
+		else if (interpreter.run(*module, status) == vm::Status::ERROR)
+			return report(status, module->lines());
+
+		compiled.push_back(program.get());
+		sources.push_back(std::move(code));
+		programs.push_back(std::move(program));
+		modules.push_back(std::move(module));
+	}
+
+	if (!pgo_record.empty())
+	{
+		vm::Feedback recorded;
+		for (std::size_t index = 0; index != modules.size(); ++index)
+			recorded.record(*compiled[index], sources[index], *modules[index]);
+
+		std::ofstream out(pgo_record);
+		recorded.write(out);
+		if (!out)
+		{
+			std::cout << "ERROR: cannot write " << pgo_record << std::endl;
+			return 1;
+		}
+	}
+
+	if (!profile.empty())
+	{
+		profiler.stop();
+		profiler.report_flat(std::cerr);
+
+		std::ofstream folded(profile);
+		profiler.report_folded(folded);
+		if (!folded)
+		{
+			std::cout << "ERROR: cannot write " << profile << std::endl;
+			return 1;
+		}
+	}
+
+	if (pairs)
+		pair_counter.report(std::cerr);
+
+	if (speculate)
+		speculator.report(std::cerr);
+
+#if defined(VM_STATS)
+	if (stats)
+		vm::Stats::instance().report(std::cerr);
+
+	if (!stats_json.empty())
+	{
+		std::ofstream out(stats_json);
+		vm::Stats::instance().report_json(out);
+		if (!out)
+		{
+			std::cout << "ERROR: cannot write " << stats_json << std::endl;
+			return 1;
+		}
+	}
+#endif
 
-	return 0;
+	return failed ? 1 : 0;
 }
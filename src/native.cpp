@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <cassert>
+
+#include <dlfcn.h>
+
+#include <native.hpp>
+#include <stats.hpp>
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		static char type_code(Type type) noexcept
+		{
+			switch (type)
+			{
+			default: return '?';
+			case Type::Double: return 'd';
+			case Type::Int: return 'i';
+			case Type::String: return 's';
+			case Type::Void: return 'v';
+			}
+		}
+
+		static std::string signature_shape(Signature const & signature)
+		{
+			std::string shape(1, type_code(signature.return_type()));
+			for (Signature::ParamType const & param : signature)
+				shape += type_code(param.first);
+			return shape;
+		}
+
+		static bool is_valid_shape(std::string const & shape) noexcept
+		{
+			return shape.find('?') == std::string::npos
+				&& shape.find('v', 1) == std::string::npos;
+		}
+
+#if defined(__x86_64__)
+		/*
+		 * trampoline(rdi = target, rsi = args): integer and string slots go
+		 * to rdi, rsi, rdx, rcx, r8, r9, doubles to xmm0-xmm7, the rest is
+		 * pushed right to left; a double result is moved to rax so every
+		 * shape returns its Value in the same register
+		 */
+		static void emit_trampoline(std::string const & shape, Assembler & code)
+		{
+			static x64::Register const int_regs[] = {
+				x64::rdi, x64::rsi, x64::rdx, x64::rcx, x64::r8, x64::r9
+			};
+			static std::size_t const int_count = sizeof(int_regs) / sizeof(int_regs[0]);
+			static std::size_t const xmm_count = 8;
+
+			std::vector<std::size_t> ints, xmms, stack;
+			for (std::size_t index = 1; index != shape.size(); ++index)
+			{
+				std::size_t const slot = index - 1;
+				if (shape[index] == 'd')
+					(xmms.size() < xmm_count ? xmms : stack).push_back(slot);
+				else
+					(ints.size() < int_count ? ints : stack).push_back(slot);
+			}
+
+			code.push(x64::rbp);
+			code.mov(x64::rbp, x64::rsp);
+			code.mov(x64::r11, x64::rdi);
+			code.mov(x64::r10, x64::rsi);
+
+			if (stack.size() % 2)
+				code.sub(x64::rsp, 8);
+			std::for_each(stack.rbegin(), stack.rend(), [&code](std::size_t slot)
+					{ code.push(x64::r10, static_cast<std::int32_t>(slot * sizeof(Value))); });
+
+			for (std::size_t index = 0; index != ints.size(); ++index)
+				code.mov(int_regs[index], x64::r10, static_cast<std::int32_t>(ints[index] * sizeof(Value)));
+			for (std::size_t index = 0; index != xmms.size(); ++index)
+				code.movsd(static_cast<x64::XmmRegister>(index), x64::r10, static_cast<std::int32_t>(xmms[index] * sizeof(Value)));
+
+			code.mov(x64::rax, static_cast<std::uint32_t>(xmms.size()));
+			code.call(x64::r11);
+
+			if (shape[0] == 'd')
+				code.movq(x64::rax, x64::xmm0);
+
+			code.leave();
+			code.ret();
+		}
+#endif
+
+	}
+
+	NativeLinker::NativeLinker()
+		: perf_(nullptr)
+	{ }
+
+	NativeLinker::~NativeLinker()
+	{ std::for_each(libraries_.begin(), libraries_.end(), [](void * lib) { dlclose(lib); }); }
+
+	Status::Code NativeLinker::load_library(std::string const & path, Status & status)
+	{
+		void * const lib = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+		if (!lib)
+		{
+			Status(Status::ERROR, "cannot load library " + path).swap(status);
+			return status.code();
+		}
+
+		libraries_.push_back(lib);
+		return Status::SUCCESS;
+	}
+
+	void NativeLinker::set_perf(PerfWriter * perf) noexcept
+	{ perf_ = perf; }
+
+	NativeAddress NativeLinker::resolve(std::string const & symbol) const noexcept
+	{
+		void * address = nullptr;
+		for (void * lib : libraries_)
+			if ((address = dlsym(lib, symbol.c_str())) != nullptr)
+				break;
+
+		if (!address)
+			address = dlsym(RTLD_DEFAULT, symbol.c_str());
+
+		return reinterpret_cast<NativeAddress>(address);
+	}
+
+	NativeTrampoline NativeLinker::trampoline(Signature const & signature)
+	{
+		std::string const shape = detail::signature_shape(signature);
+		if (!detail::is_valid_shape(shape))
+			return nullptr;
+
+		TrampolinesType::const_iterator it = trampolines_.find(shape);
+		if (it != trampolines_.cend())
+			return reinterpret_cast<NativeTrampoline>(it->second.address());
+
+#if defined(__x86_64__)
+		Assembler code;
+		detail::emit_trampoline(shape, code);
+
+		ExecutableMemory memory;
+		if (!memory.install(code))
+			return nullptr;
+
+		NativeTrampoline const tramp = reinterpret_cast<NativeTrampoline>(memory.address());
+		VM_STATS_COUNT(link, code_size, code.size());
+		if (perf_)
+			perf_->load("trampoline_" + shape, memory.address(), code.size());
+		trampolines_.insert(std::make_pair(shape, std::move(memory)));
+
+		return tramp;
+#else
+		return nullptr;
+#endif
+	}
+
+	Status::Code NativeLinker::link(Program & program, Status & status)
+	{
+		VM_STATS_PHASE(link);
+		Status().swap(status);
+
+		assert(program.scope());
+		return link(*program.scope(), status);
+	}
+
+	Status::Code NativeLinker::link(Scope & scope, Status & status)
+	{
+		for (Scope::function_iterator it = scope.functions_begin(); it != scope.functions_end(); ++it)
+		{
+			NativeCallNode * const native = it->second->native();
+			if (!native || native->is_bound())
+				continue;
+
+			NativeAddress const address = resolve(native->native_name());
+			if (!address)
+			{
+				Status(Status::ERROR, "unresolved native symbol " + native->native_name(), native->start()).swap(status);
+				return status.code();
+			}
+
+			NativeTrampoline const tramp = trampoline(native->signature());
+			if (!tramp)
+			{
+				Status(Status::ERROR, "unsupported native signature for " + native->name(), native->start()).swap(status);
+				return status.code();
+			}
+
+			native->bind(address, tramp);
+		}
+
+		for (Scope::child_iterator it = scope.children_begin(); it != scope.children_end(); ++it)
+			if (link(**it, status) == Status::ERROR)
+				return status.code();
+
+		return status.code();
+	}
+
+}
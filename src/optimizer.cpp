@@ -0,0 +1,959 @@
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <map>
+#include <vector>
+
+#include <optimizer.hpp>
+#include <stats.hpp>
+#include <vectorizer.hpp>
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		static bool is_numeric(Type type) noexcept
+		{ return type == Type::Int || type == Type::Double; }
+
+		class TypeOf : public Visitor
+		{
+		public:
+			using Visitor::visit;
+
+			TypeOf() noexcept
+				: type_(Type::Invalid)
+			{ }
+
+			Type type() const noexcept
+			{ return type_; }
+
+			virtual void visit(BinaryExprNode & node)
+			{
+				switch (node.kind())
+				{
+				default:
+					type_ = Type::Invalid;
+					return;
+				case Token::eq: case Token::neq: case Token::ge: case Token::le:
+				case Token::gt: case Token::lt: case Token::lor: case Token::land:
+				case Token::aor: case Token::aand: case Token::axor: case Token::mod:
+					type_ = Type::Int;
+					return;
+				case Token::add: case Token::sub: case Token::mul: case Token::div:
+					break;
+				}
+
+				/* an int operand is converted when mixed with a double one */
+				Type const left = expression_type(node.left());
+				Type const right = expression_type(node.right());
+				if (is_numeric(left) && is_numeric(right))
+					type_ = (left == Type::Double || right == Type::Double) ? Type::Double : Type::Int;
+				else if (node.kind() == Token::add && left == Type::String && right == Type::String)
+					type_ = Type::String;
+			}
+
+			virtual void visit(UnaryExprNode & node)
+			{
+				Type const operand = expression_type(node.operand());
+				if (node.kind() == Token::lnot)
+					type_ = Type::Int;
+				else if (operand == Type::Int || (operand == Type::Double && node.kind() == Token::sub))
+					type_ = operand;
+			}
+
+			virtual void visit(StringLitNode &)
+			{ type_ = Type::String; }
+
+			virtual void visit(IntLitNode &)
+			{ type_ = Type::Int; }
+
+			virtual void visit(DoubleLitNode &)
+			{ type_ = Type::Double; }
+
+			virtual void visit(LoadNode & node)
+			{ type_ = node.variable()->type(); }
+
+			virtual void visit(LetNode & node)
+			{ type_ = expression_type(node.value()); }
+
+			virtual void visit(CallNode & node)
+			{
+				if (node.function())
+					type_ = node.function()->return_type();
+			}
+
+		private:
+			Type type_;
+		};
+
+		class NodeCounter : public Visitor
+		{
+		public:
+			NodeCounter() noexcept
+				: count_(0)
+			{ }
+
+			std::size_t count() const noexcept
+			{ return count_; }
+
+			#define VISIT(n)								\
+				virtual void visit(n & node)				\
+				{											\
+					++count_;								\
+					node.visit_children(*this);				\
+				}
+			FOR_NODES(VISIT)
+			#undef VISIT
+
+		private:
+			std::size_t count_;
+		};
+
+		/* an expression is pure if it has no calls and cannot trap */
+		class PurityCheck : public Visitor
+		{
+		public:
+			using Visitor::visit;
+
+			PurityCheck() noexcept
+				: pure_(true)
+				, reads_(false)
+			{ }
+
+			bool pure() const noexcept
+			{ return pure_; }
+
+			/* whether the value depends on a variable an effect may change */
+			bool reads() const noexcept
+			{ return reads_; }
+
+			virtual void visit(LoadNode &)
+			{ reads_ = true; }
+
+			virtual void visit(BinaryExprNode & node)
+			{
+				if (node.kind() == Token::div || node.kind() == Token::mod)
+					pure_ = false;
+				node.visit_children(*this);
+			}
+
+			virtual void visit(CallNode &)
+			{ pure_ = false; }
+
+			/* the store must run once */
+			virtual void visit(LetNode & node)
+			{
+				pure_ = false;
+				node.visit_children(*this);
+			}
+
+		private:
+			bool pure_;
+			bool reads_;
+		};
+
+		static bool is_pure(ASTNode * node)
+		{
+			PurityCheck check;
+			node->visit(check);
+			return check.pure();
+		}
+
+		static bool reads_variables(ASTNode * node)
+		{
+			PurityCheck check;
+			node->visit(check);
+			return check.reads();
+		}
+
+		static bool fold_int(Token::Kind kind, std::int64_t left, std::int64_t right, std::int64_t & result) noexcept
+		{
+			typedef std::uint64_t U;
+
+			switch (kind)
+			{
+			default: return false;
+			case Token::add: result = static_cast<std::int64_t>(U(left) + U(right)); break;
+			case Token::sub: result = static_cast<std::int64_t>(U(left) - U(right)); break;
+			case Token::mul: result = static_cast<std::int64_t>(U(left) * U(right)); break;
+			case Token::div:
+			case Token::mod:
+				if (right == 0 || (left == std::numeric_limits<std::int64_t>::min() && right == -1))
+					return false;
+				result = (kind == Token::div) ? left / right : left % right;
+				break;
+			case Token::eq: result = left == right; break;
+			case Token::neq: result = left != right; break;
+			case Token::ge: result = left >= right; break;
+			case Token::le: result = left <= right; break;
+			case Token::gt: result = left > right; break;
+			case Token::lt: result = left < right; break;
+			case Token::lor: result = left || right; break;
+			case Token::land: result = left && right; break;
+			case Token::aor: result = left | right; break;
+			case Token::aand: result = left & right; break;
+			case Token::axor: result = left ^ right; break;
+			}
+			return true;
+		}
+
+		static std::unique_ptr<ASTNode> fold_double(BinaryExprNode const & node, double left, double right)
+		{
+			Location const start = node.start(), finish = node.finish();
+
+			switch (node.kind())
+			{
+			default: return nullptr;
+			case Token::add: return std::unique_ptr<ASTNode>(new DoubleLitNode(left + right, start, finish));
+			case Token::sub: return std::unique_ptr<ASTNode>(new DoubleLitNode(left - right, start, finish));
+			case Token::mul: return std::unique_ptr<ASTNode>(new DoubleLitNode(left * right, start, finish));
+			case Token::div: return std::unique_ptr<ASTNode>(new DoubleLitNode(left / right, start, finish));
+			case Token::eq: return std::unique_ptr<ASTNode>(new IntLitNode(left == right, start, finish));
+			case Token::neq: return std::unique_ptr<ASTNode>(new IntLitNode(left != right, start, finish));
+			case Token::ge: return std::unique_ptr<ASTNode>(new IntLitNode(left >= right, start, finish));
+			case Token::le: return std::unique_ptr<ASTNode>(new IntLitNode(left <= right, start, finish));
+			case Token::gt: return std::unique_ptr<ASTNode>(new IntLitNode(left > right, start, finish));
+			case Token::lt: return std::unique_ptr<ASTNode>(new IntLitNode(left < right, start, finish));
+			}
+		}
+
+		static std::unique_ptr<ASTNode> fold(BinaryExprNode & node)
+		{
+			IntLitNode const * const ileft = dynamic_cast<IntLitNode const *>(node.left());
+			IntLitNode const * const iright = dynamic_cast<IntLitNode const *>(node.right());
+			if (ileft && iright)
+			{
+				std::int64_t value;
+				if (!fold_int(node.kind(), ileft->value(), iright->value(), value))
+					return nullptr;
+				return std::unique_ptr<ASTNode>(new IntLitNode(value, node.start(), node.finish()));
+			}
+
+			DoubleLitNode const * const dleft = dynamic_cast<DoubleLitNode const *>(node.left());
+			DoubleLitNode const * const dright = dynamic_cast<DoubleLitNode const *>(node.right());
+			if (dleft && dright)
+				return fold_double(node, dleft->value(), dright->value());
+
+			return nullptr;
+		}
+
+		static std::unique_ptr<ASTNode> fold(UnaryExprNode & node)
+		{
+			if (IntLitNode const * const lit = dynamic_cast<IntLitNode const *>(node.operand()))
+			{
+				std::int64_t value = lit->value();
+				switch (node.kind())
+				{
+				default: return nullptr;
+				case Token::sub: value = static_cast<std::int64_t>(0 - static_cast<std::uint64_t>(value)); break;
+				case Token::anot: value = ~value; break;
+				case Token::lnot: value = !value; break;
+				}
+				return std::unique_ptr<ASTNode>(new IntLitNode(value, node.start(), node.finish()));
+			}
+
+			DoubleLitNode const * const lit = dynamic_cast<DoubleLitNode const *>(node.operand());
+			if (lit && node.kind() == Token::sub)
+				return std::unique_ptr<ASTNode>(new DoubleLitNode(-lit->value(), node.start(), node.finish()));
+
+			return nullptr;
+		}
+
+		class ConstantFolder : public Transformer
+		{
+		public:
+			ConstantFolder() noexcept
+				: changed_(false)
+			{ }
+
+			bool changed() const noexcept
+			{ return changed_; }
+
+			virtual std::unique_ptr<ASTNode> transform(std::unique_ptr<ASTNode> node)
+			{
+				node->transform_children(*this);
+
+				std::unique_ptr<ASTNode> folded;
+				if (BinaryExprNode * const binary = dynamic_cast<BinaryExprNode *>(node.get()))
+					folded = fold(*binary);
+				else if (UnaryExprNode * const unary = dynamic_cast<UnaryExprNode *>(node.get()))
+					folded = fold(*unary);
+
+				if (!folded)
+					return node;
+
+				changed_ = true;
+				return folded;
+			}
+
+		private:
+			bool changed_;
+		};
+
+		class DeadBranches : public Transformer
+		{
+		public:
+			DeadBranches() noexcept
+				: changed_(false)
+			{ }
+
+			bool changed() const noexcept
+			{ return changed_; }
+
+			virtual std::unique_ptr<ASTNode> transform(std::unique_ptr<ASTNode> node)
+			{
+				node->transform_children(*this);
+
+				if (IfNode * const branch = dynamic_cast<IfNode *>(node.get()))
+				{
+					IntLitNode const * const cond = dynamic_cast<IntLitNode const *>(branch->expression());
+					if (!cond)
+						return node;
+
+					changed_ = true;
+					if (cond->value())
+						return branch->release_then_block();
+					return branch->release_else_block();
+				}
+
+				if (WhileNode * const loop = dynamic_cast<WhileNode *>(node.get()))
+				{
+					IntLitNode const * const cond = dynamic_cast<IntLitNode const *>(loop->expression());
+					if (cond && !cond->value())
+					{
+						changed_ = true;
+						return nullptr;
+					}
+				}
+
+				if (ForNode * const loop = dynamic_cast<ForNode *>(node.get()))
+				{
+					IntLitNode const * const from = dynamic_cast<IntLitNode const *>(loop->from());
+					IntLitNode const * const to = dynamic_cast<IntLitNode const *>(loop->to());
+					if (from && to && RangeCounter(from->value(), to->value()).done())
+					{
+						changed_ = true;
+
+						/* a variable the loop declares is in the scope around its body, any other one outside */
+						Variable * const var = loop->variable();
+						if (var->owner() == loop->body()->owner())
+							return nullptr;
+
+						/* a variable of an outer scope is still assigned from */
+						std::unique_ptr<ASTNode> value(new IntLitNode(from->value(), from->start(), from->finish()));
+						return std::unique_ptr<ASTNode>(new StoreNode(var, std::move(value), Token::assign,
+									loop->start(), loop->finish()));
+					}
+				}
+
+				Block * const block = dynamic_cast<Block *>(node.get());
+				if (block && block->empty())
+				{
+					changed_ = true;
+					return nullptr;
+				}
+
+				return node;
+			}
+
+		private:
+			bool changed_;
+		};
+
+		/* drops statements that follow a return in the same block */
+		class UnreachableCode : public Visitor
+		{
+		public:
+			using Visitor::visit;
+
+			UnreachableCode() noexcept
+				: changed_(false)
+			{ }
+
+			bool changed() const noexcept
+			{ return changed_; }
+
+			virtual void visit(Block & node)
+			{
+				Block::iterator it = std::find_if(node.begin(), node.end(),
+						[](ASTNode * stmt) { return dynamic_cast<ReturnNode *>(stmt) != nullptr; });
+
+				if (it != node.end() && ++it != node.end())
+				{
+					node.erase(it, node.end());
+					changed_ = true;
+				}
+
+				node.visit_children(*this);
+			}
+
+		private:
+			bool changed_;
+		};
+
+		/*
+		 * checks that a callee expression only refers to the callee
+		 * parameters and global variables and calls no function nested in
+		 * the callee, which a caller can neither see nor give the callee
+		 * frame it may capture from, and counts parameter uses
+		 */
+		class InlineAnalysis : public Visitor
+		{
+		public:
+			using Visitor::visit;
+
+			InlineAnalysis(Function const & callee, Scope const * globals)
+				: callee_(callee)
+				, globals_(globals)
+				, uses_(callee.parameters_number(), 0)
+				, conditional_(callee.parameters_number(), false)
+				, short_circuit_(0)
+				, pure_(true)
+				, valid_(true)
+			{ }
+
+			bool valid() const noexcept
+			{ return valid_; }
+
+			bool pure() const noexcept
+			{ return pure_; }
+
+			std::size_t uses(std::size_t index) const noexcept
+			{ return uses_[index]; }
+
+			bool conditional(std::size_t index) const noexcept
+			{ return conditional_[index]; }
+
+			virtual void visit(BinaryExprNode & node)
+			{
+				if (node.kind() == Token::div || node.kind() == Token::mod)
+					pure_ = false;
+
+				if (node.kind() != Token::lor && node.kind() != Token::land)
+				{
+					node.visit_children(*this);
+					return;
+				}
+
+				node.left()->visit(*this);
+				++short_circuit_;
+				node.right()->visit(*this);
+				--short_circuit_;
+			}
+
+			virtual void visit(LoadNode & node)
+			{
+				/* an impure argument may write the global, the body must not read it first */
+				Variable const * const var = node.variable();
+				if (var->owner() == globals_)
+				{
+					pure_ = false;
+					return;
+				}
+
+				std::size_t const index = parameter_index(var);
+				if (index == callee_.parameters_number())
+				{
+					valid_ = false;
+					return;
+				}
+
+				++uses_[index];
+				if (short_circuit_)
+					conditional_[index] = true;
+			}
+
+			virtual void visit(CallNode & node)
+			{
+				pure_ = false;
+
+				Function const * const target = node.function();
+				for (Scope const * scope = target ? target->body()->owner() : nullptr; scope; scope = scope->owner())
+					if (scope == callee_.body()->owner())
+						valid_ = false;
+
+				node.visit_children(*this);
+			}
+
+			#define REJECT(n)						\
+				virtual void visit(n &)				\
+				{ valid_ = false; }
+			REJECT(Block)
+			REJECT(StoreNode)
+			REJECT(LetNode)
+			REJECT(ForNode)
+			REJECT(WhileNode)
+			REJECT(NativeCallNode)
+			REJECT(ReturnNode)
+			REJECT(IfNode)
+			REJECT(PrintNode)
+			#undef REJECT
+
+			std::size_t parameter_index(Variable const * var) const noexcept
+			{
+				if (var->owner() != callee_.body()->owner())
+					return callee_.parameters_number();
+
+				std::size_t index = 0;
+				while (index != callee_.parameters_number() && callee_.name_at(index) != var->name())
+					++index;
+				return index;
+			}
+
+		private:
+			Function const & callee_;
+			Scope const * globals_;
+			std::vector<std::size_t> uses_;
+			std::vector<bool> conditional_;
+			std::size_t short_circuit_;
+			bool pure_;
+			bool valid_;
+		};
+
+		class StoresTo : public Visitor
+		{
+		public:
+			using Visitor::visit;
+
+			explicit StoresTo(Variable const * var) noexcept
+				: variable_(var)
+				, found_(false)
+			{ }
+
+			bool found() const noexcept
+			{ return found_; }
+
+			virtual void visit(StoreNode & node)
+			{
+				if (node.variable() == variable_)
+					found_ = true;
+				node.visit_children(*this);
+			}
+
+			virtual void visit(LetNode & node)
+			{
+				if (node.variable() == variable_)
+					found_ = true;
+				node.visit_children(*this);
+			}
+
+			virtual void visit(ForNode & node)
+			{
+				if (node.variable() == variable_)
+					found_ = true;
+				node.visit_children(*this);
+			}
+
+			/* a function declared in the scope of the variable may write it, a global one included */
+			virtual void visit(CallNode & node)
+			{
+				Function const * const target = node.function();
+				for (Scope const * scope = target ? target->body()->owner() : nullptr; scope; scope = scope->owner())
+					if (scope == variable_->owner())
+						found_ = true;
+				node.visit_children(*this);
+			}
+
+		private:
+			Variable const * variable_;
+			bool found_;
+		};
+
+		class LoopVectorizer : public Visitor
+		{
+		public:
+			using Visitor::visit;
+
+			explicit LoopVectorizer(bool fast_math) noexcept
+				: fast_math_(fast_math)
+			{ }
+
+			virtual void visit(ForNode & node)
+			{
+				node.visit_children(*this);
+				node.set_reduction(Reduction::recognize(node, fast_math_));
+			}
+
+		private:
+			bool fast_math_;
+		};
+
+		class LoopLowering : public Visitor
+		{
+		public:
+			using Visitor::visit;
+
+			virtual void visit(ForNode & node)
+			{
+				node.visit_children(*this);
+
+				bool const counted = node.from() && node.to()
+						&& node.variable()->type() == Type::Int
+						&& expression_type(node.from()) == Type::Int
+						&& expression_type(node.to()) == Type::Int;
+
+				StoresTo stores(node.variable());
+				node.body()->visit(stores);
+
+				node.set_counted(counted, stores.found());
+			}
+		};
+
+		/* copies an expression replacing parameter loads with arguments */
+		class Cloner : public Visitor
+		{
+		public:
+			using Visitor::visit;
+
+			typedef std::map<Variable const *, ASTNode *> ArgumentsType;
+
+			explicit Cloner(ArgumentsType args)
+				: args_(std::move(args))
+			{ }
+
+			std::unique_ptr<ASTNode> clone(ASTNode * node)
+			{
+				node->visit(*this);
+				assert(result_);
+				return std::move(result_);
+			}
+
+			virtual void visit(BinaryExprNode & node)
+			{
+				std::unique_ptr<ASTNode> left = clone(node.left());
+				std::unique_ptr<ASTNode> right = clone(node.right());
+				result_.reset(new BinaryExprNode(node.kind(), std::move(left), std::move(right), node.start(), node.finish()));
+			}
+
+			virtual void visit(UnaryExprNode & node)
+			{
+				std::unique_ptr<ASTNode> operand = clone(node.operand());
+				result_.reset(new UnaryExprNode(node.kind(), std::move(operand), node.start(), node.finish()));
+			}
+
+			virtual void visit(StringLitNode & node)
+			{ result_.reset(new StringLitNode(&node.value(), node.start(), node.finish())); }
+
+			virtual void visit(IntLitNode & node)
+			{ result_.reset(new IntLitNode(node.value(), node.start(), node.finish())); }
+
+			virtual void visit(DoubleLitNode & node)
+			{ result_.reset(new DoubleLitNode(node.value(), node.start(), node.finish())); }
+
+			virtual void visit(LoadNode & node)
+			{
+				ArgumentsType::const_iterator it = args_.find(node.variable());
+				if (it != args_.end())
+				{
+					result_ = clone(it->second);
+					return;
+				}
+				result_.reset(new LoadNode(node.variable(), node.start(), node.finish()));
+			}
+
+			virtual void visit(LetNode & node)
+			{
+				std::unique_ptr<ASTNode> init = clone(node.init());
+				std::unique_ptr<ASTNode> value = clone(node.value());
+				result_.reset(new LetNode(node.variable(), std::move(init), std::move(value), node.start(), node.finish()));
+			}
+
+			virtual void visit(CallNode & node)
+			{
+				std::unique_ptr<CallNode> call(new CallNode(node.name(), node.start(), node.finish()));
+				for (std::size_t index = 0; index != node.parameters_number(); ++index)
+					call->push_back(clone(node.at(index)));
+				call->set_function(node.function());
+				call->count_call(node.calls());
+				result_ = std::move(call);
+			}
+
+		private:
+			ArgumentsType args_;
+			std::unique_ptr<ASTNode> result_;
+		};
+
+		class Inliner : public Transformer
+		{
+		public:
+			static std::size_t const max_depth = 4;
+
+			Inliner(Optimizer const & options, Function & caller, Scope const * globals)
+				: options_(options)
+				, caller_(caller)
+				, globals_(globals)
+				, stack_(1, &caller)
+				, changed_(false)
+			{ }
+
+			bool changed() const noexcept
+			{ return changed_; }
+
+			virtual std::unique_ptr<ASTNode> transform(std::unique_ptr<ASTNode> node)
+			{
+				node->transform_children(*this);
+
+				CallNode * const call = dynamic_cast<CallNode *>(node.get());
+				if (!call || !call->function())
+					return node;
+
+				std::unique_ptr<ASTNode> inlined = inline_call(*call);
+				if (!inlined)
+					return node;
+
+				changed_ = true;
+				stack_.push_back(call->function());
+				inlined = transform(std::move(inlined));
+				stack_.pop_back();
+
+				return inlined;
+			}
+
+		private:
+			Optimizer const & options_;
+			Function & caller_;
+			Scope const * globals_;
+			std::vector<Function const *> stack_;
+			bool changed_;
+
+			/* body of a function consisting of a single return statement */
+			static ASTNode * returned_expression(Function & fun) noexcept
+			{
+				if (fun.native() || fun.body()->size() != 1)
+					return nullptr;
+
+				ReturnNode * const ret = dynamic_cast<ReturnNode *>(fun.body()->at(0));
+				return ret ? ret->expression() : nullptr;
+			}
+
+			std::unique_ptr<ASTNode> inline_call(CallNode & call)
+			{
+				Function & callee = *call.function();
+
+				if (stack_.size() > max_depth)
+					return nullptr;
+				if (std::find(stack_.begin(), stack_.end(), &callee) != stack_.end())
+					return nullptr;
+
+				ASTNode * const expr = returned_expression(callee);
+				if (!expr || expression_type(expr) != callee.return_type())
+					return nullptr;
+
+				bool const hot = callee.calls() >= options_.hot_calls() || call.calls() >= options_.hot_calls();
+				std::size_t const budget = hot
+						? options_.hot_inline_budget()
+						: options_.inline_budget();
+				if (count_nodes(*expr) > budget)
+					return nullptr;
+
+				InlineAnalysis analysis(callee, globals_);
+				expr->visit(analysis);
+				if (!analysis.valid())
+					return nullptr;
+
+				/*
+				 * an argument with side effects must be evaluated exactly once
+				 * and in the same order relative to every other effect; one
+				 * that reads variables the body may write is bound to a
+				 * temporary before the body runs
+				 */
+				std::size_t impure = 0;
+				bool reads = false;
+				Cloner::ArgumentsType args;
+				for (std::size_t index = 0; index != call.parameters_number(); ++index)
+				{
+					ASTNode * const arg = call.at(index);
+					if (expression_type(arg) != callee.type_at(index))
+						return nullptr;
+
+					if (!is_pure(arg))
+					{
+						if (++impure > 1 || !analysis.pure())
+							return nullptr;
+						if (analysis.uses(index) != 1 || analysis.conditional(index))
+							return nullptr;
+					}
+					else if (reads_variables(arg))
+						reads = true;
+
+					Variable const * const param = callee.body()->owner()->lookup_variable(callee.name_at(index));
+					assert(param);
+					args[param] = arg;
+				}
+
+				/* the body may read another argument before the impure one runs */
+				if (impure && reads)
+					return nullptr;
+
+				std::vector<std::pair<Variable *, ASTNode *> > bound;
+				std::vector<std::unique_ptr<LoadNode> > temporaries;
+				if (reads && !analysis.pure())
+					for (std::size_t index = 0; index != call.parameters_number(); ++index)
+					{
+						ASTNode * const arg = call.at(index);
+						if (!reads_variables(arg))
+							continue;
+
+						Variable * const var = temporary(callee.type_at(index), arg->start());
+						bound.push_back(std::make_pair(var, arg));
+						temporaries.push_back(std::unique_ptr<LoadNode>(new LoadNode(var, arg->start(), arg->finish())));
+						Variable const * const param = callee.body()->owner()->lookup_variable(callee.name_at(index));
+						args[param] = temporaries.back().get();
+					}
+
+				std::unique_ptr<ASTNode> inlined = Cloner(std::move(args)).clone(expr);
+				while (!bound.empty())
+				{
+					std::unique_ptr<ASTNode> init = Cloner(Cloner::ArgumentsType()).clone(bound.back().second);
+					inlined.reset(new LetNode(bound.back().first, std::move(init), std::move(inlined),
+								call.start(), call.finish()));
+					bound.pop_back();
+				}
+				return inlined;
+			}
+
+			/* a local of the caller no name of the source can clash with */
+			Variable * temporary(Type type, Location const & location)
+			{
+				/* the top level code has no parameters, its variables are the globals */
+				Block * const body = caller_.body();
+				Scope * const scope = body->owner() ? body->owner() : body->scope();
+				std::string name;
+				for (std::size_t index = 0; name.empty() || scope->lookup_variable(name); ++index)
+					name = "$" + std::to_string(index);
+
+				std::unique_ptr<Variable> var(new Variable(type, name, location, location));
+				Variable * const result = var.get();
+				scope->define_variable(std::move(var));
+				return result;
+			}
+		};
+
+	}
+
+	Type expression_type(ASTNode * node) noexcept
+	{
+		detail::TypeOf type;
+		node->visit(type);
+		return type.type();
+	}
+
+	std::unique_ptr<ASTNode> fold_literals(std::unique_ptr<ASTNode> node)
+	{
+		std::unique_ptr<ASTNode> folded;
+		if (BinaryExprNode * const binary = dynamic_cast<BinaryExprNode *>(node.get()))
+			folded = detail::fold(*binary);
+		else if (UnaryExprNode * const unary = dynamic_cast<UnaryExprNode *>(node.get()))
+			folded = detail::fold(*unary);
+
+		return folded ? std::move(folded) : std::move(node);
+	}
+
+	std::size_t count_nodes(ASTNode & node)
+	{
+		detail::NodeCounter counter;
+		node.visit(counter);
+		return counter.count();
+	}
+
+	Optimizer::Optimizer() noexcept
+		: inline_budget_(default_inline_budget)
+		, hot_inline_budget_(default_hot_inline_budget)
+		, hot_calls_(default_hot_calls)
+		, fast_math_(false)
+	{ }
+
+	std::size_t Optimizer::inline_budget() const noexcept
+	{ return inline_budget_; }
+
+	void Optimizer::set_inline_budget(std::size_t nodes) noexcept
+	{ inline_budget_ = nodes; }
+
+	std::size_t Optimizer::hot_inline_budget() const noexcept
+	{ return hot_inline_budget_; }
+
+	void Optimizer::set_hot_inline_budget(std::size_t nodes) noexcept
+	{ hot_inline_budget_ = nodes; }
+
+	std::uint64_t Optimizer::hot_calls() const noexcept
+	{ return hot_calls_; }
+
+	void Optimizer::set_hot_calls(std::uint64_t calls) noexcept
+	{ hot_calls_ = calls; }
+
+	bool Optimizer::fast_math() const noexcept
+	{ return fast_math_; }
+
+	void Optimizer::set_fast_math(bool enable) noexcept
+	{ fast_math_ = enable; }
+
+	bool Optimizer::fold_constants(Function & function)
+	{
+		detail::ConstantFolder folder;
+		function.body()->transform_children(folder);
+		return folder.changed();
+	}
+
+	bool Optimizer::eliminate_dead_code(Function & function)
+	{
+		detail::DeadBranches branches;
+		function.body()->transform_children(branches);
+
+		detail::UnreachableCode unreachable;
+		function.body()->visit(unreachable);
+
+		return branches.changed() || unreachable.changed();
+	}
+
+	bool Optimizer::inline_calls(Function & function, Scope const * globals)
+	{
+		detail::Inliner inliner(*this, function, globals);
+		function.body()->transform_children(inliner);
+		return inliner.changed();
+	}
+
+	void Optimizer::lower_loops(Function & function)
+	{
+		detail::LoopLowering lowering;
+		function.body()->visit(lowering);
+	}
+
+	void Optimizer::vectorize_loops(Function & function)
+	{
+		detail::LoopVectorizer vectorizer(fast_math());
+		function.body()->visit(vectorizer);
+	}
+
+	void Optimizer::optimize(Program & program)
+	{
+		VM_STATS_PHASE(optimize);
+		std::vector<Function *> functions = program.functions();
+		functions.erase(std::remove_if(functions.begin(), functions.end(),
+							[](Function * fun) { return fun->native() != nullptr; }),
+						functions.end());
+
+		for (Function * fun : functions)
+		{
+			fold_constants(*fun);
+			eliminate_dead_code(*fun);
+		}
+
+		for (Function * fun : functions)
+		{
+			if (!inline_calls(*fun, program.scope()))
+				continue;
+
+			fold_constants(*fun);
+			eliminate_dead_code(*fun);
+		}
+
+		for (Function * fun : functions)
+		{
+			lower_loops(*fun);
+			vectorize_loops(*fun);
+		}
+	}
+
+}
@@ -1,14 +1,19 @@
-#include <cstdlib>
+#include <algorithm>
 #include <memory>
 
+#include <optimizer.hpp>
 #include <parser.hpp>
+#include <stats.hpp>
 
 namespace vm
 {
 
-	Program::Program(std::unique_ptr<Function> fun, std::unique_ptr<Scope> scope) noexcept
+	Program::Program(std::unique_ptr<Function> fun, std::unique_ptr<Scope> scope, LineTable lines,
+				std::shared_ptr<StringPool> strings) noexcept
 		: top_(fun.release())
 		, scope_(scope.release())
+		, lines_(std::move(lines))
+		, strings_(std::move(strings))
 	{ }
 
 	Program::~Program()
@@ -23,9 +28,175 @@ namespace vm
 	Function * Program::top_level() noexcept
 	{ return top_; }
 
+	Scope const * Program::scope() const noexcept
+	{ return scope_; }
+
+	Scope * Program::scope() noexcept
+	{ return scope_; }
+
+	namespace detail
+	{
+
+		static void collect_functions(Scope * scope, std::vector<Function *> & functions)
+		{
+			for (Scope::function_iterator it = scope->functions_begin(); it != scope->functions_end(); ++it)
+				functions.push_back(it->second);
+
+			for (Scope::child_iterator it = scope->children_begin(); it != scope->children_end(); ++it)
+				collect_functions(*it, functions);
+		}
+
+		/* the same, leaving out the sorted skipped functions with everything nested in them */
+		static void collect_functions(Scope * scope, std::vector<Function *> const & skipped,
+					std::vector<Scope *> const & skipped_scopes, std::vector<Function *> & functions)
+		{
+			for (Scope::function_iterator it = scope->functions_begin(); it != scope->functions_end(); ++it)
+				if (!std::binary_search(skipped.begin(), skipped.end(), it->second))
+					functions.push_back(it->second);
+
+			for (Scope::child_iterator it = scope->children_begin(); it != scope->children_end(); ++it)
+				if (!std::binary_search(skipped_scopes.begin(), skipped_scopes.end(), *it))
+					collect_functions(*it, skipped, skipped_scopes, functions);
+		}
+
+	}
+
+	std::vector<Function *> Program::functions()
+	{
+		std::vector<Function *> functions;
+
+		if (top_)
+			functions.push_back(top_);
+		if (scope_)
+			detail::collect_functions(scope_, functions);
+
+		return functions;
+	}
+
+	LineTable const & Program::lines() const noexcept
+	{ return lines_; }
+
+	std::shared_ptr<StringPool> const & Program::strings() const noexcept
+	{ return strings_; }
+
+	namespace detail
+	{
+
+		template <typename Action>
+		static void for_each_scope(Scope * scope, Action action)
+		{
+			action(*scope);
+			for (Scope::child_iterator it = scope->children_begin(); it != scope->children_end(); ++it)
+				for_each_scope(*it, action);
+		}
+
+		/* tells if a function uses variables declared outside of it */
+		class FunctionUses : public Visitor
+		{
+		public:
+			using Visitor::visit;
+
+			explicit FunctionUses(Scope * root) noexcept
+				: root_(root)
+				, closed_(true)
+			{ }
+
+			bool closed() const noexcept
+			{ return closed_; }
+
+			virtual void visit(LoadNode & node)
+			{ use(node.variable()); }
+
+			virtual void visit(StoreNode & node)
+			{
+				use(node.variable());
+				node.visit_children(*this);
+			}
+
+			virtual void visit(ForNode & node)
+			{
+				use(node.variable());
+				node.visit_children(*this);
+			}
+
+		private:
+			Scope * root_;
+			bool closed_;
+
+			void use(Variable const * var) noexcept
+			{
+				Scope const * scope = var->owner();
+				while (scope && scope != root_)
+					scope = scope->owner();
+				closed_ = closed_ && scope;
+			}
+		};
+
+		/* moves every location of a subtree by the same distance */
+		class Relocate : public Visitor
+		{
+		public:
+			explicit Relocate(std::ptrdiff_t delta) noexcept
+				: delta_(delta)
+			{ }
+
+			#define RELOCATE(n)						\
+				virtual void visit(n & node)		\
+				{									\
+					move(node);						\
+					node.visit_children(*this);		\
+				}
+			FOR_NODES(RELOCATE)
+			#undef RELOCATE
+
+			void move(LocatedInFile & located) const noexcept
+			{
+				located.set_start(shift(located.start()));
+				located.set_finish(shift(located.finish()));
+			}
+
+		private:
+			std::ptrdiff_t delta_;
+
+			Location shift(Location const & loc) const noexcept
+			{
+				if (!loc.is_reachable())
+					return loc;
+				return Location(static_cast<std::uint32_t>(loc.position() + delta_));
+			}
+		};
+
+		static bool starts_statement(Token::Kind kind) noexcept
+		{
+			switch (kind)
+			{
+			case Token::if_kw:
+			case Token::for_kw:
+			case Token::while_kw:
+			case Token::print_kw:
+			case Token::return_kw:
+			case Token::function_kw:
+			case Token::int_t:
+			case Token::double_t:
+			case Token::string_t:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		static bool precedes(Status const & left, Status const & right) noexcept
+		{ return left.location().position() < right.location().position(); }
+
+	}
 
 	Parser::Parser()
 		: scope_(nullptr)
+		, status_(nullptr)
+		, diagnostics_(nullptr)
+		, depth_(0)
+		, program_(nullptr)
+		, reuse_(nullptr)
 	{ }
 
 	Parser::~Parser()
@@ -37,6 +208,68 @@ namespace vm
 	bool Parser::is_ok() const noexcept
 	{ return status_->code() != Status::ERROR; }
 
+	Parser::Checkpoint Parser::checkpoint() const noexcept
+	{
+		Checkpoint const point = { pos_, calls_.size(), scope_ };
+		return point;
+	}
+
+	bool Parser::collect()
+	{
+		if (!diagnostics_)
+			return false;
+
+		/* a construct failing at the end of a file fails every enclosing one there too */
+		if (diagnostics_->empty() || diagnostics_->back().location().position() != status_->location().position())
+			diagnostics_->push_back(*status_);
+		Status().swap(*status_);
+		return true;
+	}
+
+	bool Parser::recover(Checkpoint const & from)
+	{
+		if (!collect())
+			return false;
+
+		/* calls and scopes of the dropped statement must not outlive it */
+		calls_.resize(from.calls);
+		scope_ = from.scope;
+		depth_ = 0;
+
+		if (pos_ == from.pos && peek_token() != Token::eof)
+			consume_token();
+		synchronize();
+		return true;
+	}
+
+	void Parser::synchronize() noexcept
+	{
+		std::size_t nesting = 0;
+		while (peek_token() != Token::eof)
+		{
+			Token::Kind const tok = peek_token();
+			if (!nesting)
+			{
+				if (tok == Token::semi)
+				{
+					consume_token();
+					return;
+				}
+
+				if (tok == Token::rbrace || detail::starts_statement(tok))
+					return;
+			}
+
+			consume_token();
+
+			/* a skipped block is skipped as a whole, with its else branch */
+			if (tok == Token::lbrace)
+				++nesting;
+			else if (tok == Token::rbrace && !--nesting && peek_token() != Token::else_kw)
+				return;
+		}
+	}
+
 	std::unique_ptr<Program> Parser::parse(std::string const & code)
 	{
 		Status status;
@@ -44,33 +277,261 @@ namespace vm
 	}
 
 	std::unique_ptr<Program> Parser::parse(std::string const & code, Status & status)
+	{ return parse_program(code, status, nullptr); }
+
+	std::unique_ptr<Program> Parser::parse(std::string const & code, Status & status, DiagnosticsType & diagnostics)
+	{
+		diagnostics.clear();
+		std::unique_ptr<Program> program = parse_program(code, status, &diagnostics);
+
+		/* calls are resolved after the whole source is parsed */
+		std::stable_sort(diagnostics.begin(), diagnostics.end(), detail::precedes);
+		if (!diagnostics.empty())
+			Status(diagnostics.front()).swap(status);
+		return program;
+	}
+
+	std::unique_ptr<Program> Parser::parse_program(std::string const & code, Status & status, DiagnosticsType * diagnostics)
 	{
 		clear();
-		if (Scanner().scan(code, tokens_, status) == Status::ERROR)
+		{
+			VM_STATS_PHASE(scan);
+			if (Scanner().scan(code, tokens_, status) == Status::ERROR)
+			{
+				if (diagnostics)
+					diagnostics->push_back(status);
+				return nullptr;
+			}
+			VM_STATS_COUNT(scan, tokens, tokens_.size());
+		}
+		code_ = code;
+		strings_ = std::make_shared<StringPool>();
+		return parse_tokens(status, diagnostics);
+	}
+
+	std::unique_ptr<Program> Parser::reparse(std::unique_ptr<Program> previous, Edit const & edit,
+				Status & status, Changes & changes)
+	{
+		changes.parsed.clear();
+		changes.dropped.clear();
+
+		if (!previous || previous.get() != program_)
+		{
+			Status(Status::ERROR, "the program is not the last one parsed").swap(status);
+			return nullptr;
+		}
+
+		if (edit.offset > code_.size() || edit.length > code_.size() - edit.offset)
+		{
+			Status(Status::ERROR, "the edit is out of the source").swap(status);
 			return nullptr;
+		}
+
+		std::string code = edit.apply(code_);
+		TokenList tokens(std::move(tokens_));
+		Reuse reuse;
+		reuse.previous = previous.get();
+		reuse.delta = static_cast<std::ptrdiff_t>(edit.text.size()) - static_cast<std::ptrdiff_t>(edit.length);
+		reuse.spans.swap(spans_);
+		reuse.next = 0;
+
+		clear();
+		{
+			VM_STATS_PHASE(scan);
+			if (Scanner().rescan(code, edit, tokens, reuse.splice, status) == Status::ERROR)
+				return nullptr;
+			tokens_ = std::move(tokens);
+			VM_STATS_COUNT(scan, tokens, reuse.splice.new_end - reuse.splice.first);
+		}
+		code_.swap(code);
+		/* the literals of the reused functions are in the pool of the previous program */
+		strings_ = previous->strings();
+
+		reuse_ = &reuse;
+		std::unique_ptr<Program> program = parse_tokens(status, nullptr);
+		reuse_ = nullptr;
+
+		/* reused functions were taken out of previous, the rest of it is gone */
+		std::vector<Function *> const dropped = previous->functions();
+		changes.dropped.assign(dropped.begin(), dropped.end());
+		previous.reset();
+
+		std::vector<Scope *> scopes;
+		scopes.reserve(reuse.reused.size());
+		for (Function * fun : reuse.reused)
+			scopes.push_back(fun->body()->owner());
+		std::sort(reuse.reused.begin(), reuse.reused.end());
+		std::sort(scopes.begin(), scopes.end());
+
+		if (program->top_level())
+			changes.parsed.push_back(program->top_level());
+		detail::collect_functions(program->scope(), reuse.reused, scopes, changes.parsed);
+
+		return program;
+	}
+
+	std::unique_ptr<Program> Parser::parse_tokens(Status & status, DiagnosticsType * diagnostics)
+	{
 		status_ = &status;
+		diagnostics_ = diagnostics;
+		end_ = Location(static_cast<std::uint32_t>(code_.size()));
+
+		VM_STATS_PHASE(parse);
 
 		push_scope();
 		std::unique_ptr<Scope> top_scope(scope());
 		std::unique_ptr<Function> top(parse_toplevel());
+		if (is_ok())
+			resolve_calls();
+		if (!is_ok())
+			collect();
 		pop_scope();
 
-		return std::unique_ptr<Program>(new Program(std::move(top), std::move(top_scope)));
+		std::unique_ptr<Program> program(new Program(std::move(top), std::move(top_scope), tokens_.lines(), strings_));
+		program_ = program.get();
+		return program;
 	}
 
+	LineTable const & Parser::lines() const noexcept
+	{ return tokens_.lines(); }
+
 	void Parser::clear() noexcept
 	{
 		scope_ = nullptr;
 		status_ = nullptr;
+		diagnostics_ = nullptr;
 		tokens_.clear();
+		calls_.clear();
 		pos_ = 0;
+		depth_ = 0;
+		end_ = Location();
+		code_.clear();
+		program_ = nullptr;
+		spans_.clear();
+		strings_.reset();
+	}
+
+	bool Parser::reuse_function()
+	{
+		if (!reuse_)
+			return false;
+
+		/* index of the current token before the edit, unless the edit touched it */
+		Splice const & splice = reuse_->splice;
+		std::size_t old;
+		if (pos_ < splice.first)
+			old = pos_;
+		else if (pos_ >= splice.new_end)
+			old = pos_ - splice.new_end + splice.old_end;
+		else
+			return false;
+
+		SpansType const & spans = reuse_->spans;
+		while (reuse_->next != spans.size() && spans[reuse_->next].first < old)
+			++reuse_->next;
+		if (reuse_->next == spans.size() || spans[reuse_->next].first != old)
+			return false;
+
+		Span & span = reuse_->spans[reuse_->next];
+		if (old < splice.first && span.end > splice.first)
+			return false;
+
+		/* a later function of the same name took its place */
+		Function * const fun = span.function;
+		Scope * const top = reuse_->previous->scope();
+		if (top->lookup_function(fun->name()) != fun)
+			return false;
+
+		/* the rest of the program is parsed anew, so nothing outside may be used */
+		Scope * const params = fun->body()->owner();
+		if (span.state == Span::unknown)
+		{
+			detail::FunctionUses uses(params);
+			fun->body()->visit(uses);
+			detail::for_each_scope(params, [&uses](Scope & scope) {
+				for (Scope::function_iterator it = scope.functions_begin(); it != scope.functions_end(); ++it)
+					it->second->body()->visit(uses);
+			});
+			span.state = uses.closed() ? Span::closed : Span::open;
+		}
+		if (span.state == Span::open)
+			return false;
+
+		if (old >= splice.old_end && reuse_->delta)
+		{
+			detail::Relocate relocate(reuse_->delta);
+			relocate.move(*fun);
+			fun->body()->visit(relocate);
+			detail::for_each_scope(params, [&relocate](Scope & scope) {
+				for (Scope::variable_iterator it = scope.variables_begin(); it != scope.variables_end(); ++it)
+					relocate.move(*it->second);
+				for (Scope::function_iterator it = scope.functions_begin(); it != scope.functions_end(); ++it)
+				{
+					relocate.move(*it->second);
+					it->second->body()->visit(relocate);
+				}
+			});
+		}
+
+		std::unique_ptr<Function> moved = top->release_function(fun);
+		params->set_owner(scope());
+		scope()->define_function(std::move(moved));
+		calls_.insert(calls_.end(), span.calls.begin(), span.calls.end());
+		reuse_->reused.push_back(fun);
+
+		std::size_t const length = span.end - span.first;
+		Span reused = { fun, pos_, pos_ + length, std::move(span.calls), span.state };
+		spans_.push_back(std::move(reused));
+		++reuse_->next;
+		consume_token(length);
+		return true;
+	}
+
+	void Parser::resolve_calls()
+	{
+		for (CallSitesType::value_type const & site : calls_)
+		{
+			CallNode * const call = site.first;
+			Function * const fun = site.second->lookup_function(call->name());
+			if (!fun)
+			{
+				error("undefined function " + call->name(), call->start());
+				if (!collect())
+					return;
+				continue;
+			}
+
+			if (fun->parameters_number() != call->parameters_number())
+			{
+				error("wrong number of arguments to " + call->name(), call->start());
+				if (!collect())
+					return;
+				continue;
+			}
+
+			call->set_function(fun);
+		}
+		calls_.clear();
 	}
 
 	Token::Kind Parser::peek_token(std::size_t offset) const noexcept
 	{ return tokens_.at(pos_ + offset).kind(); }
 
 	Location Parser::location() const noexcept
-	{ return tokens_.at(pos_).location(); }
+	{
+		/* the end of file token has no place in the source, errors there point past its end */
+		if (pos_ >= tokens_.size())
+			return end_;
+		return tokens_.at(pos_).location();
+	}
+
+	/* where an error at an extracted token points, past the end for the end of file */
+	Location Parser::location(Token const & tok) const noexcept
+	{
+		if (tok.kind() == Token::eof || tok.kind() == Token::undef)
+			return end_;
+		return tok.location();
+	}
 
 	Token Parser::extract_token()
 	{
@@ -79,8 +540,9 @@ namespace vm
 		return tok;
 	}
 
+	/* stops at the end of file token, which stays the next one from then on */
 	void Parser::consume_token(std::size_t count) noexcept
-	{ pos_ += count; }
+	{ pos_ = std::min(pos_ + count, tokens_.size()); }
 
 	bool Parser::ensure_token(Token::Kind kind)
 	{
@@ -112,9 +574,34 @@ namespace vm
 			if (ensure_token(Token::semi))
 				continue;
 
+			Checkpoint const from = checkpoint();
+			if (peek_token() == Token::function_kw)
+			{
+				if (reuse_function())
+					continue;
+
+				std::unique_ptr<Function> fun = parse_function();
+				if (!fun)
+				{
+					if (!recover(from))
+						return nullptr;
+					continue;
+				}
+
+				Span span = { fun.get(), from.pos, pos_,
+					CallSitesType(calls_.begin() + from.calls, calls_.end()), Span::unknown };
+				spans_.push_back(std::move(span));
+				scope()->define_function(std::move(fun));
+				continue;
+			}
+
 			std::unique_ptr<ASTNode> node = parse_statement();
 			if (!is_ok())
-				return nullptr;
+			{
+				if (!recover(from))
+					return nullptr;
+				continue;
+			}
 
 			if (node)
 				body->push_back(std::move(node));
@@ -127,20 +614,30 @@ namespace vm
 
 	std::unique_ptr<Block> Parser::parse_block()
 	{
-		push_scope();	
-		assert(ensure_token(Token::lbrace));
+		if (!ensure_token(Token::lbrace))
+		{
+			error("{ expected", location());
+			return nullptr;
+		}
+
+		push_scope();
 
 		std::unique_ptr<Block> blk(new Block(scope()));
-		while (peek_token() != Token::rbrace)
+		while (peek_token() != Token::rbrace && peek_token() != Token::eof)
 		{
 			if (ensure_token(Token::semi))
 				continue;
 
+			Checkpoint const from = checkpoint();
 			if (peek_token() == Token::function_kw)
 			{
 				std::unique_ptr<Function> fun = parse_function();
 				if (!fun)
-					return nullptr;
+				{
+					if (!recover(from))
+						return nullptr;
+					continue;
+				}
 
 				scope()->define_function(std::move(fun));
 				continue;
@@ -148,7 +645,11 @@ namespace vm
 
 			std::unique_ptr<ASTNode> stmt = parse_statement();
 			if (!is_ok())
-				return nullptr;
+			{
+				if (!recover(from))
+					return nullptr;
+				continue;
+			}
 
 			if (stmt)
 				blk->push_back(std::move(stmt));
@@ -221,7 +722,8 @@ namespace vm
 		if (!expr)
 			return nullptr;
 
-		return std::unique_ptr<StoreNode>(new StoreNode(variable, std::move(expr), op.kind(), var.location(), expr->finish()));
+		Location const finish = expr->finish();
+		return std::unique_ptr<StoreNode>(new StoreNode(variable, std::move(expr), op.kind(), var.location(), finish));
 	}
 
 	std::unique_ptr<CallNode> Parser::parse_call()
@@ -251,6 +753,7 @@ namespace vm
 			}
 		}
 		call->set_finish(location());
+		calls_.push_back(std::make_pair(call.get(), scope()));
 
 		return call;
 	}
@@ -278,14 +781,14 @@ namespace vm
 		Token const tp = extract_token();
 		if (!Token::is_typename(tp.kind()))
 		{
-			error("type expected", tp.location());
+			error("type expected", location(tp));
 			return nullptr;
 		}
 
 		Token const nm = extract_token();
 		if (nm.kind() != Token::ident)
 		{
-			error("identifier expected", nm.location());
+			error("identifier expected", location(nm));
 			return nullptr;
 		}
 
@@ -301,14 +804,14 @@ namespace vm
 			Token const param_type = extract_token();
 			if (!Token::is_typename(param_type.kind()))
 			{
-				error("typename or ) expected", param_type.location());
+				error("typename or ) expected", location(param_type));
 				return nullptr;
 			}
 
 			Token const param_name = extract_token();
 			if (param_name.kind() != Token::ident)
 			{
-				error("identifier or ) expected", param_name.location());
+				error("identifier or ) expected", location(param_name));
 				return nullptr;
 			}
 
@@ -336,13 +839,45 @@ namespace vm
 			std::unique_ptr<Variable> var(new Variable(it->first, it->second, tp.location(), location()));
 			scope()->define_variable(std::move(var));
 		}
-		std::unique_ptr<Block> body = parse_block();
+
+		std::unique_ptr<Block> body;
+		if (ensure_token(Token::native_kw))
+			body = parse_native(*sign);
+		else
+			body = parse_block();
+
+		pop_scope();
 		if (!body)
 			return nullptr;
 
+		return std::unique_ptr<Function>(new Function(std::move(sign), std::move(body), tp.location(), location()));
+	}
+
+	std::unique_ptr<Block> Parser::parse_native(Signature const & sign)
+	{
+		Token const sym = extract_token();
+		if (sym.kind() != Token::string_l)
+		{
+			error("native symbol name expected", location(sym));
+			return nullptr;
+		}
+
+		if (!ensure_token(Token::semi))
+		{
+			error("; expected", location());
+			return nullptr;
+		}
+
+		/* the stub body gets its own scope, like any other function body */
+		push_scope();
+
+		std::unique_ptr<Signature> native(new Signature(sign));
+		std::unique_ptr<Block> body(new Block(scope(), sym.location(), sym.location()));
+		body->push_back(std::unique_ptr<ASTNode>(new NativeCallNode(sym.value(), std::move(native), sym.location(), sym.location())));
+
 		pop_scope();
 
-		return std::unique_ptr<Function>(new Function(std::move(sign), std::move(body), tp.location(), location()));
+		return body;
 	}
 
 	std::unique_ptr<WhileNode> Parser::parse_while()
@@ -386,10 +921,17 @@ namespace vm
 			return nullptr;
 		}
 
+		Token const tp = Token::is_typename(peek_token()) ? extract_token() : Token(Token::undef);
+		if (tp.kind() == Token::void_t)
+		{
+			error("variable type expected", location(tp));
+			return nullptr;
+		}
+
 		Token const var = extract_token();
 		if (var.kind() != Token::ident)
 		{
-			error("identifier expected", var.location());
+			error("identifier expected", location(var));
 			return nullptr;
 		}
 
@@ -409,17 +951,27 @@ namespace vm
 			return nullptr;
 		}
 
-		std::unique_ptr<Block> body = parse_block();
-		if (!body)
-			return nullptr;
+		push_scope();
+
+		if (tp.kind() != Token::undef)
+		{
+			std::unique_ptr<Variable> decl(new Variable(detail::token_to_type(tp.kind()), var.value(), var.location(), var.location()));
+			scope()->define_variable(std::move(decl));
+		}
 
 		Variable * const v = scope()->lookup_variable(var.value());
 		if (!v)
 		{
-			error("unknown variable" + var.value(), var.location());
+			error("unknown variable " + var.value(), var.location());
+			pop_scope();
 			return nullptr;
 		}
 
+		std::unique_ptr<Block> body = parse_block();
+		pop_scope();
+		if (!body)
+			return nullptr;
+
 		return std::unique_ptr<ForNode>(new ForNode(v, std::move(expr), std::move(body), start, location()));
 	}
 
@@ -480,7 +1032,7 @@ namespace vm
 	{
 		Location const loc = location();
 
-		assert(ensure_token(Token::return_kw));
+		assert(ensure_token(Token::print_kw));
 
 		if (!ensure_token(Token::lparen))
 		{
@@ -514,7 +1066,7 @@ namespace vm
 		Token const name = extract_token();
 		if (name.kind() != Token::ident)
 		{
-			error("identifier expected", name.location());
+			error("identifier expected", location(name));
 			return nullptr;
 		}
 
@@ -534,32 +1086,51 @@ namespace vm
 	}
 
 	std::unique_ptr<ASTNode> Parser::parse_expression()
-	{ return parse_binary(); }
+	{
+		if (depth_ == max_expression_depth)
+		{
+			error("expression is nested too deeply", location());
+			return nullptr;
+		}
 
-	std::unique_ptr<ASTNode> Parser::parse_binary(int prev)
+		++depth_;
+		std::unique_ptr<ASTNode> expr = parse_binary();
+		--depth_;
+
+		return expr;
+	}
+
+	static_assert(Token::binding_power(Token::mul) > Token::binding_power(Token::add), "* binds tighter than +");
+	static_assert(Token::binding_power(Token::land) > Token::binding_power(Token::lor), "&& binds tighter than ||");
+	static_assert(Token::binding_power(Token::assign) == 0, "assignment is not an expression operator");
+
+	/*
+	 * precedence climbing: a chain of operators of equal power is folded
+	 * to the left by the loop, the right operand only recurses into
+	 * strictly stronger operators, so the depth is bounded by the number
+	 * of precedence levels, not by the length of the expression; operators
+	 * applied to literals are folded as soon as they are built
+	 */
+	std::unique_ptr<ASTNode> Parser::parse_binary(int power)
 	{
 		std::unique_ptr<ASTNode> left = parse_unary();
 		if (!left)
 			return nullptr;
 
-		int prec = Token::get_precedence(peek_token());
-		if (prec <= 0)
+		for (;;)
 		{
-			error("operator expected", location());
-			return nullptr;
-		}
+			Token::Kind const kind = peek_token();
+			int const binding = Token::binding_power(kind);
+			if (binding < power)
+				break;
 
-		while (prec >= prev)
-		{
-			while (Token::get_precedence(peek_token()) == prec)
-			{
-				Token const op = extract_token();
-				std::unique_ptr<ASTNode> right = parse_binary();
-				if (!right)
-					return nullptr;
-				left.reset(new BinaryExprNode(op.kind(), std::move(left), std::move(right), left->start(), right->finish()));
-			}
-			prec = Token::get_precedence(peek_token());
+			consume_token();
+			std::unique_ptr<ASTNode> right = parse_binary(binding + 1);
+			if (!right)
+				return nullptr;
+
+			Location const start = left->start(), finish = right->finish();
+			left = fold_literals(std::unique_ptr<ASTNode>(new BinaryExprNode(kind, std::move(left), std::move(right), start, finish)));
 		}
 
 		return left;
@@ -575,15 +1146,29 @@ namespace vm
 
 	std::unique_ptr<ASTNode> Parser::parse_unary()
 	{
-		if (detail::is_unary(peek_token()))
+		if (!detail::is_unary(peek_token()))
+			return parse_primary();
+
+		/* prefix operators are applied innermost first, without recursion */
+		std::vector<Token> prefix;
+		while (detail::is_unary(peek_token()))
+			prefix.push_back(extract_token());
+
+		std::unique_ptr<ASTNode> expr = parse_primary();
+		if (!expr)
+			return nullptr;
+
+		for (std::vector<Token>::const_reverse_iterator it = prefix.rbegin(); it != prefix.rend(); ++it)
 		{
-			Token const op = extract_token();
-			std::unique_ptr<ASTNode> expr = parse_unary();
-			if (!expr)
-				return nullptr;
-			return std::unique_ptr<ASTNode>(new UnaryExprNode(op.kind(), std::move(expr), op.location(), expr->finish()));
+			Location const finish = expr->finish();
+			expr = fold_literals(std::unique_ptr<ASTNode>(new UnaryExprNode(it->kind(), std::move(expr), it->location(), finish)));
 		}
 
+		return expr;
+	}
+
+	std::unique_ptr<ASTNode> Parser::parse_primary()
+	{
 		if (peek_token() == Token::ident && peek_token(1) == Token::lparen)
 			return parse_call();
 
@@ -607,8 +1192,9 @@ namespace vm
 
 		if (peek_token() == Token::string_l)
 		{
-			Token const tok = extract_token();
-			return std::unique_ptr<ASTNode>(new StringLitNode(tok.value(), tok.location(), tok.location()));
+			Token const & tok = tokens_.at(pos_);
+			consume_token();
+			return std::unique_ptr<ASTNode>(new StringLitNode(strings_->intern(tok.value()), tok.location(), tok.location()));
 		}
 
 		if (ensure_token(Token::lparen))
@@ -632,38 +1218,20 @@ namespace vm
 
 	std::unique_ptr<ASTNode> Parser::parse_int()
 	{
-		Token const tok = extract_token();
+		Token const & tok = tokens_.at(pos_);
 		assert(tok.kind() == Token::int_l);
+		consume_token();
 
-		std::string const & value = tok.value();
-		char * endptr = nullptr;
-
-		long int num = strtol(value.c_str(), &endptr, 10);
-		if (endptr == nullptr || *endptr != '\0')
-		{
-			error("integer literal expected", tok.location());
-			return nullptr;
-		}
-
-		return std::unique_ptr<ASTNode>(new IntLitNode(num, tok.location(), tok.location()));
+		return std::unique_ptr<ASTNode>(new IntLitNode(tok.literal().as_int, tok.location(), tok.location()));
 	}
 
 	std::unique_ptr<ASTNode> Parser::parse_double()
 	{
-		Token const tok = extract_token();
+		Token const & tok = tokens_.at(pos_);
 		assert(tok.kind() == Token::double_l);
+		consume_token();
 
-		std::string const & value = tok.value();
-		char * endptr = nullptr;
-
-		double num = strtod(value.c_str(), &endptr);
-		if (endptr == nullptr || *endptr != '\0')
-		{
-			error("double literal expected", tok.location());
-			return nullptr;
-		}
-
-		return std::unique_ptr<ASTNode>(new DoubleLitNode(num, tok.location(), tok.location()));
+		return std::unique_ptr<ASTNode>(new DoubleLitNode(tok.literal().as_double, tok.location(), tok.location()));
 	}
 
 }
@@ -0,0 +1,164 @@
+#include <limits>
+#include <vector>
+
+#include <peephole.hpp>
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		/* the int jump taken when the comparison holds, or when it fails */
+		static Opcode::Kind compare_jump(Opcode::Kind compare, bool holds) noexcept
+		{
+			switch (compare)
+			{
+			default: return Opcode::nop;
+			case Opcode::ieq: return holds ? Opcode::jieq : Opcode::jine;
+			case Opcode::ine: return holds ? Opcode::jine : Opcode::jieq;
+			case Opcode::ilt: return holds ? Opcode::jilt : Opcode::jige;
+			case Opcode::ile: return holds ? Opcode::jile : Opcode::jigt;
+			case Opcode::igt: return holds ? Opcode::jigt : Opcode::jile;
+			case Opcode::ige: return holds ? Opcode::jige : Opcode::jilt;
+			}
+		}
+
+		/* the double operation with an int right operand */
+		static Opcode::Kind mixed(Opcode::Kind operation) noexcept
+		{
+			switch (operation)
+			{
+			default: return Opcode::nop;
+			case Opcode::dadd: return Opcode::diadd;
+			case Opcode::dsub: return Opcode::disub;
+			case Opcode::dmul: return Opcode::dimul;
+			case Opcode::ddiv: return Opcode::didiv;
+			}
+		}
+
+		static bool is_add(Instruction const * insn) noexcept
+		{ return insn && (insn->opcode == Opcode::iadd || insn->opcode == Opcode::isub); }
+
+		/*
+		 * the superinstruction first and second fuse into, nop if none;
+		 * third follows them unless it is a jump target
+		 */
+		static Instruction fuse(Instruction const & first, Instruction const & second, Instruction const * third) noexcept
+		{
+			Instruction fused = { Opcode::nop, 0 };
+			switch (first.opcode)
+			{
+			default:
+				if (second.opcode == Opcode::jz || second.opcode == Opcode::jnz)
+				{
+					fused.opcode = compare_jump(first.opcode, second.opcode == Opcode::jnz);
+					fused.arg = second.arg;
+				}
+				break;
+
+			case Opcode::load:
+				if (second.opcode == Opcode::load && Instruction::fits(first.arg, second.arg))
+				{
+					fused.opcode = Opcode::load2;
+					fused.arg = Instruction::pack(first.arg, second.arg);
+				}
+				/* the constant is better off as the argument of an iaddi */
+				else if (second.opcode == Opcode::ipush && !is_add(third) && Instruction::fits(first.arg, second.arg))
+				{
+					fused.opcode = Opcode::loadi;
+					fused.arg = Instruction::pack(first.arg, second.arg);
+				}
+				break;
+
+			case Opcode::i2d:
+				fused.opcode = mixed(second.opcode);
+				break;
+
+			case Opcode::ipush:
+				if (second.opcode == Opcode::iadd)
+				{
+					fused.opcode = Opcode::iaddi;
+					fused.arg = first.arg;
+				}
+				else if (second.opcode == Opcode::isub && first.arg != std::numeric_limits<std::int32_t>::min())
+				{
+					fused.opcode = Opcode::iaddi;
+					fused.arg = -first.arg;
+				}
+				break;
+			}
+			return fused;
+		}
+
+		/* where a jump to target ends up through the unconditional jumps it meets */
+		static std::int32_t thread(Code::InstructionsType const & code, std::int32_t target) noexcept
+		{
+			/* a loop made of jumps alone keeps whatever target it reached */
+			for (std::size_t hops = 0; hops != code.size(); ++hops)
+			{
+				std::size_t const index = static_cast<std::size_t>(target);
+				if (index >= code.size() || code[index].opcode != Opcode::jmp)
+					break;
+				target = code[index].arg;
+			}
+			return target;
+		}
+
+	}
+
+	void peephole(Code & code)
+	{
+		std::size_t const size = code.size();
+		Code::InstructionsType insns(code.instructions(), code.instructions() + size);
+
+		std::vector<bool> targets(size + 1, false);
+		for (Instruction & insn : insns)
+			if (Opcode::is_jump(insn.opcode))
+			{
+				insn.arg = detail::thread(insns, insn.arg);
+				targets[insn.arg] = true;
+			}
+
+		/* moved maps the old index of an instruction to its new one */
+		Code::InstructionsType fused;
+		std::vector<Location> locations;
+		std::vector<std::int32_t> moved(size + 1);
+		fused.reserve(size);
+		locations.reserve(size);
+		for (std::size_t index = 0; index != size; ++index)
+		{
+			Instruction const & insn = insns[index];
+			moved[index] = static_cast<std::int32_t>(fused.size());
+
+			if (insn.opcode == Opcode::jmp && static_cast<std::size_t>(insn.arg) == index + 1)
+				continue;
+
+			if (index + 1 != size && !targets[index + 1])
+			{
+				Instruction const * const third = (index + 2 < size && !targets[index + 2]) ? &insns[index + 2] : nullptr;
+				Instruction const pair = detail::fuse(insn, insns[index + 1], third);
+				if (pair.opcode != Opcode::nop)
+				{
+					/* a fused jump keeps the location of the jump, the profile looks it up */
+					fused.push_back(pair);
+					locations.push_back(code.location_at(Opcode::is_jump(pair.opcode) ? index + 1 : index));
+					moved[index + 1] = moved[index];
+					++index;
+					continue;
+				}
+			}
+
+			fused.push_back(insn);
+			locations.push_back(code.location_at(index));
+		}
+		moved[size] = static_cast<std::int32_t>(fused.size());
+
+		for (Instruction & insn : fused)
+			if (Opcode::is_jump(insn.opcode))
+				insn.arg = moved[insn.arg];
+
+		code.rewrite(std::move(fused), std::move(locations));
+	}
+
+}
@@ -0,0 +1,208 @@
+#include <cinttypes>
+#include <ctime>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <perf.hpp>
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		/* see tools/perf/Documentation/jitdump-specification.txt */
+		enum JitDumpRecord
+		{
+			jit_code_load = 0,
+			jit_code_debug_info = 2
+		};
+
+		struct JitDumpHeader
+		{
+			std::uint32_t magic;
+			std::uint32_t version;
+			std::uint32_t total_size;
+			std::uint32_t elf_mach;
+			std::uint32_t pad1;
+			std::uint32_t pid;
+			std::uint64_t timestamp;
+			std::uint64_t flags;
+		};
+
+		struct JitDumpRecordHeader
+		{
+			std::uint32_t id;
+			std::uint32_t total_size;
+			std::uint64_t timestamp;
+		};
+
+		static std::uint32_t const jitdump_magic = 0x4A695444;
+		static std::uint32_t const jitdump_version = 1;
+
+#if defined(__x86_64__)
+		static std::uint32_t const elf_machine = 62;
+#elif defined(__aarch64__)
+		static std::uint32_t const elf_machine = 183;
+#else
+		static std::uint32_t const elf_machine = 0;
+#endif
+
+		/* perf record -k mono samples with the same clock */
+		static std::uint64_t timestamp() noexcept
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			return static_cast<std::uint64_t>(now.tv_sec) * 1000000000u + now.tv_nsec;
+		}
+
+		template <typename T>
+		static void write(std::FILE * out, T const & value)
+		{ std::fwrite(&value, sizeof(value), 1, out); }
+
+		static void write(std::FILE * out, std::string const & value)
+		{ std::fwrite(value.c_str(), value.size() + 1, 1, out); }
+
+		static std::string file_name(std::string const & directory, char const * prefix, char const * suffix)
+		{ return directory + "/" + prefix + std::to_string(getpid()) + suffix; }
+
+	}
+
+	PerfWriter::PerfWriter() noexcept
+		: map_(nullptr)
+		, dump_(nullptr)
+		, marker_(nullptr)
+		, marker_size_(0)
+		, index_(0)
+	{ }
+
+	PerfWriter::~PerfWriter()
+	{ close(); }
+
+	bool PerfWriter::open_map(std::string const & directory)
+	{
+		if (map_)
+			return true;
+
+		map_ = std::fopen(detail::file_name(directory, "perf-", ".map").c_str(), "w");
+		return map_ != nullptr;
+	}
+
+	bool PerfWriter::open_jitdump(std::string const & directory)
+	{
+		if (dump_)
+			return true;
+
+		dump_ = std::fopen(detail::file_name(directory, "jit-", ".dump").c_str(), "w+");
+		if (!dump_)
+			return false;
+
+		/* perf finds the dump through this executable mapping of the file */
+		marker_size_ = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+		marker_ = mmap(nullptr, marker_size_, PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(dump_), 0);
+		if (marker_ == MAP_FAILED)
+		{
+			marker_ = nullptr;
+			std::fclose(dump_);
+			dump_ = nullptr;
+			return false;
+		}
+
+		detail::JitDumpHeader header;
+		header.magic = detail::jitdump_magic;
+		header.version = detail::jitdump_version;
+		header.total_size = sizeof(header);
+		header.elf_mach = detail::elf_machine;
+		header.pad1 = 0;
+		header.pid = static_cast<std::uint32_t>(getpid());
+		header.timestamp = detail::timestamp();
+		header.flags = 0;
+		detail::write(dump_, header);
+		std::fflush(dump_);
+
+		return true;
+	}
+
+	void PerfWriter::close()
+	{
+		if (map_)
+			std::fclose(map_);
+		map_ = nullptr;
+
+		if (marker_)
+			munmap(marker_, marker_size_);
+		marker_ = nullptr;
+
+		if (dump_)
+			std::fclose(dump_);
+		dump_ = nullptr;
+	}
+
+	bool PerfWriter::is_open() const noexcept
+	{ return map_ || dump_; }
+
+	void PerfWriter::load(std::string const & name, void const * address, std::size_t size,
+				std::string const & file, LinesType const & lines)
+	{
+		if (map_)
+		{
+			std::fprintf(map_, "%" PRIxPTR " %zx %s\n", reinterpret_cast<std::uintptr_t>(address), size, name.c_str());
+			std::fflush(map_);
+		}
+
+		if (dump_)
+		{
+			/* line info has to precede the code it describes */
+			if (!lines.empty())
+				write_debug_info(address, file, lines);
+			write_code_load(name, address, size);
+			std::fflush(dump_);
+		}
+	}
+
+	void PerfWriter::write_debug_info(void const * address, std::string const & file, LinesType const & lines)
+	{
+		std::uint64_t const start = reinterpret_cast<std::uint64_t>(address);
+
+		detail::JitDumpRecordHeader header;
+		header.id = detail::jit_code_debug_info;
+		header.total_size = sizeof(header) + 2 * sizeof(std::uint64_t);
+		header.timestamp = detail::timestamp();
+		for (std::size_t index = 0; index != lines.size(); ++index)
+			header.total_size += sizeof(std::uint64_t) + 2 * sizeof(std::uint32_t) + file.size() + 1;
+
+		detail::write(dump_, header);
+		detail::write(dump_, start);
+		detail::write(dump_, static_cast<std::uint64_t>(lines.size()));
+		for (Line const & line : lines)
+		{
+			detail::write(dump_, static_cast<std::uint64_t>(start + line.offset));
+			detail::write(dump_, static_cast<std::uint32_t>(line.line + 1));
+			detail::write(dump_, static_cast<std::uint32_t>(0));
+			detail::write(dump_, file);
+		}
+	}
+
+	void PerfWriter::write_code_load(std::string const & name, void const * address, std::size_t size)
+	{
+		std::uint64_t const start = reinterpret_cast<std::uint64_t>(address);
+
+		detail::JitDumpRecordHeader header;
+		header.id = detail::jit_code_load;
+		header.total_size = sizeof(header) + 2 * sizeof(std::uint32_t) + 4 * sizeof(std::uint64_t) + name.size() + 1 + size;
+		header.timestamp = detail::timestamp();
+
+		detail::write(dump_, header);
+		detail::write(dump_, static_cast<std::uint32_t>(getpid()));
+		detail::write(dump_, static_cast<std::uint32_t>(syscall(SYS_gettid)));
+		detail::write(dump_, start);
+		detail::write(dump_, start);
+		detail::write(dump_, static_cast<std::uint64_t>(size));
+		detail::write(dump_, index_++);
+		detail::write(dump_, name);
+		std::fwrite(address, size, 1, dump_);
+	}
+
+}
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <set>
+#include <string>
+#include <utility>
+
+#include <sys/time.h>
+
+#include <profiler.hpp>
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		static std::size_t line_of(Profiler::Site const & site) noexcept
+		{ return site.code->line_at(site.offset); }
+
+		static double percent(std::size_t count, std::size_t total) noexcept
+		{ return total ? 100.0 * count / total : 0.0; }
+
+	}
+
+	volatile std::sig_atomic_t Profiler::ticks_ = 0;
+
+	Profiler::Profiler(unsigned frequency)
+		: frequency_(std::max(1u, std::min(frequency, 1000000u)))
+		, running_(false)
+		, samples_(0)
+	{ }
+
+	Profiler::~Profiler()
+	{ stop(); }
+
+	void Profiler::handler(int)
+	{ ticks_ = ticks_ + 1; }
+
+	bool Profiler::start()
+	{
+		if (running_)
+			return true;
+
+		struct sigaction action;
+		std::memset(&action, 0, sizeof(action));
+		action.sa_handler = &Profiler::handler;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		if (sigaction(SIGPROF, &action, &previous_) != 0)
+			return false;
+
+		ticks_ = 0;
+
+		struct itimerval timer;
+		timer.it_interval.tv_sec = 0;
+		timer.it_interval.tv_usec = 1000000 / frequency_;
+		timer.it_value = timer.it_interval;
+		if (setitimer(ITIMER_PROF, &timer, nullptr) != 0)
+		{
+			sigaction(SIGPROF, &previous_, nullptr);
+			return false;
+		}
+
+		running_ = true;
+		return true;
+	}
+
+	void Profiler::stop()
+	{
+		if (!running_)
+			return;
+
+		struct itimerval timer;
+		std::memset(&timer, 0, sizeof(timer));
+		setitimer(ITIMER_PROF, &timer, nullptr);
+		sigaction(SIGPROF, &previous_, nullptr);
+		running_ = false;
+	}
+
+	void Profiler::sample(StackType const & stack)
+	{
+		std::size_t const ticks = ticks_;
+		ticks_ = 0;
+
+		if (!ticks || stack.empty())
+			return;
+
+		stacks_[stack] += ticks;
+		samples_ += ticks;
+	}
+
+	std::size_t Profiler::samples() const noexcept
+	{ return samples_; }
+
+	Profiler::StacksType const & Profiler::stacks() const noexcept
+	{ return stacks_; }
+
+	void Profiler::report_flat(std::ostream & out) const
+	{
+		typedef std::pair<Code const *, std::size_t> LineType;
+
+		std::map<Code const *, std::size_t> self, total;
+		std::map<LineType, std::size_t> lines;
+
+		for (StacksType::value_type const & entry : stacks_)
+		{
+			StackType const & stack = entry.first;
+			Site const & top = stack.back();
+
+			self[top.code] += entry.second;
+			lines[LineType(top.code, detail::line_of(top))] += entry.second;
+
+			/* recursive functions count once per sample */
+			std::set<Code const *> seen;
+			for (Site const & site : stack)
+				if (seen.insert(site.code).second)
+					total[site.code] += entry.second;
+		}
+
+		typedef std::pair<std::size_t, Code const *> FunctionType;
+		std::vector<FunctionType> functions;
+		for (std::pair<Code const * const, std::size_t> const & entry : total)
+			functions.push_back(FunctionType(self[entry.first], entry.first));
+		std::sort(functions.rbegin(), functions.rend());
+
+		out << "samples: " << samples_ << " at " << frequency_ << " Hz" << std::endl
+			<< std::fixed << std::setprecision(2)
+			<< std::setw(8) << "self%" << std::setw(8) << "total%"
+			<< std::setw(10) << "self" << std::setw(10) << "total"
+			<< "  function" << std::endl;
+		for (FunctionType const & function : functions)
+		{
+			std::size_t const inclusive = total[function.second];
+			out << std::setw(8) << detail::percent(function.first, samples_)
+				<< std::setw(8) << detail::percent(inclusive, samples_)
+				<< std::setw(10) << function.first
+				<< std::setw(10) << inclusive
+				<< "  " << function.second->name() << std::endl;
+		}
+
+		typedef std::pair<std::size_t, LineType> HotLineType;
+		std::vector<HotLineType> hot;
+		for (std::pair<LineType const, std::size_t> const & entry : lines)
+			hot.push_back(HotLineType(entry.second, entry.first));
+		std::sort(hot.rbegin(), hot.rend());
+
+		out << std::endl
+			<< std::setw(8) << "self%" << std::setw(10) << "self"
+			<< "  line" << std::endl;
+		for (HotLineType const & line : hot)
+		{
+			out << std::setw(8) << detail::percent(line.first, samples_)
+				<< std::setw(10) << line.first
+				<< "  " << line.second.first->name() << ":";
+			if (line.second.second == LineTable::npos)
+				out << "?";
+			else
+				out << line.second.second;
+			out << std::endl;
+		}
+	}
+
+	void Profiler::report_folded(std::ostream & out) const
+	{
+		/* stacks that differ only in offsets fold into one line */
+		std::map<std::string, std::size_t> folded;
+		for (StacksType::value_type const & entry : stacks_)
+		{
+			std::string line;
+			for (Site const & site : entry.first)
+			{
+				if (!line.empty())
+					line += ';';
+				line += site.code->name();
+			}
+			folded[line] += entry.second;
+		}
+
+		for (std::pair<std::string const, std::size_t> const & entry : folded)
+			out << entry.first << " " << entry.second << std::endl;
+	}
+
+	PairCounter::PairCounter() noexcept
+		: total_(0)
+	{ std::memset(counts_, 0, sizeof(counts_)); }
+
+	std::uint64_t PairCounter::count_of(Opcode::Kind first, Opcode::Kind second) const noexcept
+	{ return counts_[first][second]; }
+
+	std::uint64_t PairCounter::total() const noexcept
+	{ return total_; }
+
+	void PairCounter::report(std::ostream & out, std::size_t limit) const
+	{
+		typedef std::pair<std::uint64_t, std::pair<int, int> > PairType;
+		std::vector<PairType> pairs;
+		for (int first = 0; first != Opcode::opcode_count; ++first)
+			for (int second = 0; second != Opcode::opcode_count; ++second)
+				if (counts_[first][second])
+					pairs.push_back(PairType(counts_[first][second], std::make_pair(first, second)));
+		std::sort(pairs.rbegin(), pairs.rend());
+		if (pairs.size() > limit)
+			pairs.resize(limit);
+
+		out << "pairs: " << total_ << std::endl
+			<< std::fixed << std::setprecision(2)
+			<< std::setw(8) << "share%" << std::setw(14) << "count"
+			<< "  pair" << std::endl;
+		for (PairType const & pair : pairs)
+			out << std::setw(8) << 100.0 * pair.first / total_
+				<< std::setw(14) << pair.first
+				<< "  " << Opcode::name(static_cast<Opcode::Kind>(pair.second.first))
+				<< " " << Opcode::name(static_cast<Opcode::Kind>(pair.second.second)) << std::endl;
+	}
+
+}
@@ -1,15 +1,32 @@
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <iterator>
+#include <limits>
 
 #include <scanner.hpp>
 
 namespace vm
 {
 
+	std::string Edit::apply(std::string const & code) const
+	{
+		std::string result;
+		result.reserve(code.size() - length + text.size());
+		result.append(code, 0, offset);
+		result.append(text);
+		result.append(code, offset + length, std::string::npos);
+		return result;
+	}
+
 	TokenList::TokenList()
 	{ }
 
 	void TokenList::clear() noexcept
-	{ tokens_.clear(); }
+	{
+		tokens_.clear();
+		lines_.clear();
+	}
 
 	void TokenList::push_back(Token token)
 	{ tokens_.push_back(std::move(token)); }
@@ -17,6 +34,31 @@ namespace vm
 	void TokenList::emplace_back(Token::Kind kind, std::string value, Location loc)
 	{ tokens_.emplace_back(kind, std::move(value), std::move(loc)); }
 
+	void TokenList::emplace_back(Token::Kind kind, Value literal, Location loc)
+	{ tokens_.emplace_back(kind, literal, std::move(loc)); }
+
+	void TokenList::replace(size_t first, size_t last, TokenList & tokens, std::ptrdiff_t delta)
+	{
+		for (size_t index = last; index != tokens_.size(); ++index)
+		{
+			Token & token = tokens_[index];
+			token.set_location(Location(static_cast<std::uint32_t>(token.location().position() + delta)));
+		}
+
+		std::vector<Token>::iterator const begin = tokens_.begin();
+		size_t const common = std::min(last - first, tokens.size());
+		std::move(tokens.tokens_.begin(), tokens.tokens_.begin() + common, begin + first);
+		if (common != last - first)
+			tokens_.erase(begin + first + common, begin + last);
+		else
+			tokens_.insert(begin + last, std::make_move_iterator(tokens.tokens_.begin() + common),
+						std::make_move_iterator(tokens.tokens_.end()));
+		tokens.clear();
+	}
+
+	size_t TokenList::size() const noexcept
+	{ return tokens_.size(); }
+
 	Token const & TokenList::at(size_t index) const noexcept
 	{
 		static Token const err(Token::undef);
@@ -37,6 +79,12 @@ namespace vm
 	std::string const & TokenList::value_at(size_t index) const noexcept
 	{ return at(index).value(); }
 
+	LineTable & TokenList::lines() noexcept
+	{ return lines_; }
+
+	LineTable const & TokenList::lines() const noexcept
+	{ return lines_; }
+
 	namespace detail
 	{
 
@@ -62,6 +110,25 @@ namespace vm
 			return ch;
 		}
 
+		/* false once the digit no longer fits, the mantissa is then left as it was */
+		static bool append_digit(std::uint64_t & mantissa, char ch) noexcept
+		{
+			std::uint64_t const digit = static_cast<std::uint64_t>(ch - '0');
+			if (mantissa > (std::numeric_limits<std::uint64_t>::max() - digit) / 10)
+				return false;
+			mantissa = mantissa * 10 + digit;
+			return true;
+		}
+
+		/* powers of ten a double holds exactly */
+		static double const exact_powers[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+
+		static std::int32_t const max_exact_power = sizeof(exact_powers) / sizeof(exact_powers[0]) - 1;
+		static std::uint64_t const max_exact_mantissa = std::uint64_t(1) << 53;
+
 	}
 
 
@@ -71,25 +138,92 @@ namespace vm
 	Status::Code Scanner::scan(std::string const & code, TokenList & tokens, Status & status)
 	{
 		reset(&tokens, &status, &code);
-		scan_impl();
+		tokens.lines().assign(code);
+
+		if (code.size() >= Location::unreachable)
+			error("source is too large", Location());
+		else
+			scan_impl();
+
 		return status_->code();
 	}
 
-	char Scanner::peek_char(size_t off) const noexcept
-	{ return (pos_ + off < code_->size()) ? code_->at(pos_ + off) : '\0'; }
-
-	char Scanner::get_char() noexcept
+	Status::Code Scanner::rescan(std::string const & code, Edit const & edit, TokenList & tokens,
+					Splice & splice, Status & status)
 	{
-		char ch = peek_char();
+		TokenList scanned;
+		reset(&scanned, &status, &code);
+
+		if (code.size() >= Location::unreachable)
+		{
+			error("source is too large", Location());
+			return status_->code();
+		}
 
-		++offset_; ++pos_;
+		/*
+		 * the token before the edit may grow into it and the one before
+		 * that might have peeked at it (1..2), so both are scanned again
+		 */
+		std::size_t first = 0, last = tokens.size();
+		while (first != last)
+		{
+			std::size_t const middle = first + (last - first) / 2;
+			if (tokens.location_at(middle).position() < edit.offset)
+				first = middle + 1;
+			else
+				last = middle;
+		}
+		first -= std::min<std::size_t>(first, 2);
+
+		previous_ = &tokens;
+		splice.first = first;
+		splice.old_end = tokens.size();
+		old_pos_ = first;
+		delta_ = static_cast<std::ptrdiff_t>(edit.text.size()) - static_cast<std::ptrdiff_t>(edit.length);
+		resync_pos_ = edit.offset + edit.text.size();
+		pos_ = first != tokens.size() ? tokens.location_at(first).position() : 0;
+		if (pos_ > edit.offset)
+			pos_ = 0;
+
+		scan_impl();
+		previous_ = nullptr;
+
+		/* the scan stops before the end only where it met the old tokens */
+		if (pos_ < code.size())
+			splice.old_end = old_pos_;
 
-		if (ch == '\n')
+		if (is_ok())
 		{
-			offset_ = 0;
-			++line_;
+			splice.new_end = first + scanned.size();
+			tokens.replace(first, splice.old_end, scanned, delta_);
+			tokens.lines().assign(code);
 		}
+		return status_->code();
+	}
+
+	bool Scanner::resync()
+	{
+		if (pos_ < resync_pos_)
+			return false;
+
+		std::ptrdiff_t const pos = static_cast<std::ptrdiff_t>(pos_);
+		while (old_pos_ != previous_->size() && previous_->location_at(old_pos_).position() + delta_ < pos)
+			++old_pos_;
 
+		if (old_pos_ == previous_->size() || previous_->location_at(old_pos_).position() + delta_ != pos)
+			return false;
+
+		/* from here on the code is the old one, only moved */
+		return true;
+	}
+
+	char Scanner::peek_char(size_t off) const noexcept
+	{ return (pos_ + off < code_->size()) ? code_->at(pos_ + off) : '\0'; }
+
+	char Scanner::get_char() noexcept
+	{
+		char const ch = peek_char();
+		++pos_;
 		return ch;
 	}
 
@@ -97,7 +231,7 @@ namespace vm
 	{ while (n--) get_char(); } 
 
 	Location Scanner::current_location() const noexcept
-	{ return Location(line_, offset_); }
+	{ return Location(static_cast<std::uint32_t>(pos_)); }
 
 	bool Scanner::is_ok() const noexcept
 	{ return status_->code() != Status::ERROR; }
@@ -118,6 +252,7 @@ namespace vm
 			{
 				get_char();
 				value += detail::get_unescaped(get_char());
+				continue;
 			}
 			value += get_char();
 		}
@@ -132,27 +267,76 @@ namespace vm
 		error("unexpected end of file", current_location());
 	}
 
+	/*
+	 * converts the literal right from the source: an exact mantissa scaled
+	 * by an exact power of ten is correctly rounded by a single operation,
+	 * only longer or larger doubles go through strtod; ints saturate as
+	 * strtol did
+	 */
 	void Scanner::scan_number()
 	{
-		Token::Kind kind(Token::int_l);
 		Location location(current_location());
-		std::string value;
+		std::size_t const first = pos_;
+		std::uint64_t mantissa = 0;
+		std::int32_t scale = 0;
+		bool exact = true;
 
 		while (detail::is_digit(peek_char()))
-			value += get_char();
+			exact = detail::append_digit(mantissa, get_char()) && exact;
 
-		if (peek_char() == 'e' || peek_char() == '.')
+		bool const fraction = peek_char() == '.' && peek_char(1) != '.';
+		if (!fraction && peek_char() != 'e')
 		{
-			kind = Token::double_l;
-			if (peek_char() == 'e' && (peek_char(1) == '-' || peek_char(1) == '+'))
-				value += get_char();
-			value += get_char();
+			Value value;
+			value.as_int = (!exact || mantissa > static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()))
+				? std::numeric_limits<std::int64_t>::max() : static_cast<std::int64_t>(mantissa);
+			tokens_->emplace_back(Token::int_l, value, std::move(location));
+			return;
+		}
 
+		if (fraction)
+		{
+			get_char();
 			while (detail::is_digit(peek_char()))
-				value += get_char();
+			{
+				exact = detail::append_digit(mantissa, get_char()) && exact;
+				--scale;
+			}
 		}
 
-		tokens_->emplace_back(kind, std::move(value), std::move(location));
+		if (peek_char() == 'e')
+		{
+			get_char();
+			bool const negative = peek_char() == '-';
+			if (peek_char() == '-' || peek_char() == '+')
+				get_char();
+
+			if (!detail::is_digit(peek_char()))
+			{
+				error("double literal expected", location);
+				return;
+			}
+
+			std::int32_t exponent = 0;
+			while (detail::is_digit(peek_char()))
+			{
+				char const ch = get_char();
+				if (exponent <= detail::max_exact_power)
+					exponent = exponent * 10 + (ch - '0');
+			}
+			scale += negative ? -exponent : exponent;
+		}
+
+		Value value;
+		if (exact && mantissa <= detail::max_exact_mantissa && scale >= -detail::max_exact_power && scale <= detail::max_exact_power)
+		{
+			double const number = static_cast<double>(mantissa);
+			value.as_double = scale < 0 ? number / detail::exact_powers[-scale] : number * detail::exact_powers[scale];
+		}
+		else
+			value.as_double = std::strtod(code_->substr(first, pos_ - first).c_str(), nullptr);
+
+		tokens_->emplace_back(Token::double_l, value, std::move(location));
 	}
 
 	void Scanner::scan_ident()
@@ -187,7 +371,14 @@ namespace vm
 		while (is_ok() && peek_char() != '\0')
 		{
 			skip_whitespaces();
-			skip_comment();
+			if (peek_char() == '/' && peek_char(1) == '/')
+			{
+				skip_comment();
+				continue;
+			}
+
+			if (previous_ && resync())
+				return;
 
 			char const ch = peek_char();
 			if (ch == '\0')
@@ -240,14 +431,17 @@ namespace vm
 
 	void Scanner::reset(TokenList * tokens, Status * status, std::string const * code) noexcept
 	{
-		line_ = 0;
-		offset_ = 0;
 		pos_ = 0;
 
 		tokens_ = tokens;
 		status_ = status;
 		code_ = code;
 
+		previous_ = nullptr;
+		resync_pos_ = 0;
+		old_pos_ = 0;
+		delta_ = 0;
+
 		if (status_)
 			Status().swap(*status_);
 	}
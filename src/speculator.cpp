@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <vector>
+
+#include <peephole.hpp>
+#include <speculator.hpp>
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		/* the way a conditional jump is speculated to go */
+		enum Way
+		{
+			both,
+			falls,
+			jumps
+		};
+
+		/* the instructions control goes to after the one at index */
+		template <typename Visit>
+		static void successors(Instruction const * code, std::size_t size, std::size_t index, Visit visit)
+		{
+			Instruction const & insn = code[index];
+			switch (insn.opcode)
+			{
+			case Opcode::ret:
+			case Opcode::retv:
+			case Opcode::deopt:
+				return;
+			case Opcode::jmp:
+				visit(static_cast<std::size_t>(insn.arg));
+				return;
+			default:
+				if (Opcode::is_conditional(insn.opcode))
+					visit(static_cast<std::size_t>(insn.arg));
+				if (index + 1 != size)
+					visit(index + 1);
+				return;
+			}
+		}
+
+		/* the instructions a path from the first one reaches when every conditional jump goes its way */
+		static std::vector<bool> reach(Instruction const * code, std::size_t size, std::vector<Way> const & ways)
+		{
+			std::vector<bool> reached(size, false);
+			std::vector<std::size_t> pending(1, 0);
+			reached[0] = true;
+			while (!pending.empty())
+			{
+				std::size_t const index = pending.back();
+				pending.pop_back();
+				auto const visit = [&](std::size_t next) {
+					if (!reached[next])
+					{
+						reached[next] = true;
+						pending.push_back(next);
+					}
+				};
+				if (ways[index] == falls)
+					visit(index + 1);
+				else if (ways[index] == jumps)
+					visit(static_cast<std::size_t>(code[index].arg));
+				else
+					successors(code, size, index, visit);
+			}
+			return reached;
+		}
+
+		/* drops the instructions no path from the first one reaches */
+		static void prune(Code::InstructionsType & code, std::vector<Location> & locations)
+		{
+			std::vector<bool> const reached = reach(code.data(), code.size(), std::vector<Way>(code.size(), both));
+
+			std::vector<std::int32_t> moved(code.size());
+			std::size_t kept = 0;
+			for (std::size_t index = 0; index != code.size(); ++index)
+			{
+				moved[index] = static_cast<std::int32_t>(kept);
+				if (reached[index])
+				{
+					code[kept] = code[index];
+					locations[kept] = locations[index];
+					++kept;
+				}
+			}
+			code.resize(kept);
+			locations.resize(kept);
+
+			for (Instruction & insn : code)
+				if (Opcode::is_jump(insn.opcode))
+					insn.arg = moved[insn.arg];
+		}
+
+	}
+
+	Speculator::Speculator() noexcept
+		: hot_calls_(default_hot_calls)
+		, min_samples_(default_min_samples)
+		, max_deopts_(default_max_deopts)
+		, speculated_(0)
+		, deopts_(0)
+		, abandoned_(0)
+	{ }
+
+	void Speculator::set_hot_calls(std::uint64_t calls) noexcept
+	{ hot_calls_ = calls; }
+
+	void Speculator::set_min_samples(std::uint64_t samples) noexcept
+	{ min_samples_ = samples; }
+
+	void Speculator::set_max_deopts(std::uint64_t deopts) noexcept
+	{ max_deopts_ = deopts; }
+
+	Code const * Speculator::enter(Code const & baseline)
+	{
+		if (baseline.settled())
+			return &baseline;
+		if (Code const * const speculative = baseline.speculative())
+			return speculative;
+		if (baseline.calls().value() < hot_calls_)
+			return &baseline;
+
+		std::unique_ptr<Code> speculative = speculate(baseline);
+		if (!speculative)
+		{
+			baseline.settle();
+			return &baseline;
+		}
+
+		/* another interpreter may have installed its own meanwhile */
+		if (baseline.install(std::move(speculative)))
+			speculated_.fetch_add(1, std::memory_order_relaxed);
+		return baseline.speculative();
+	}
+
+	void Speculator::deoptimized(Code const & speculative) noexcept
+	{
+		deopts_.fetch_add(1, std::memory_order_relaxed);
+		speculative.deopts().increment();
+
+		Code const & baseline = *speculative.baseline();
+		if (speculative.deopts().value() >= max_deopts_ && !baseline.settled())
+		{
+			baseline.settle();
+			abandoned_.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	std::unique_ptr<Code> Speculator::speculate(Code const & baseline) const
+	{
+		std::size_t const size = baseline.size();
+		Instruction const * const insns = baseline.instructions();
+
+		std::vector<detail::Way> ways(size, detail::both);
+		for (std::size_t index = 0; index != size; ++index)
+			if (Opcode::is_conditional(insns[index].opcode))
+			{
+				std::uint64_t const taken = baseline.taken(index).value();
+				std::uint64_t const fallen = baseline.fallen(index).value();
+				if (taken + fallen >= min_samples_ && !(taken && fallen))
+					ways[index] = taken ? detail::jumps : detail::falls;
+			}
+
+		/*
+		 * a guard of a jump always taken is the inverse jump to a deopt
+		 * and a jump to the target, one jump more unless everything up
+		 * to the target is dropped and that jump goes to the next
+		 * instruction; where some of it still runs the jump stays as it
+		 * was, which reaches more code, so this repeats until none stays
+		 */
+		std::vector<bool> reached;
+		for (bool changed = true; changed; )
+		{
+			changed = false;
+			reached = detail::reach(insns, size, ways);
+			for (std::size_t index = 0; index != size; ++index)
+			{
+				if (ways[index] != detail::jumps)
+					continue;
+
+				std::size_t const target = static_cast<std::size_t>(insns[index].arg);
+				bool kept = target <= index;
+				for (std::size_t between = index + 1; !kept && between < target; ++between)
+					kept = reached[between];
+				if (kept)
+				{
+					ways[index] = detail::both;
+					changed = true;
+				}
+			}
+		}
+
+		/*
+		 * guards jump to the deopt stubs appended after the body, their
+		 * argument is the stub number until the body is complete
+		 */
+		Code::InstructionsType code;
+		std::vector<Location> locations;
+		std::vector<bool> guards;
+		std::vector<std::size_t> targets;
+		std::vector<Location> stubs;
+		std::vector<std::int32_t> moved(size + 1);
+		for (std::size_t index = 0; index != size; ++index)
+		{
+			moved[index] = static_cast<std::int32_t>(code.size());
+			Instruction insn = insns[index];
+			Location const location = baseline.location_at(index);
+
+			if (ways[index] == detail::both)
+			{
+				code.push_back(insn);
+				locations.push_back(location);
+				guards.push_back(false);
+				continue;
+			}
+
+			bool const taken = ways[index] == detail::jumps;
+			Instruction const guard = {
+				taken ? Opcode::inverse(insn.opcode) : insn.opcode,
+				static_cast<std::int32_t>(targets.size())
+			};
+			targets.push_back(taken ? index + 1 : static_cast<std::size_t>(insn.arg));
+			stubs.push_back(location);
+			code.push_back(guard);
+			locations.push_back(location);
+			guards.push_back(true);
+
+			/* the way it always went */
+			if (taken)
+			{
+				Instruction const jump = { Opcode::jmp, insn.arg };
+				code.push_back(jump);
+				locations.push_back(location);
+				guards.push_back(false);
+			}
+		}
+		moved[size] = static_cast<std::int32_t>(code.size());
+
+		if (targets.empty())
+			return nullptr;
+
+		std::int32_t const first_stub = static_cast<std::int32_t>(code.size());
+		for (std::size_t index = 0; index != code.size(); ++index)
+			if (guards[index])
+				code[index].arg += first_stub;
+			else if (Opcode::is_jump(code[index].opcode))
+				code[index].arg = moved[code[index].arg];
+
+		for (std::size_t stub = 0; stub != targets.size(); ++stub)
+		{
+			Instruction const deopt = { Opcode::deopt, static_cast<std::int32_t>(stub) };
+			code.push_back(deopt);
+			locations.push_back(stubs[stub]);
+		}
+
+		detail::prune(code, locations);
+
+		std::unique_ptr<Code> speculative = baseline.derive(std::move(code), std::move(locations), std::move(targets));
+		peephole(*speculative);
+
+		/*
+		 * a guard runs as often as the jump it replaced, only the jumps
+		 * to the next instruction dropped and the pairs fused where a
+		 * target went away make the code that still runs shorter
+		 */
+		std::size_t body = 0;
+		for (std::size_t index = 0; index != speculative->size(); ++index)
+			if (speculative->at(index).opcode != Opcode::deopt)
+				++body;
+		if (body >= static_cast<std::size_t>(std::count(reached.begin(), reached.end(), true)))
+			return nullptr;
+
+		speculative->seal();
+		return speculative;
+	}
+
+	std::size_t Speculator::speculated() const noexcept
+	{ return speculated_.load(std::memory_order_relaxed); }
+
+	std::size_t Speculator::deopts() const noexcept
+	{ return deopts_.load(std::memory_order_relaxed); }
+
+	std::size_t Speculator::abandoned() const noexcept
+	{ return abandoned_.load(std::memory_order_relaxed); }
+
+	void Speculator::report(std::ostream & out) const
+	{
+		out << "speculated: " << speculated()
+			<< ", deopts: " << deopts()
+			<< ", abandoned: " << abandoned() << std::endl;
+	}
+
+}
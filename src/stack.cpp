@@ -0,0 +1,53 @@
+#include <cassert>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <stack.hpp>
+
+namespace vm
+{
+
+	StackMemory::StackMemory() noexcept
+		: memory_(nullptr), size_(0), mapped_(0)
+	{ }
+
+	StackMemory::~StackMemory()
+	{
+		if (memory_)
+			munmap(memory_, mapped_);
+	}
+
+	bool StackMemory::reserve(std::size_t size)
+	{
+		assert(!memory_);
+
+		std::size_t const page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+		std::size_t const usable = (size + page - 1) / page * page;
+		std::size_t const mapped = usable + page;
+
+		void * const memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+									MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (memory == MAP_FAILED)
+			return false;
+
+		if (mprotect(static_cast<char *>(memory) + usable, page, PROT_NONE))
+		{
+			munmap(memory, mapped);
+			return false;
+		}
+
+		memory_ = memory;
+		size_ = size;
+		mapped_ = mapped;
+
+		return true;
+	}
+
+	void * StackMemory::address() const noexcept
+	{ return memory_; }
+
+	std::size_t StackMemory::size() const noexcept
+	{ return size_; }
+
+}
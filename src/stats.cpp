@@ -0,0 +1,166 @@
+#include <stats.hpp>
+
+#if defined(VM_STATS)
+
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <new>
+
+namespace
+{
+
+	/* per thread, so concurrent contexts never touch a shared counter */
+	thread_local std::size_t allocated_bytes = 0;
+	thread_local std::size_t allocations = 0;
+
+}
+
+void * operator new(std::size_t size)
+{
+	allocated_bytes += size;
+	allocations += 1;
+
+	void * const memory = std::malloc(size ? size : 1);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void * memory) noexcept
+{ std::free(memory); }
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		static double cpu_seconds() noexcept
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+			return now.tv_sec + now.tv_nsec / 1e9;
+		}
+
+	}
+
+	char const * Phase::name(Kind kind) noexcept
+	{
+		#define PHASE_NAME(name) case name: return #name;
+		switch (kind)
+		{
+		FOR_PHASES(PHASE_NAME)
+		default: return "unknown";
+		}
+		#undef PHASE_NAME
+	}
+
+	Stats::Stats() noexcept
+	{
+		for (PhaseStats & phase : phases_)
+			phase = PhaseStats();
+	}
+
+	Stats & Stats::instance() noexcept
+	{
+		thread_local Stats stats;
+		return stats;
+	}
+
+	PhaseStats & Stats::phase(Phase::Kind kind) noexcept
+	{ return phases_[kind]; }
+
+	PhaseStats const & Stats::phase(Phase::Kind kind) const noexcept
+	{ return phases_[kind]; }
+
+	std::size_t Stats::allocated_bytes() noexcept
+	{ return ::allocated_bytes; }
+
+	std::size_t Stats::allocations() noexcept
+	{ return ::allocations; }
+
+	void Stats::report(std::ostream & out) const
+	{
+		out << std::left << std::setw(10) << "phase" << std::right
+			<< std::setw(8) << "calls"
+			<< std::setw(12) << "wall ms"
+			<< std::setw(12) << "cpu ms"
+			<< std::setw(12) << "alloc KiB"
+			<< std::setw(10) << "allocs"
+			<< std::setw(10) << "tokens"
+			<< std::setw(10) << "nodes"
+			<< std::setw(10) << "code"
+			<< std::endl;
+
+		for (std::size_t kind = 0; kind != Phase::phase_count; ++kind)
+		{
+			PhaseStats const & phase = phases_[kind];
+			if (!phase.calls)
+				continue;
+
+			out << std::left << std::setw(10) << Phase::name(static_cast<Phase::Kind>(kind)) << std::right
+				<< std::setw(8) << phase.calls
+				<< std::fixed << std::setprecision(3)
+				<< std::setw(12) << phase.wall * 1000.0
+				<< std::setw(12) << phase.cpu * 1000.0
+				<< std::setw(12) << phase.bytes / 1024.0
+				<< std::setw(10) << phase.allocations
+				<< std::setw(10) << phase.tokens
+				<< std::setw(10) << phase.nodes
+				<< std::setw(10) << phase.code_size
+				<< std::endl;
+		}
+	}
+
+	void Stats::report_json(std::ostream & out) const
+	{
+		out << "{\n\t\"phases\": [";
+
+		char const * separator = "\n";
+		for (std::size_t kind = 0; kind != Phase::phase_count; ++kind)
+		{
+			PhaseStats const & phase = phases_[kind];
+			if (!phase.calls)
+				continue;
+
+			out << separator
+				<< "\t\t{\n"
+				<< "\t\t\t\"phase\": \"" << Phase::name(static_cast<Phase::Kind>(kind)) << "\",\n"
+				<< "\t\t\t\"calls\": " << phase.calls << ",\n"
+				<< std::setprecision(9)
+				<< "\t\t\t\"wall_seconds\": " << phase.wall << ",\n"
+				<< "\t\t\t\"cpu_seconds\": " << phase.cpu << ",\n"
+				<< "\t\t\t\"allocated_bytes\": " << phase.bytes << ",\n"
+				<< "\t\t\t\"allocations\": " << phase.allocations << ",\n"
+				<< "\t\t\t\"tokens\": " << phase.tokens << ",\n"
+				<< "\t\t\t\"nodes\": " << phase.nodes << ",\n"
+				<< "\t\t\t\"code_size\": " << phase.code_size << "\n"
+				<< "\t\t}";
+			separator = ",\n";
+		}
+
+		out << "\n\t]\n}\n";
+	}
+
+	PhaseTimer::PhaseTimer(Phase::Kind kind) noexcept
+		: kind_(kind)
+		, wall_(std::chrono::steady_clock::now())
+		, cpu_(detail::cpu_seconds())
+		, bytes_(Stats::allocated_bytes())
+		, allocations_(Stats::allocations())
+	{ }
+
+	PhaseTimer::~PhaseTimer()
+	{
+		PhaseStats & phase = Stats::instance().phase(kind_);
+		phase.calls += 1;
+		phase.wall += std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_).count();
+		phase.cpu += detail::cpu_seconds() - cpu_;
+		phase.bytes += Stats::allocated_bytes() - bytes_;
+		phase.allocations += Stats::allocations() - allocations_;
+	}
+
+}
+
+#endif
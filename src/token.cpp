@@ -16,13 +16,15 @@ namespace vm
 	static int const token_precedence[] = {
 		#define PRECEDENCE(k, s, p) p,
 		FOR_TOKENS(PRECEDENCE)
-		#undef VALUE
+		#undef PRECEDENCE
 		-1
 	};
 
+	constexpr int Token::binding_powers[];
+
 	char const * Token::get_token_value(Token::Kind kind) noexcept
 	{
-		assert(kind > Token::undef && kind < Token::token_count);
+		assert(kind >= Token::undef && kind < Token::token_count);
 
 		return token_values[static_cast<size_t>(kind)];
 	}
@@ -49,9 +51,6 @@ namespace vm
 	bool Token::is_keyword(Token::Kind kind) noexcept
 	{ return kind >= Token::double_t && kind <= Token::return_kw; }
 
-	bool Token::is_assignment(Token::Kind kind) noexcept
-	{ return kind == Token::incrset || kind == Token::decrset || kind == Token::assign; }
-
 	bool Token::is_typename(Token::Kind kind) noexcept
 	{ return kind == Token::double_t || kind == Token::int_t || kind == Token::string_t || kind == Token::void_t; }
 
@@ -61,6 +60,7 @@ namespace vm
 
 		swap(kind_, tok.kind_);
 		swap(value_, tok.value_);
+		swap(literal_, tok.literal_);
 		swap(location_, tok.location_);
 
 		return *this;
@@ -0,0 +1,396 @@
+#include <algorithm>
+#include <cassert>
+
+#include <optimizer.hpp>
+#include <vectorizer.hpp>
+
+namespace vm
+{
+
+	namespace detail
+	{
+
+		typedef std::uint64_t IntLanes __attribute__((vector_size(Reduction::lanes * sizeof(std::uint64_t))));
+		typedef std::int64_t SignedLanes __attribute__((vector_size(Reduction::lanes * sizeof(std::int64_t))));
+		typedef double DoubleLanes __attribute__((vector_size(Reduction::lanes * sizeof(double))));
+
+		/* int lanes wrap around like the scalar int arithmetic does */
+		union Lanes
+		{
+			IntLanes as_int;
+			DoubleLanes as_double;
+		};
+
+		static IntLanes const lane_offsets = { 0, 1, 2, 3 };
+
+		static_assert(Reduction::lanes == 4, "lane_offsets must have one entry per lane");
+
+	}
+
+	class ReductionCompiler : public Visitor
+	{
+	public:
+		using Visitor::visit;
+
+		ReductionCompiler(Reduction & reduction, ForNode const & loop) noexcept
+			: reduction_(reduction)
+			, loop_(loop)
+			, depth_(0)
+			, valid_(true)
+		{ }
+
+		bool compile(ASTNode * expr, Type type)
+		{
+			Type const actual = expression_type(expr);
+			if (actual != Type::Int && actual != Type::Double)
+				return false;
+			if (actual == Type::Double && type == Type::Int)
+				return false;
+
+			expr->visit(*this);
+			if (valid_ && actual != type)
+				emit(Reduction::IntToDouble, Type::Double);
+
+			return valid_;
+		}
+
+		virtual void visit(BinaryExprNode & node)
+		{
+			Type const left = expression_type(node.left());
+			Type const right = expression_type(node.right());
+			Type const type = (left == Type::Double || right == Type::Double) ? Type::Double : Type::Int;
+
+			Reduction::Opcode opcode;
+			switch (node.kind())
+			{
+			default:
+				valid_ = false;
+				return;
+			case Token::add: opcode = Reduction::Add; break;
+			case Token::sub: opcode = Reduction::Sub; break;
+			case Token::mul: opcode = Reduction::Mul; break;
+			case Token::div:
+				if (type != Type::Double)
+				{
+					valid_ = false;
+					return;
+				}
+				opcode = Reduction::Div;
+				break;
+			}
+
+			node.left()->visit(*this);
+			if (left != type)
+				emit(Reduction::IntToDouble, Type::Double);
+
+			node.right()->visit(*this);
+			if (right != type)
+				emit(Reduction::IntToDouble, Type::Double);
+
+			emit(opcode, type);
+			--depth_;
+		}
+
+		virtual void visit(UnaryExprNode & node)
+		{
+			if (node.kind() != Token::sub)
+			{
+				valid_ = false;
+				return;
+			}
+
+			node.operand()->visit(*this);
+			emit(Reduction::Neg, expression_type(node.operand()));
+		}
+
+		virtual void visit(IntLitNode & node)
+		{
+			Value value;
+			value.as_int = node.value();
+			push(Reduction::LoadConst, Type::Int, value);
+		}
+
+		virtual void visit(DoubleLitNode & node)
+		{
+			Value value;
+			value.as_double = node.value();
+			push(Reduction::LoadConst, Type::Double, value);
+		}
+
+		virtual void visit(LoadNode & node)
+		{
+			Variable * const var = node.variable();
+			if (var == loop_.variable())
+			{
+				push(Reduction::LoadIndex, Type::Int, Value());
+				return;
+			}
+
+			if (var == reduction_.accumulator_ || (var->type() != Type::Int && var->type() != Type::Double))
+			{
+				valid_ = false;
+				return;
+			}
+
+			std::vector<Variable *> & invariants = reduction_.invariants_;
+			std::size_t const slot = std::find(invariants.begin(), invariants.end(), var) - invariants.begin();
+			if (slot == invariants.size())
+				invariants.push_back(var);
+
+			push(Reduction::LoadInvariant, var->type(), Value(), slot);
+		}
+
+		#define REJECT(n)						\
+			virtual void visit(n &)				\
+			{ valid_ = false; }
+		REJECT(Block)
+		REJECT(StringLitNode)
+		REJECT(StoreNode)
+		REJECT(LetNode)
+		REJECT(ForNode)
+		REJECT(WhileNode)
+		REJECT(NativeCallNode)
+		REJECT(ReturnNode)
+		REJECT(IfNode)
+		REJECT(CallNode)
+		REJECT(PrintNode)
+		#undef REJECT
+
+	private:
+		Reduction & reduction_;
+		ForNode const & loop_;
+		std::size_t depth_;
+		bool valid_;
+
+		void emit(Reduction::Opcode opcode, Type type, Value value = Value(), std::size_t slot = 0)
+		{
+			Reduction::Instruction const insn = { opcode, type, value, slot };
+			reduction_.code_.push_back(insn);
+		}
+
+		void push(Reduction::Opcode opcode, Type type, Value value, std::size_t slot = 0)
+		{
+			if (++depth_ > Reduction::max_depth)
+				valid_ = false;
+			emit(opcode, type, value, slot);
+		}
+	};
+
+	Reduction::Reduction(Variable * acc, Token::Kind kind, bool reassociates)
+		: accumulator_(acc)
+		, kind_(kind)
+		, reassociates_(reassociates)
+	{ }
+
+	std::unique_ptr<Reduction> Reduction::recognize(ForNode & loop, bool fast_math)
+	{
+		if (!loop.is_counted() || loop.writes_variable() || loop.body()->size() != 1)
+			return nullptr;
+
+		StoreNode * const store = dynamic_cast<StoreNode *>(loop.body()->at(0));
+		if (!store)
+			return nullptr;
+
+		Variable * const acc = store->variable();
+		if (acc == loop.variable() || (acc->type() != Type::Int && acc->type() != Type::Double))
+			return nullptr;
+
+		Token::Kind kind = store->kind();
+		ASTNode * expr = store->expression();
+		if (kind == Token::assign)
+		{
+			/* acc = acc + expr, acc = expr + acc or acc = acc - expr */
+			BinaryExprNode * const binary = dynamic_cast<BinaryExprNode *>(expr);
+			if (!binary)
+				return nullptr;
+
+			LoadNode const * const left = dynamic_cast<LoadNode const *>(binary->left());
+			LoadNode const * const right = dynamic_cast<LoadNode const *>(binary->right());
+			bool const left_acc = left && left->variable() == acc;
+			bool const right_acc = right && right->variable() == acc;
+
+			if (binary->kind() == Token::add && left_acc)
+				expr = binary->right();
+			else if (binary->kind() == Token::add && right_acc)
+				expr = binary->left();
+			else if (binary->kind() == Token::sub && left_acc)
+				expr = binary->right();
+			else
+				return nullptr;
+
+			kind = (binary->kind() == Token::add) ? Token::incrset : Token::decrset;
+		}
+
+		bool const reassociates = acc->type() == Type::Int || fast_math;
+		std::unique_ptr<Reduction> reduction(new Reduction(acc, kind, reassociates));
+		if (!ReductionCompiler(*reduction, loop).compile(expr, acc->type()))
+			return nullptr;
+
+		return reduction;
+	}
+
+	Variable * Reduction::accumulator() const noexcept
+	{ return accumulator_; }
+
+	Token::Kind Reduction::kind() const noexcept
+	{ return kind_; }
+
+	bool Reduction::reassociates() const noexcept
+	{ return reassociates_; }
+
+	std::size_t Reduction::invariants_number() const noexcept
+	{ return invariants_.size(); }
+
+	Variable * Reduction::invariant_at(std::size_t index) const noexcept
+	{ return invariants_.at(index); }
+
+	namespace detail
+	{
+
+		static Lanes evaluate(std::vector<Reduction::Instruction> const & code,
+								std::uint64_t index, Value const * invariants) noexcept
+		{
+			Lanes stack[Reduction::max_depth];
+			std::size_t top = 0;
+
+			for (Reduction::Instruction const & insn : code)
+			{
+				bool const is_int = insn.type == Type::Int;
+				switch (insn.opcode)
+				{
+				case Reduction::LoadIndex:
+					stack[top++].as_int = lane_offsets + index;
+					break;
+				case Reduction::LoadConst:
+				case Reduction::LoadInvariant:
+				{
+					Value const value = (insn.opcode == Reduction::LoadConst) ? insn.value : invariants[insn.slot];
+					if (is_int)
+						stack[top++].as_int = IntLanes{} + static_cast<std::uint64_t>(value.as_int);
+					else
+						stack[top++].as_double = DoubleLanes{} + value.as_double;
+					break;
+				}
+				case Reduction::IntToDouble:
+					stack[top - 1].as_double = __builtin_convertvector(reinterpret_cast<SignedLanes &>(stack[top - 1].as_int), DoubleLanes);
+					break;
+				case Reduction::Add:
+					--top;
+					if (is_int)
+						stack[top - 1].as_int += stack[top].as_int;
+					else
+						stack[top - 1].as_double += stack[top].as_double;
+					break;
+				case Reduction::Sub:
+					--top;
+					if (is_int)
+						stack[top - 1].as_int -= stack[top].as_int;
+					else
+						stack[top - 1].as_double -= stack[top].as_double;
+					break;
+				case Reduction::Mul:
+					--top;
+					if (is_int)
+						stack[top - 1].as_int *= stack[top].as_int;
+					else
+						stack[top - 1].as_double *= stack[top].as_double;
+					break;
+				case Reduction::Div:
+					--top;
+					stack[top - 1].as_double /= stack[top].as_double;
+					break;
+				case Reduction::Neg:
+					if (is_int)
+						stack[top - 1].as_int = -stack[top - 1].as_int;
+					else
+						stack[top - 1].as_double = -stack[top - 1].as_double;
+					break;
+				}
+			}
+
+			assert(top == 1);
+			return stack[0];
+		}
+
+	}
+
+	Value Reduction::run(Value acc, std::int64_t from, std::int64_t to, Value const * invariants) const noexcept
+	{
+		RangeCounter const counter(from, to);
+		if (counter.done())
+			return acc;
+
+		bool const is_int = accumulator_->type() == Type::Int;
+		bool const negate = kind_ == Token::decrset;
+
+		std::uint64_t sum = static_cast<std::uint64_t>(acc.as_int);
+		double dsum = acc.as_double;
+
+		detail::Lanes partial;
+		if (is_int)
+			partial.as_int = detail::IntLanes{};
+		else
+			partial.as_double = detail::DoubleLanes{};
+
+		/* left is the trip count minus one, so INT64_MIN..INT64_MAX fits */
+		std::uint64_t left = counter.last_index();
+		std::uint64_t index = static_cast<std::uint64_t>(from);
+		std::size_t tail = 0;
+
+		for (;;)
+		{
+			if (left < lanes - 1)
+			{
+				tail = static_cast<std::size_t>(left) + 1;
+				break;
+			}
+
+			detail::Lanes const values = detail::evaluate(code_, index, invariants);
+			if (is_int)
+				partial.as_int += values.as_int;
+			else if (reassociates_)
+				partial.as_double += values.as_double;
+			else
+				for (std::size_t lane = 0; lane != lanes; ++lane)
+					dsum = negate ? dsum - values.as_double[lane] : dsum + values.as_double[lane];
+
+			if (left == lanes - 1)
+				break;
+
+			left -= lanes;
+			index += lanes;
+		}
+
+		if (tail)
+		{
+			detail::Lanes const values = detail::evaluate(code_, index, invariants);
+			for (std::size_t lane = 0; lane != tail; ++lane)
+			{
+				if (is_int)
+					sum = negate ? sum - values.as_int[lane] : sum + values.as_int[lane];
+				else
+					dsum = negate ? dsum - values.as_double[lane] : dsum + values.as_double[lane];
+			}
+		}
+
+		Value result;
+		if (is_int)
+		{
+			std::uint64_t total = 0;
+			for (std::size_t lane = 0; lane != lanes; ++lane)
+				total += partial.as_int[lane];
+
+			result.as_int = static_cast<std::int64_t>(negate ? sum - total : sum + total);
+		}
+		else if (reassociates_)
+		{
+			double const total = (partial.as_double[0] + partial.as_double[1]) + (partial.as_double[2] + partial.as_double[3]);
+			result.as_double = negate ? dsum - total : dsum + total;
+		}
+		else
+			result.as_double = dsum;
+
+		return result;
+	}
+
+}
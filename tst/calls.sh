@@ -0,0 +1,14 @@
+#!/bin/bash
+
+BENCH="`readlink -e $1`"
+
+# a context calls its handlers many times, what the calls hold must stay flat
+RESULT=`$BENCH --filter call --min-time 0 --threads 1`
+if [ $? -eq 0 ]
+then
+	echo "TEST calls PASSED"
+else
+	echo "$RESULT" | grep ERROR
+	echo "TEST calls FAILED"
+	exit 1
+fi
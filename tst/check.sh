@@ -0,0 +1,23 @@
+#!/bin/bash
+
+TESTER="`readlink -e $0`"
+JIT="`readlink -e $1`"
+TESTS="`dirname $TESTER`/check"
+
+INPUTS=`ls $TESTS | grep .*\.input | sed -e 's/.input//'`
+
+cd "$TESTS"
+for TEST in $INPUTS
+do
+	# a parser that never reaches the end of a broken file fails instead of hanging
+	RESULT=`timeout 10 $JIT --check "$TEST.input"`
+	EXPECTED=`cat "$TEST.output"`
+
+	if [ "$RESULT" == "$EXPECTED" ]
+	then
+		echo "TEST $TEST PASSED"
+	else
+		echo "TEST $TEST FAILED"
+		exit 1
+	fi
+done 
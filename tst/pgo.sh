@@ -0,0 +1,51 @@
+#!/bin/bash
+
+TESTER="`readlink -e $0`"
+JIT="`readlink -e $1`"
+ENGINE="$2"
+TESTS="`dirname $TESTER`/bench"
+EFFECTS="`dirname $TESTER`/pgo"
+PROFILE="`mktemp`"
+
+INPUTS=`ls $TESTS | grep .*\.input | sed -e 's/.input//'`
+
+for TEST in $INPUTS
+do
+	# the second run uses the profile of the first one and adds to it
+	$JIT --engine $ENGINE --pgo-record "$PROFILE" "$TESTS/$TEST.input" > /dev/null
+	RESULT=`$JIT --engine $ENGINE --speculate --pgo-use "$PROFILE" --pgo-record "$PROFILE" "$TESTS/$TEST.input" 2>/dev/null`
+	EXPECTED=`cat "$TESTS/$TEST.output"`
+
+	if [ "$RESULT" == "$EXPECTED" ]
+	then
+		echo "TEST $TEST ($ENGINE) PASSED"
+	else
+		echo "TEST $TEST ($ENGINE) FAILED"
+		rm -f "$PROFILE"
+		exit 1
+	fi
+done
+
+INPUTS=`ls $EFFECTS | grep .*\.input | sed -e 's/.input//'`
+
+for TEST in $INPUTS
+do
+	# the code laid out with the profile of one run and what the speculator did without and with it
+	rm -f "$PROFILE"
+	$JIT --engine $ENGINE --pgo-record "$PROFILE" "$EFFECTS/$TEST.input" > /dev/null
+	RESULT=`$JIT --engine $ENGINE --dump --pgo-use "$PROFILE" "$EFFECTS/$TEST.input"
+		$JIT --engine $ENGINE --speculate "$EFFECTS/$TEST.input" 2>&1
+		$JIT --engine $ENGINE --speculate --pgo-use "$PROFILE" "$EFFECTS/$TEST.input" 2>&1`
+	EXPECTED=`cat "$EFFECTS/$TEST.$ENGINE.output"`
+
+	if [ "$RESULT" == "$EXPECTED" ]
+	then
+		echo "TEST $TEST ($ENGINE) PASSED"
+	else
+		echo "TEST $TEST ($ENGINE) FAILED"
+		rm -f "$PROFILE"
+		exit 1
+	fi
+done
+
+rm -f "$PROFILE"
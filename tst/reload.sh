@@ -0,0 +1,23 @@
+#!/bin/bash
+
+TESTER="`readlink -e $0`"
+JIT="`readlink -e $1`"
+ENGINE="$2"
+TESTS="`dirname $TESTER`/reload"
+
+INPUTS=`ls $TESTS | grep .*\.0\.input | sed -e 's/.0.input//'`
+
+cd "$TESTS"
+for TEST in $INPUTS
+do
+	RESULT=`$JIT --engine $ENGINE --reload $TEST.*.input`
+	EXPECTED=`cat "$TEST.$ENGINE.output"`
+
+	if [ "$RESULT" == "$EXPECTED" ]
+	then
+		echo "TEST $TEST ($ENGINE) PASSED"
+	else
+		echo "TEST $TEST ($ENGINE) FAILED"
+		exit 1
+	fi
+done 
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+TESTER="`readlink -e $0`"
+JIT="`readlink -e $1`"
+TESTS="`dirname $TESTER`/reparse"
+
+INPUTS=`ls $TESTS | grep .*\.0\.input | sed -e 's/.0.input//'`
+
+cd "$TESTS"
+for TEST in $INPUTS
+do
+	RESULT=`$JIT --reparse $TEST.*.input`
+	EXPECTED=`cat "$TEST.output"`
+
+	if [ "$RESULT" == "$EXPECTED" ]
+	then
+		echo "TEST $TEST PASSED"
+	else
+		echo "TEST $TEST FAILED"
+		exit 1
+	fi
+done 
@@ -0,0 +1,24 @@
+#!/bin/bash
+
+TESTER="`readlink -e $0`"
+JIT="`readlink -e $1`"
+ENGINE="$2"
+shift 2
+FLAGS="$@"
+TESTS="`dirname $TESTER`/bench"
+
+INPUTS=`ls $TESTS | grep .*\.input | sed -e 's/.input//'`
+
+for TEST in $INPUTS
+do
+	RESULT=`$JIT --engine $ENGINE $FLAGS "$TESTS/$TEST.input" 2>/dev/null`
+	EXPECTED=`cat "$TESTS/$TEST.output"`
+
+	if [ "$RESULT" == "$EXPECTED" ]
+	then
+		echo "TEST $TEST ($ENGINE${FLAGS:+ $FLAGS}) PASSED"
+	else
+		echo "TEST $TEST ($ENGINE${FLAGS:+ $FLAGS}) FAILED"
+		exit 1
+	fi
+done 